@@ -27,6 +27,11 @@ typedef int (*mln_alloc_shm_lock_cb_t)(void *);
 #define M_ALLOC_SHM_LARGE_SIZE   (1*1024+512)*1024
 #define M_ALLOC_SHM_DEFAULT_SIZE 2*1024*1024
 
+#define M_ALLOC_ARENA_SLAB_SIZE  (64*1024)
+#define M_ALLOC_ARENA_LARGE_SIZE (M_ALLOC_ARENA_SLAB_SIZE >> 2)
+
+#define M_ALLOC_STATS_SITES      16
+
 typedef struct mln_alloc_s       mln_alloc_t;
 typedef struct mln_alloc_mgr_s   mln_alloc_mgr_t;
 typedef struct mln_alloc_chunk_s mln_alloc_chunk_t;
@@ -45,19 +50,33 @@ struct mln_alloc_shm_attr_s {
  * It seems that we can not set bit variables those summary not enough aligned bytes
  * at the end of structure.
  * But in Linux, no such kind of problem.
+ *
+ * 'pool' must be the last field, it is the word right before the user memory.
+ * Arena memory has only mln_alloc_arena_hdr_t as its header, whose 'pool'
+ * is this word, see mln_alloc_arena_m().
  */
 typedef struct mln_alloc_blk_s {
     struct mln_alloc_blk_s   *prev;
     struct mln_alloc_blk_s   *next;
-    mln_alloc_t              *pool;
     void                     *data;
     mln_alloc_chunk_t        *chunk;
     mln_size_t                blk_size;
     mln_size_t                is_large:1;
     mln_size_t                in_used:1;
     mln_size_t                padding:30;
+    mln_alloc_t              *pool;
 } mln_alloc_blk_t;
 
+typedef struct {
+    mln_size_t                size;/*requested size, for mln_alloc_re*/
+    mln_alloc_t              *pool;/*must be the last field as well*/
+} mln_alloc_arena_hdr_t;
+
+typedef struct mln_alloc_slab_s {
+    struct mln_alloc_slab_s  *next;
+    mln_size_t                size;
+} mln_alloc_slab_t;
+
 struct mln_alloc_chunk_s {
     struct mln_alloc_chunk_s *prev;
     struct mln_alloc_chunk_s *next;
@@ -75,8 +94,48 @@ struct mln_alloc_mgr_s {
     mln_alloc_blk_t          *used_tail;
     mln_alloc_chunk_t        *chunk_head;
     mln_alloc_chunk_t        *chunk_tail;
+    /*statistics*/
+    mln_size_t                nr_used;
+    mln_size_t                nr_used_hwm;
+    mln_size_t                nr_chunk;
+    mln_u64_t                 nr_alloc;
 };
 
+typedef struct {
+    void                     *addr;/*return address of the caller*/
+    mln_u64_t                 count;
+    mln_u64_t                 bytes;
+} mln_alloc_site_t;
+
+typedef struct {
+    mln_size_t                blk_size;
+    mln_size_t                used;/*live blocks*/
+    mln_size_t                used_hwm;
+    mln_size_t                cached;/*free blocks kept in chunks*/
+    mln_size_t                chunks;
+    mln_u64_t                 allocs;
+} mln_alloc_class_stats_t;
+
+typedef struct {
+    mln_size_t                live_bytes;
+    mln_size_t                live_bytes_hwm;
+    mln_size_t                cached_bytes;
+    mln_size_t                large_nr;
+    mln_size_t                large_bytes;
+    mln_alloc_class_stats_t   classes[M_ALLOC_MGR_LEN];
+    /*arena*/
+    mln_size_t                slabs;
+    mln_size_t                slab_bytes;
+    /*shared memory*/
+    mln_size_t                shm_blocks;
+    mln_size_t                shm_free_bytes;
+    mln_size_t                shm_largest_free;
+    mln_u32_t                 shm_frag;/*percentage of free space not in the largest free run*/
+    /*call-site sampling*/
+    mln_u32_t                 nr_sites;
+    mln_alloc_site_t          sites[M_ALLOC_STATS_SITES];
+} mln_alloc_stats_t;
+
 typedef struct mln_alloc_shm_s {
     struct mln_alloc_shm_s   *prev;
     struct mln_alloc_shm_s   *next;
@@ -99,18 +158,53 @@ struct mln_alloc_s {
     HANDLE                    map_handle;
 #endif
     struct mln_alloc_s       *parent;
+    /*
+     * thread cache: 'owner' is the owner thread's tag (NULL if not a cache),
+     * 'remote_free' is a lock-free stack of blocks freed by other threads.
+     */
+    void                     *owner;
+    void                     *remote_free;
     mln_alloc_mgr_t           mgr_tbl[M_ALLOC_MGR_LEN];
     mln_alloc_chunk_t        *large_used_head;
     mln_alloc_chunk_t        *large_used_tail;
     mln_alloc_shm_t          *shm_head;
     mln_alloc_shm_t          *shm_tail;
+    /*arena mode*/
+    mln_u8ptr_t               arena_pos;
+    mln_u8ptr_t               arena_end;
+    mln_alloc_slab_t         *slab_head;
+    mln_alloc_slab_t         *slab_cur;
+    mln_alloc_slab_t         *slab_large;
+    mln_u32_t                 arena:1;
+    /*statistics*/
+    mln_size_t                live_bytes;
+    mln_size_t                live_bytes_hwm;
+    mln_size_t                large_nr;
+    mln_size_t                large_bytes;
+    mln_u32_t                 sample_rate;
+    mln_u32_t                 sample_cnt;
+    void                     *sample_site;
+    mln_alloc_site_t         *sites;
 };
 
 
 #define mln_alloc_is_shm(pool) (pool->mem != NULL)
+/*shared pools (shm pools with lock callbacks) are locked by their sub-pools*/
+#define mln_alloc_is_shared(pool) (pool->lock != NULL)
+#define mln_alloc_is_arena(pool) (pool->arena)
 
 extern mln_alloc_t *mln_alloc_shm_init(struct mln_alloc_shm_attr_s *attr);
 extern mln_alloc_t *mln_alloc_init(mln_alloc_t *parent);
+extern mln_alloc_t *mln_alloc_tcache_init(mln_alloc_t *parent);
+extern mln_alloc_t *mln_alloc_arena_init(mln_alloc_t *parent);
+extern void mln_alloc_reset(mln_alloc_t *pool);
+extern void mln_alloc_stats(mln_alloc_t *pool, mln_alloc_stats_t *stats);
+/*
+ * Call sites are taken from __builtin_return_address(0) inside the allocator,
+ * so with MLN_FUNC_FLAG every sample records the MLN_FUNC wrapper of
+ * mln_alloc_m/c/re instead of the caller and all samples fall into one site.
+ */
+extern int mln_alloc_stats_sample(mln_alloc_t *pool, mln_u32_t rate);
 extern void mln_alloc_destroy(mln_alloc_t *pool);
 extern void *mln_alloc_m(mln_alloc_t *pool, mln_size_t size);
 extern void *mln_alloc_c(mln_alloc_t *pool, mln_size_t size);
@@ -0,0 +1,91 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#ifndef __MLN_BTREE_H
+#define __MLN_BTREE_H
+
+#include "mln_types.h"
+
+/*
+ * In-memory B+tree.
+ * Elements are kept in leaves which are linked in order, inner nodes only
+ * route. data[i] (i > 0) of an inner node is the smallest element under
+ * child[i], data[0] is unused. Duplicated elements are allowed.
+ */
+#define M_BTREE_ORDER     32
+#define M_BTREE_MIN       (M_BTREE_ORDER >> 1)
+#define M_BTREE_MAX_DEPTH 24
+
+typedef struct mln_btree_node_s mln_btree_node_t;
+
+/*
+ * >0 -- the first argument greater than the second.
+ * ==0 -- equal.
+ * <0 -- less.
+ */
+typedef int (*btree_cmp)(const void *, const void *);
+typedef void (*btree_free_data)(void *);
+typedef int (*btree_iterate_handler)(void *data, void *udata);
+typedef void *(*btree_pool_alloc_handler)(void *, mln_size_t);
+typedef void (*btree_pool_free_handler)(void *);
+
+struct mln_btree_attr {
+    void                      *pool;
+    btree_pool_alloc_handler   pool_alloc;
+    btree_pool_free_handler    pool_free;
+    btree_cmp                  cmp;
+    btree_free_data            data_free;
+};
+
+struct mln_btree_node_s {
+    mln_u32_t                  leaf:1;
+    mln_u32_t                  nr:31;/*number of elements or children*/
+    struct mln_btree_node_s   *prev;/*leaves only*/
+    struct mln_btree_node_s   *next;/*leaves only*/
+    void                      *data[M_BTREE_ORDER];
+    /*inner nodes only, leaves are allocated without it*/
+    struct mln_btree_node_s   *child[M_BTREE_ORDER];
+};
+
+typedef struct {
+    void                      *pool;
+    btree_pool_alloc_handler   pool_alloc;
+    btree_pool_free_handler    pool_free;
+    btree_cmp                  cmp;
+    btree_free_data            data_free;
+    mln_btree_node_t          *root;
+    mln_btree_node_t          *head;/*the first leaf*/
+    mln_btree_node_t          *tail;/*the last leaf*/
+    mln_uauto_t                nr_data;
+    mln_u32_t                  height;
+} mln_btree_t;
+
+/*
+ * Iterator, it is invalidated by inserting and removing.
+ */
+typedef struct {
+    mln_btree_node_t          *leaf;
+    mln_u32_t                  idx;
+} mln_btree_iter_t;
+
+#define mln_btree_nr_data(t)   ((t)->nr_data)
+
+extern mln_btree_t *mln_btree_new(struct mln_btree_attr *attr) __NONNULL1(1);
+extern void mln_btree_free(mln_btree_t *t);
+extern void mln_btree_reset(mln_btree_t *t) __NONNULL1(1);
+extern int mln_btree_insert(mln_btree_t *t, void *data) __NONNULL2(1,2);
+extern int mln_btree_load(mln_btree_t *t, void **data, mln_size_t n) __NONNULL1(1);
+extern void *mln_btree_search(mln_btree_t *t, void *key) __NONNULL2(1,2);
+extern void *mln_btree_remove(mln_btree_t *t, void *key) __NONNULL2(1,2);
+extern void *mln_btree_lower_bound(mln_btree_t *t, void *key, mln_btree_iter_t *it) __NONNULL3(1,2,3);
+extern void *mln_btree_upper_bound(mln_btree_t *t, void *key, mln_btree_iter_t *it) __NONNULL3(1,2,3);
+extern void *mln_btree_first(mln_btree_t *t, mln_btree_iter_t *it) __NONNULL2(1,2);
+extern void *mln_btree_last(mln_btree_t *t, mln_btree_iter_t *it) __NONNULL2(1,2);
+extern void *mln_btree_next(mln_btree_iter_t *it) __NONNULL1(1);
+extern void *mln_btree_prev(mln_btree_iter_t *it) __NONNULL1(1);
+extern int mln_btree_iterate(mln_btree_t *t, btree_iterate_handler handler, void *udata) __NONNULL2(1,2);
+
+#endif
+
@@ -11,6 +11,21 @@
 #include "mln_alloc.h"
 #include "mln_file.h"
 
+/*
+ * Shared buffer.
+ * One copy of data referenced by the mln_buf_t of many connections, e.g.
+ * a frame broadcast to all of them. The creator holds the first reference,
+ * every mln_buf_t made by mln_buf_shared_ref holds another one, dropped
+ * when the buffer is released. The data is freed with the last reference.
+ * The counter is atomic, so the connections may belong to different
+ * threads, but the data must not be modified once shared.
+ */
+typedef struct mln_buf_shared_s {
+    mln_uauto_t         refs;
+    mln_size_t          size;
+    mln_u8ptr_t         data;/*follows this structure*/
+} mln_buf_shared_t;
+
 typedef struct mln_buf_s {
     mln_u8ptr_t         left_pos;
     mln_u8ptr_t         pos;
@@ -18,6 +33,7 @@ typedef struct mln_buf_s {
     mln_u8ptr_t         start;
     mln_u8ptr_t         end;
     struct mln_buf_s   *shadow;
+    mln_buf_shared_t   *shared;/*the shared buffer referenced, the memory is not ours*/
     mln_off_t           file_left_pos;
     mln_off_t           file_pos;
     mln_off_t           file_last;
@@ -58,11 +74,31 @@ typedef struct mln_chain_s {
     }\
 }
 
+#define mln_buf_shared_data(psb) ((psb)->data)
+#define mln_buf_shared_size(psb) ((psb)->size)
+#define mln_buf_shared_refs(psb) __atomic_load_n(&((psb)->refs), __ATOMIC_RELAXED)
+
 extern mln_buf_t *mln_buf_new(mln_alloc_t *pool);
 extern mln_chain_t *mln_chain_new(mln_alloc_t *pool);
 extern void mln_buf_pool_release(mln_buf_t *b);
 extern void mln_chain_pool_release(mln_chain_t *c);
 extern void mln_chain_pool_release_all(mln_chain_t *c);
+/*
+ * Create a shared buffer of size bytes, data is copied into it if not NULL.
+ * Its memory comes from malloc, not from any pool, so it may outlive the
+ * connections it is sent to.
+ */
+extern mln_buf_shared_t *mln_buf_shared_new(void *data, mln_size_t size);
+/*
+ * Drop a reference, the one returned by mln_buf_shared_new included.
+ */
+extern void mln_buf_shared_free(mln_buf_shared_t *sb);
+/*
+ * Make an in-memory buffer from pool holding a reference of sb.
+ * The whole data is in [pos, last), and only the buffer structure is
+ * freed by mln_buf_pool_release.
+ */
+extern mln_buf_t *mln_buf_shared_ref(mln_alloc_t *pool, mln_buf_shared_t *sb) __NONNULL2(1,2);
 
 
 #endif
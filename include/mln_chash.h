@@ -0,0 +1,70 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#ifndef __MLN_CHASH_H
+#define __MLN_CHASH_H
+
+#include "mln_types.h"
+#include "mln_hash.h"
+
+/*
+ * Concurrent hash table.
+ * Keys are spread over a power-of-2 number of shards by the high bits of
+ * the hash value. Each shard is a mln_hash_t guarded by its own reader-writer
+ * spin lock, so lookups on the same shard run in parallel and writers only
+ * block one shard. Writers are preferred, new readers wait for them.
+ */
+#define M_CHASH_DFL_SHARDS 16
+#define M_CHASH_MAX_SHARDS 65536
+#define M_CHASH_CACHELINE  64
+
+typedef struct mln_chash_s mln_chash_t;
+
+typedef struct {
+    mln_hash_t               hash;/*must be the first member*/
+    mln_uauto_t              lock;/*bit 0: writer, others: readers * 2*/
+    mln_chash_t             *ch;
+} __attribute__((aligned(M_CHASH_CACHELINE))) mln_chash_shard_t;
+
+struct mln_chash_s {
+    /*
+     * The hash callback receives &base. Like mln_hash_flat_t, its len is
+     * M_HASH_FLAT_SPACE, so 'x % h->len' still works, unless full_hash is set.
+     */
+    mln_hash_t               base;
+    mln_chash_shard_t       *shards;/*cache line aligned, so no two shards share a line*/
+    void                    *shards_mem;/*the block holding shards, it is what gets freed*/
+    mln_u64_t                mask;/*number of shards - 1*/
+};
+
+extern mln_chash_t *
+mln_chash_new(struct mln_hash_attr *attr, mln_u32_t nr_shards) __NONNULL1(1);
+extern void
+mln_chash_free(mln_chash_t *ch, mln_hash_flag_t flg);
+extern void *
+mln_chash_search(mln_chash_t *ch, void *key) __NONNULL2(1,2);
+/*
+ * mln_chash_access():
+ * Call handler(h, key, val, udata) on the entry under the shard's read lock.
+ * Return -1 if not found, otherwise the return value of handler.
+ */
+extern int
+mln_chash_access(mln_chash_t *ch, void *key, hash_iterate_handler handler, void *udata) __NONNULL3(1,2,3);
+extern int
+mln_chash_insert(mln_chash_t *ch, void *key, void *val) __NONNULL2(1,2);
+/*
+ * mln_chash_update():
+ * Same as mln_hash_update, key and val are second rank pointers.
+ */
+extern int
+mln_chash_update(mln_chash_t *ch, void *key, void *val) __NONNULL3(1,2,3);
+extern void
+mln_chash_remove(mln_chash_t *ch, void *key, mln_hash_flag_t flg) __NONNULL2(1,2);
+extern int
+mln_chash_iterate(mln_chash_t *ch, hash_iterate_handler handler, void *udata) __NONNULL1(1);
+extern mln_u64_t mln_chash_nr_nodes(mln_chash_t *ch) __NONNULL1(1);
+
+#endif
+
@@ -11,6 +11,7 @@
 #include <sys/socket.h>
 #endif
 #include <sys/types.h>
+#include <limits.h>
 #include "mln_types.h"
 #include "mln_chain.h"
 #include "mln_alloc.h"
@@ -34,6 +35,44 @@
 #define M_C_TYPE_MEMORY 0x1
 #define M_C_TYPE_FILE   0x2
 
+/*
+ * Memory receiving buffers are sized between M_C_RCV_MIN and M_C_RCV_MAX.
+ * The size is doubled when a read fills all the space offered, and halved
+ * when a read uses no more than a quarter of it. A read fills the room left
+ * in the tail buffer first, then a new buffer, in one readv.
+ */
+#define M_C_RCV_MIN 4096
+#define M_C_RCV_MAX 65536
+/*
+ * Receiving into files goes socket -> pipe -> file by splice if MLN_SPLICE
+ * is defined, at most M_C_SPLICE_SIZE bytes at a time. Data appended to the
+ * file of the tail buffer filled by the last read extends that buffer.
+ */
+#define M_C_SPLICE_SIZE 262144
+/*
+ * Sending: consecutive memory buffers are sent by one sendmsg, at most
+ * M_C_IOV_MAX of them, file buffers by sendfile. MSG_MORE is given if a
+ * file buffer follows, and the socket is corked while a file buffer is
+ * sent with data behind it, until mln_tcp_conn_send returns.
+ * If MSG_ZEROCOPY is enabled by mln_tcp_conn_zerocopy_set, batches of at
+ * least zc_min bytes are sent with it. Their chains are kept in the zc
+ * list until the kernel reports the completion on the error queue, and
+ * only then moved to the sent queue.
+ */
+#if defined(IOV_MAX)
+#define M_C_IOV_MAX IOV_MAX
+#else
+#define M_C_IOV_MAX 1024
+#endif
+#define M_C_ZEROCOPY_MIN 16384
+
+struct mln_tcp_conn_zc_s {
+    mln_u64_t                  first;/*index of the first chain this send touched*/
+    mln_u32_t                  seq;
+    mln_u32_t                  done;
+    struct mln_tcp_conn_zc_s  *next;
+};
+
 typedef struct {
     mln_alloc_t *pool;
     mln_chain_t *rcv_head;
@@ -42,6 +81,19 @@ typedef struct {
     mln_chain_t *snd_tail;
     mln_chain_t *sent_head;
     mln_chain_t *sent_tail;
+    mln_buf_t   *rcv_buf;/*the last buffer received into, data may be appended*/
+    mln_u8ptr_t  rcv_spare;/*a buffer allocated but not used by the last read*/
+    mln_u32_t    rcv_spare_size;
+    mln_u32_t    rcv_size;/*size of the next receiving buffer*/
+    int          rcv_pipe[2];/*for splice, created on demand*/
+    mln_chain_t *zc_head;/*sent by MSG_ZEROCOPY, waiting for completion*/
+    mln_chain_t *zc_tail;
+    struct mln_tcp_conn_zc_s *zc_wait_head;
+    struct mln_tcp_conn_zc_s *zc_wait_tail;
+    mln_u64_t    zc_in;/*index of the next chain added to the zc list*/
+    mln_u64_t    zc_out;/*index of the head of the zc list*/
+    mln_u32_t    zc_seq;
+    mln_u32_t    zc_min;/*0 means MSG_ZEROCOPY is off*/
     int          sockfd;
 } mln_tcp_conn_t;
 
@@ -52,6 +104,7 @@ typedef struct {
 #define mln_tcp_conn_fd_get(pconn) ((pconn)->sockfd)
 #define mln_tcp_conn_fd_set(pconn,fd) (pconn)->sockfd = (fd)
 #define mln_tcp_conn_pool_get(pconn) ((pconn)->pool)
+#define mln_tcp_conn_zerocopy_pending(pconn) ((pconn)->zc_wait_head != NULL)
 extern int mln_tcp_conn_init(mln_tcp_conn_t *tc, int sockfd) __NONNULL1(1);
 extern void mln_tcp_conn_destroy(mln_tcp_conn_t *tc);
 extern void
@@ -67,6 +120,24 @@ extern mln_chain_t *mln_tcp_conn_pop(mln_tcp_conn_t *tc, int type) __NONNULL1(1)
 extern mln_chain_t *mln_tcp_conn_tail(mln_tcp_conn_t *tc, int type) __NONNULL1(1);
 extern int mln_tcp_conn_send(mln_tcp_conn_t *tc) __NONNULL1(1);
 extern int mln_tcp_conn_recv(mln_tcp_conn_t *tc, mln_u32_t flag) __NONNULL1(1);
+/*
+ * Append data received by a completion, e.g. the arguments of an ev_recv_handler
+ * set by mln_event_recv_set, to the receive queue. n is the length of data,
+ * 0 for EOF or -errno. data is copied, so it may be reused after return.
+ * return value: M_C_NOTYET - data queued   M_C_CLOSED - n is 0   M_C_ERROR - n < 0 or no memory
+ */
+extern int mln_tcp_conn_recv_feed(mln_tcp_conn_t *tc, mln_u8ptr_t data, int n) __NONNULL1(1);
+/*
+ * min: the least bytes of a batch sent with MSG_ZEROCOPY, 0 turns it off.
+ * return value: 0 - on success   -1 - not supported by the system or socket
+ */
+extern int mln_tcp_conn_zerocopy_set(mln_tcp_conn_t *tc, mln_u32_t min) __NONNULL1(1);
+/*
+ * Read the completions on the error queue, and move the chains completed
+ * from the zc list to the sent queue. Also called by mln_tcp_conn_send.
+ * return value: 0 - on success   -1 - on error
+ */
+extern int mln_tcp_conn_zerocopy_reap(mln_tcp_conn_t *tc) __NONNULL1(1);
 
 #endif
 
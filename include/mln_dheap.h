@@ -0,0 +1,261 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#ifndef __MLN_DHEAP_H
+#define __MLN_DHEAP_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "mln_types.h"
+
+/*
+ * Array-backed d-ary minimum heap.
+ * Each node records its index in the array, so decrease-key and delete
+ * are O(log n) without searching, and nodes can be embedded in user
+ * structures so that nothing but the array itself is allocated.
+ */
+#define M_DHEAP_ARITY   4
+#define M_DHEAP_INIT    64 /*initial array length*/
+#define M_DHEAP_NIL     ((mln_size_t)-1) /*the index of a node not in heap*/
+
+/*
+ * the same as fheap_cmp
+ * return value: 0 - p1 < p2   !0 - p1 >= p2
+ */
+typedef int (*dheap_cmp)(const void *, const void *);
+/*
+ * the left argument is the destination and the right
+ * one is the source.
+ */
+typedef void (*dheap_copy)(void *, void *);
+typedef void (*dheap_key_free)(void *);
+typedef void *(*dheap_pool_alloc_handler)(void *, mln_size_t);
+typedef void (*dheap_pool_free_handler)(void *);
+
+struct mln_dheap_attr {
+    void                     *pool;
+    dheap_pool_alloc_handler  pool_alloc;
+    dheap_pool_free_handler   pool_free;
+    dheap_cmp                 cmp;
+    dheap_copy                copy;
+    dheap_key_free            key_free;
+};
+
+typedef struct {
+    void                     *key;
+    mln_size_t                idx;
+    mln_u32_t                 nofree:1;
+} mln_dheap_node_t;
+
+typedef struct {
+    mln_dheap_node_t        **nodes;
+    mln_size_t                num;
+    mln_size_t                len;
+    dheap_cmp                 cmp;
+    dheap_copy                copy;
+    dheap_key_free            key_free;
+    void                     *pool;
+    dheap_pool_alloc_handler  pool_alloc;
+    dheap_pool_free_handler   pool_free;
+} mln_dheap_t;
+
+/*
+ * for internal
+ */
+static inline void
+mln_dheap_sift_up(mln_dheap_t *dh, mln_size_t i, dheap_cmp cmp)
+{
+    mln_dheap_node_t **nodes = dh->nodes, *node = nodes[i], *p;
+    mln_size_t pi;
+
+    while (i > 0) {
+        pi = (i - 1) / M_DHEAP_ARITY;
+        p = nodes[pi];
+        if (cmp(node->key, p->key)) break;
+        nodes[i] = p;
+        p->idx = i;
+        i = pi;
+    }
+    nodes[i] = node;
+    node->idx = i;
+}
+
+static inline void
+mln_dheap_sift_down(mln_dheap_t *dh, mln_size_t i, dheap_cmp cmp)
+{
+    mln_dheap_node_t **nodes = dh->nodes, *node = nodes[i], *c;
+    mln_size_t ci, j, end, num = dh->num;
+
+    while ((ci = i * M_DHEAP_ARITY + 1) < num) {
+        end = ci + M_DHEAP_ARITY;
+        if (end > num) end = num;
+        for (j = ci + 1; j < end; ++j) {
+            if (!cmp(nodes[j]->key, nodes[ci]->key)) ci = j;
+        }
+        c = nodes[ci];
+        if (cmp(c->key, node->key)) break;
+        nodes[i] = c;
+        c->idx = i;
+        i = ci;
+    }
+    nodes[i] = node;
+    node->idx = i;
+}
+
+static inline int mln_dheap_grow(mln_dheap_t *dh)
+{
+    mln_size_t len = dh->len? dh->len << 1: M_DHEAP_INIT;
+    mln_dheap_node_t **nodes;
+
+    if (dh->pool != NULL)
+        nodes = (mln_dheap_node_t **)dh->pool_alloc(dh->pool, len * sizeof(mln_dheap_node_t *));
+    else
+        nodes = (mln_dheap_node_t **)malloc(len * sizeof(mln_dheap_node_t *));
+    if (nodes == NULL) return -1;
+
+    if (dh->nodes != NULL) {
+        memcpy(nodes, dh->nodes, dh->num * sizeof(mln_dheap_node_t *));
+        if (dh->pool != NULL) dh->pool_free(dh->nodes);
+        else free(dh->nodes);
+    }
+    dh->nodes = nodes;
+    dh->len = len;
+    return 0;
+}
+
+/*
+ * remove the node at index i
+ */
+static inline void
+mln_dheap_remove_at(mln_dheap_t *dh, mln_size_t i, dheap_cmp cmp)
+{
+    mln_dheap_node_t *last;
+
+    dh->nodes[i]->idx = M_DHEAP_NIL;
+    if (i == --(dh->num)) return;
+    last = dh->nodes[dh->num];
+    dh->nodes[i] = last;
+    if (i > 0 && !cmp(last->key, dh->nodes[(i - 1) / M_DHEAP_ARITY]->key))
+        mln_dheap_sift_up(dh, i, cmp);
+    else
+        mln_dheap_sift_down(dh, i, cmp);
+}
+
+#define mln_dheap_inline_insert(dh, dn, compare) ({\
+    dheap_cmp cmp = (dheap_cmp)(compare);\
+    if (cmp == NULL) cmp = (dh)->cmp;\
+    int r = 0;\
+    if ((dh)->num >= (dh)->len && mln_dheap_grow((dh)) < 0) {\
+        r = -1;\
+    } else {\
+        (dh)->nodes[(dh)->num] = (dn);\
+        mln_dheap_sift_up((dh), ((dh)->num)++, cmp);\
+    }\
+    r;\
+})
+
+#define mln_dheap_inline_extract_min(dh, compare) ({\
+    dheap_cmp cmp = (dheap_cmp)(compare);\
+    if (cmp == NULL) cmp = (dh)->cmp;\
+    mln_dheap_node_t *z = NULL;\
+    if ((dh)->num) {\
+        z = (dh)->nodes[0];\
+        mln_dheap_remove_at((dh), 0, cmp);\
+    }\
+    z;\
+})
+
+#define mln_dheap_inline_decrease_key(dh, node, k, cpy, compare) ({\
+    dheap_cmp cmp = (dheap_cmp)(compare);\
+    if (cmp == NULL) cmp = (dh)->cmp;\
+    dheap_copy cp = (dheap_copy)(cpy);\
+    if (cp == NULL) cp = (dh)->copy;\
+    int r = 0;\
+    if (!cmp((node)->key, (k))) {\
+        r = -1;\
+    } else {\
+        cp((node)->key, (k));\
+        mln_dheap_sift_up((dh), (node)->idx, cmp);\
+    }\
+    r;\
+})
+
+#define mln_dheap_inline_delete(dh, node, compare) ({\
+    dheap_cmp cmp = (dheap_cmp)(compare);\
+    if (cmp == NULL) cmp = (dh)->cmp;\
+    mln_dheap_remove_at((dh), (node)->idx, cmp);\
+})
+
+#define mln_dheap_inline_node_free(dh, dn, freer) ({\
+    dheap_key_free f = (dheap_key_free)(freer);\
+    if (f == NULL) f = (dh)->key_free;\
+    if ((dn) != NULL) {\
+        if (f != NULL && (dn)->key != NULL)\
+            f((dn)->key);\
+        if (!(dn)->nofree) {\
+           if ((dh)->pool != NULL) (dh)->pool_free((dn));\
+           else free((dn));\
+        }\
+    }\
+})
+
+#define mln_dheap_inline_free(dh, freer) ({\
+    if ((dh) != NULL) {\
+        mln_size_t i;\
+        for (i = 0; i < (dh)->num; ++i) {\
+            mln_dheap_inline_node_free((dh), (dh)->nodes[i], freer);\
+        }\
+        if ((dh)->pool != NULL) {\
+            if ((dh)->nodes != NULL) (dh)->pool_free((dh)->nodes);\
+            (dh)->pool_free((dh));\
+        } else {\
+            free((dh)->nodes);\
+            free((dh));\
+        }\
+    }\
+})
+
+#define mln_dheap_node_init(dn, k) ({\
+    (dn)->key = (k);\
+    (dn)->idx = M_DHEAP_NIL;\
+    (dn)->nofree = 1;\
+    (dn);\
+})
+
+
+/*
+ * external
+ */
+#define mln_dheap_node_key(node)   ((node)->key)
+#define mln_dheap_minimum(dh)      ((dh)->num? (dh)->nodes[0]: NULL)
+#define mln_dheap_num(dh)          ((dh)->num)
+
+extern mln_dheap_t *
+mln_dheap_new(struct mln_dheap_attr *attr);
+extern void
+mln_dheap_free(mln_dheap_t *dh);
+/*
+ * return value: -1 - the array can not be extended   0 - on success
+ */
+extern int
+mln_dheap_insert(mln_dheap_t *dh, mln_dheap_node_t *dn) __NONNULL2(1,2);
+extern mln_dheap_node_t *
+mln_dheap_extract_min(mln_dheap_t *dh) __NONNULL1(1);
+/*
+ * return value: -1 - key error   0 - on success
+ */
+extern int
+mln_dheap_decrease_key(mln_dheap_t *dh, mln_dheap_node_t *node, void *key) __NONNULL3(1,2,3);
+extern void
+mln_dheap_delete(mln_dheap_t *dh, mln_dheap_node_t *node) __NONNULL2(1,2);
+
+/*mln_dheap_node_t*/
+extern mln_dheap_node_t *
+mln_dheap_node_new(mln_dheap_t *dh, void *key) __NONNULL2(1,2);
+extern void
+mln_dheap_node_free(mln_dheap_t *dh, mln_dheap_node_t *dn) __NONNULL1(1);
+
+#endif
+
@@ -8,6 +8,10 @@
 
 #if defined(MLN_EPOLL)
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#if defined(MLN_IOURING)
+#include <linux/io_uring.h>
+#endif
 #elif defined(MLN_KQUEUE)
 #include <sys/event.h>
 #else
@@ -28,6 +32,17 @@
 /*common*/
 #define M_EV_HASH_LEN 64
 #define M_EV_EPOLL_SIZE 1024 /*already ignored, see man epoll_create*/
+#define M_EV_FD_TBL_LEN 1024
+#define M_EV_URING_ENTRIES 4096
+#define M_EV_URING_IGNORE ((mln_u64_t)-1)
+#define M_EV_URING_BUF_NUM 512 /*buffers in the provided buffer ring, a power of 2*/
+#define M_EV_RECV_BUF_SIZE 8192 /*size of a buffer given to ev_recv_handler*/
+/*for timing wheel*/
+#define M_EV_WHEEL_BITS 8
+#define M_EV_WHEEL_SIZE (1 << M_EV_WHEEL_BITS)
+#define M_EV_WHEEL_MASK (M_EV_WHEEL_SIZE - 1)
+#define M_EV_WHEEL_LEVEL 4
+#define M_EV_WHEEL_TICK_MS 1
 /*for fd*/
 #define M_EV_RECV ((mln_u32_t)0x1)
 #define M_EV_SEND ((mln_u32_t)0x2)
@@ -41,7 +56,11 @@
 #define M_EV_FD_MASK ((mln_u32_t)0xff)
 #define M_EV_UNLIMITED -1
 #define M_EV_UNMODIFIED -2
-/*for epool, kqueue, select*/
+/*
+ * for epool, kqueue, select
+ * The dispatcher waits until the earliest timer or fd timeout, but never longer
+ * than M_EV_TIMEOUT_* if other threads may set events or a dispatch callback is set.
+ */
 #define M_EV_TIMEOUT_US        7000 /*7ms*/
 #define M_EV_TIMEOUT_MS        7
 #define M_EV_TIMEOUT_NS        7000000 /*7ms*/
@@ -51,10 +70,19 @@
 
 typedef struct mln_event_s      mln_event_t;
 typedef struct mln_event_desc_s mln_event_desc_t;
-typedef mln_fheap_node_t        mln_event_timer_t;
+typedef struct mln_event_desc_s mln_event_timer_t;
 
 typedef void (*ev_fd_handler)  (mln_event_t *, int, void *);
 typedef void (*ev_tm_handler)  (mln_event_t *, void *);
+/*
+ * connfd: the accepted descriptor, or -errno if accept failed.
+ */
+typedef void (*ev_accept_handler) (mln_event_t *, int fd, int connfd, void *);
+/*
+ * n > 0: n bytes received in buf, which is only valid until the handler returns.
+ * n == 0: the peer closed the connection, n < 0: -errno. buf is NULL in both cases.
+ */
+typedef void (*ev_recv_handler) (mln_event_t *, int fd, mln_u8ptr_t buf, int n, void *);
 /*
  * return value: 0 - no active, 1 - active
  */
@@ -65,6 +93,12 @@ enum mln_event_type {
     M_EV_TM,
 };
 
+typedef struct {
+    ev_accept_handler        accept_handler;
+    ev_recv_handler          recv_handler;
+    void                    *data;
+} mln_event_fd_ms_t;
+
 typedef struct mln_event_fd_s {
     int                      fd;
     mln_u32_t                active_flag;
@@ -74,7 +108,8 @@ typedef struct mln_event_fd_s {
     mln_u32_t                rd_oneshot:1;
     mln_u32_t                wr_oneshot:1;
     mln_u32_t                err_oneshot:1;
-    mln_u32_t                padding:26;
+    mln_u32_t                ms_done:1;/*the multishot recv got EOF or an error*/
+    mln_u32_t                padding:25;
     void                    *rcv_data;
     ev_fd_handler            rcv_handler;
     void                    *snd_data;
@@ -85,14 +120,89 @@ typedef struct mln_event_fd_s {
     ev_fd_handler            timeout_handler;
     mln_fheap_node_t        *timeout_node;
     mln_u64_t                end_us;
+    mln_event_fd_ms_t        ms;/*set by mln_event_accept_set and mln_event_recv_set*/
+#if defined(MLN_IOURING)
+    mln_u32_t                uring_mask;/*poll mask armed in the ring, 0 if none*/
+    mln_u32_t                uring_gen;
+    mln_u64_t                uring_ms_ud;/*user_data of the multishot request armed, 0 if none*/
+#endif
 } mln_event_fd_t;
 
 typedef struct mln_event_tm_s {
     void                    *data;
     ev_tm_handler            handler;
     mln_uauto_t              end_tm;/*us*/
+    mln_fheap_node_t        *node;/*only used by heap mode*/
 } mln_event_tm_t;
 
+/*
+ * nolock: the event is owned by the thread calling mln_event_dispatch.
+ *         No other thread will touch it, so all locks are skipped.
+ * timer_wheel: timers and fd timeouts are kept in hierarchical timing wheels
+ *              instead of fibonacci heaps, insert/cancel/re-arm are O(1).
+ * timer_tick_ms: wheel granularity, timers expiring in the same tick are
+ *                fired together. 0 means M_EV_WHEEL_TICK_MS.
+ * precise_timer: epoll only, wait for the next deadline by a timerfd with
+ *                microsecond precision instead of the millisecond epoll timeout.
+ * iouring: epoll only, use the io_uring backend if it is built in and the kernel
+ *          supports it. Descriptors set by mln_event_accept_set and
+ *          mln_event_recv_set get multishot requests, all others get single-shot
+ *          polls, which are slower than epoll_wait, so it is off by default.
+ */
+struct mln_event_attr {
+    mln_u32_t                nolock;
+    mln_u32_t                timer_wheel;
+    mln_u32_t                timer_tick_ms;
+    mln_u32_t                precise_timer;
+    mln_u32_t                iouring;
+};
+
+typedef struct mln_event_wheel_slot_s {
+    mln_event_desc_t        *head;
+    mln_event_desc_t        *tail;
+} mln_event_wheel_slot_t;
+
+typedef struct {
+    mln_u64_t                base_us;
+    mln_u64_t                tick_us;
+    mln_u64_t                cur;/*next tick to be processed*/
+    mln_uauto_t              nr;/*entries in slots*/
+    mln_event_wheel_slot_t   expired;
+    mln_event_wheel_slot_t   slots[M_EV_WHEEL_LEVEL][M_EV_WHEEL_SIZE];
+} mln_event_wheel_t;
+
+#if defined(MLN_IOURING)
+typedef struct {
+    int                      fd;
+    mln_u32_t                gen;
+    mln_u32_t                sq_entries;
+    mln_u32_t                sq_mask;
+    mln_u32_t                cq_mask;
+    mln_u32_t               *sq_head;
+    mln_u32_t               *sq_tail;
+    mln_u32_t               *sq_array;
+    mln_u32_t               *cq_head;
+    mln_u32_t               *cq_tail;
+    struct io_uring_sqe     *sqes;
+    struct io_uring_cqe     *cqes;
+    void                    *sq_ptr;
+    void                    *cq_ptr;
+    size_t                   sq_sz;
+    size_t                   cq_sz;
+    size_t                   sqes_sz;
+    struct io_uring_cqe     *ms_q;/*multishot completions waiting for their handlers*/
+    mln_u32_t                ms_mask;
+    mln_u32_t                ms_head;
+    mln_u32_t                ms_tail;
+    mln_u32_t                no_ms:1;/*the kernel has no multishot accept/recv*/
+    mln_u32_t                br_tried:1;
+    mln_u32_t                padding:30;
+    mln_u16_t                br_tail;
+    struct io_uring_buf_ring *br;/*provided buffer ring, group 0*/
+    mln_u8ptr_t              bufs;/*M_EV_URING_BUF_NUM buffers of M_EV_RECV_BUF_SIZE, NULL if not registered*/
+} mln_event_uring_t;
+#endif
+
 struct mln_event_desc_s {
     struct mln_event_desc_s *prev;
     struct mln_event_desc_s *next;
@@ -104,6 +214,12 @@ struct mln_event_desc_s {
         mln_event_tm_t       tm;
         mln_event_fd_t       fd;
     } data;
+    struct mln_event_desc_s *tw_prev;
+    struct mln_event_desc_s *tw_next;
+    mln_event_wheel_slot_t  *tw_slot;
+#if !defined(MLN_EPOLL) && !defined(MLN_KQUEUE)
+    mln_rbtree_node_t        fd_node;/*node of ev_fd_tree*/
+#endif
 };
 
 struct mln_event_s {
@@ -113,10 +229,18 @@ struct mln_event_s {
     dispatch_callback        callback;
     void                    *callback_data;
     mln_u32_t                is_break:1;
-    mln_u32_t                padding:31;
+    mln_u32_t                nolock:1;
+    mln_u32_t                timer_wheel:1;
+    mln_u32_t                padding:29;
+    mln_u64_t                nr_wakeups;
+    mln_u64_t                nr_idle_wakeups;
 #if defined(MLN_EPOLL)
     int                      epollfd;
     int                      unusedfd;
+    int                      timerfd;
+#if defined(MLN_IOURING)
+    mln_event_uring_t       *uring;/*NULL if io_uring is unavailable, epoll is used*/
+#endif
 #elif defined(MLN_KQUEUE)
     int                      kqfd;
     int                      unusedfd;
@@ -127,19 +251,29 @@ struct mln_event_s {
     fd_set                   err_set;
 #endif
 
+#if defined(MLN_EPOLL) || defined(MLN_KQUEUE)
+    mln_event_desc_t       **ev_fd_tbl;/*indexed by fd*/
+    mln_u32_t                ev_fd_tbl_len;
+#else
     mln_rbtree_t            *ev_fd_tree;
+#endif
     mln_event_desc_t        *ev_fd_wait_head;
     mln_event_desc_t        *ev_fd_wait_tail;
     mln_event_desc_t        *ev_fd_active_head;
     mln_event_desc_t        *ev_fd_active_tail;
     mln_fheap_t             *ev_fd_timeout_heap;
     mln_fheap_t             *ev_timer_heap;
+    mln_event_wheel_t       *ev_fd_timeout_wheel;
+    mln_event_wheel_t       *ev_timer_wheel;
 };
 
 #define mln_event_break_set(ev) ((ev)->is_break = 1);
 #define mln_event_break_reset(ev) ((ev)->is_break = 0);
+#define mln_event_wakeups(ev) ((ev)->nr_wakeups)
+#define mln_event_idle_wakeups(ev) ((ev)->nr_idle_wakeups)
 #define mln_event_signal_set signal
 extern mln_event_t *mln_event_new(void);
+extern mln_event_t *mln_event_new_attr(struct mln_event_attr *attr);
 extern void mln_event_free(mln_event_t *ev);
 extern void mln_event_dispatch(mln_event_t *event) __NONNULL1(1);
 /*
@@ -161,6 +295,20 @@ mln_event_timer_set(mln_event_t *event, \
                     void *data, \
                     ev_tm_handler tm_handler) __NONNULL1(1);
 extern void mln_event_timer_cancel(mln_event_t *event, mln_event_timer_t *timer) __NONNULL1(1);
+/*
+ * Call handler with every connection accepted on the listening fd.
+ * The io_uring backend uses one multishot accept, the others accept until EAGAIN
+ * when fd is readable. fd is set non-blocking.
+ */
+extern int mln_event_accept_set(mln_event_t *event, int fd, void *data, ev_accept_handler handler) __NONNULL1(1);
+/*
+ * Call handler with the data received on fd.
+ * The io_uring backend uses one multishot recv taking buffers from a provided
+ * buffer ring, the others recv once into a stack buffer when fd is readable.
+ * Both are cleared by mln_event_fd_set with M_EV_CLR, and replaced by an
+ * M_EV_RECV handler. fd is set non-blocking.
+ */
+extern int mln_event_recv_set(mln_event_t *event, int fd, void *data, ev_recv_handler handler) __NONNULL1(1);
 extern void
 mln_event_fd_timeout_handler_set(mln_event_t *event, \
                                  int fd, \
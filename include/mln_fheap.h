@@ -221,6 +221,7 @@ mln_fheap_remove_child(mln_fheap_node_t **root)
             mln_fheap_add_child(&((fh)->root_list), child);\
             child->parent = NULL;\
         }\
+        z->degree = 0;\
         mln_fheap_node_t *right = z->right;\
         mln_fheap_del_child(&((fh)->root_list), z);\
         if (z == right) {\
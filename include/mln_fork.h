@@ -15,6 +15,40 @@
 #define M_F_TYPELEN   sizeof(mln_u32_t)
 #define M_F_LENLEN    sizeof(mln_u32_t)
 
+/*
+ * Shared memory channel between master and a forked worker, enabled by
+ * 'ipc_shm_size' in the main domain (needs eventfd and mmap).
+ * Each direction is a single-producer single-consumer ring of records
+ *     [length 4bytes|type 4bytes|content Nbytes|padding to 8 bytes]
+ * A record never wraps, a length of M_F_SHM_WRAP tells the consumer
+ * to go on from the beginning of the ring. The producer rings the eventfd
+ * doorbell only when the ring was empty, the consumer drains the whole
+ * ring for one doorbell and hands the content to the ipc handler in place.
+ */
+#define M_F_SHM_CACHELINE 64
+#define M_F_SHM_ALIGN     8
+#define M_F_SHM_HDRLEN    (M_F_TYPELEN+M_F_LENLEN)
+#define M_F_SHM_WRAP      ((mln_u32_t)-1)
+
+typedef struct {
+    char                     pad_0[M_F_SHM_CACHELINE];
+    mln_u64_t                head;/*consumer*/
+    char                     pad_1[M_F_SHM_CACHELINE-sizeof(mln_u64_t)];
+    mln_u64_t                tail;/*producer*/
+    char                     pad_2[M_F_SHM_CACHELINE-sizeof(mln_u64_t)];
+    mln_u64_t                size;
+    mln_u8ptr_t              data;
+} mln_fork_shm_ring_t;
+
+typedef struct {
+    void                    *mem;/*shared anonymous mapping holding both rings*/
+    mln_size_t               size;
+    mln_fork_shm_ring_t     *to_worker;
+    mln_fork_shm_ring_t     *to_master;
+    int                      worker_fd;/*doorbell of to_worker*/
+    int                      master_fd;/*doorbell of to_master*/
+} mln_fork_shm_t;
+
 typedef struct mln_fork_s mln_fork_t;
 
 typedef void (*clr_handler)(void *);
@@ -49,6 +83,8 @@ struct mln_fork_attr {
     pid_t                    pid;
     enum proc_exec_type      etype;
     enum proc_state_type     stype;
+    mln_sauto_t              worker_no;
+    mln_fork_shm_t          *shm;
 };
 
 struct mln_fork_s {
@@ -65,6 +101,8 @@ struct mln_fork_s {
     void                    *msg_content;
     enum proc_exec_type      etype;
     enum proc_state_type     stype;
+    mln_sauto_t              worker_no;/*-1 if not a worker process*/
+    mln_fork_shm_t          *shm;/*NULL if no shared memory channel*/
 };
 
 extern int mln_fork_prepare(void);
@@ -86,6 +124,11 @@ mln_fork_spawn(enum proc_state_type stype, \
                mln_event_t *master_ev);
 extern int
 mln_fork_restart(mln_event_t *master_ev);
+/*
+ * The number of the current worker process, from 0 to worker_proc-1.
+ * -1 in the master process and the processes started by 'proc_exec'.
+ */
+extern mln_sauto_t mln_fork_worker_no(void);
 extern void
 mln_fork_master_events_set(mln_event_t *ev) __NONNULL1(1);
 extern void
@@ -109,6 +152,20 @@ mln_ipc_worker_send_prepare(mln_event_t *ev, \
                             mln_u32_t type, \
                             void *msg, \
                             mln_size_t len) __NONNULL2(1,3);
+/*
+ * Send a message through the shared memory channel, the handlers are the
+ * same as the ones of socketpair messages.
+ * return value: 0 - on success   -1 - no channel, message too long or ring full
+ * Messages sent by these and by *_send_prepare are not ordered with each other.
+ */
+extern int
+mln_ipc_master_shm_send(mln_fork_t *f_child, mln_u32_t type, void *msg, mln_size_t len) __NONNULL1(1);
+extern int
+mln_ipc_worker_shm_send(mln_u32_t type, void *msg, mln_size_t len);
+extern void
+mln_ipc_shm_handler_master(mln_event_t *ev, int fd, void *data);
+extern void
+mln_ipc_shm_handler_worker(mln_event_t *ev, int fd, void *data);
 
 #endif
 #endif
@@ -6,10 +6,22 @@
 #define __MLN_FRAMEWORK_H
 
 #include "mln_event.h"
+#include "mln_alloc.h"
+
+#define M_FRAMEWORK_ACCEPT_BATCH 64
 
 typedef int (*mln_framework_init_t)(void);
 #if !defined(WIN32)
 typedef void (*mln_framework_process_t)(mln_event_t *);
+typedef void (*mln_framework_accept_t)(mln_event_t *, int, void *);
+
+typedef struct mln_framework_listener_s {
+    int                              fd;
+    mln_framework_accept_t           handler;
+    void                            *data;
+    mln_u64_t                        accepted;
+    struct mln_framework_listener_s *next;
+} mln_framework_listener_t;
 #endif
 
 struct mln_framework_attr {
@@ -24,4 +36,10 @@ struct mln_framework_attr {
 };
 
 extern int mln_framework_init(struct mln_framework_attr *attr) __NONNULL1(1);
+#if !defined(WIN32)
+extern int
+mln_framework_listen(mln_event_t *ev, char *host, char *service, mln_framework_accept_t handler, void *data) __NONNULL3(1,3,4);
+extern int mln_framework_status(char *buf, mln_size_t size);
+extern void mln_framework_status_pool_set(mln_alloc_t *pool);
+#endif
 #endif
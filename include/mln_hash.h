@@ -8,10 +8,29 @@
 
 #include "mln_types.h"
 
-typedef struct mln_hash_s     mln_hash_t;
-typedef struct mln_hash_mgr_s mln_hash_mgr_t;
+/*
+ * Open addressing table (Robin Hood hashing with backward shift deletion).
+ * The callbacks receive the embedded mln_hash_t whose len is M_HASH_FLAT_SPACE,
+ * so a callback written as 'x % h->len' yields a 32-bit hash value.
+ */
+#define M_HASH_FLAT_SPACE    0xfffffffbULL /*the largest 32-bit prime*/
+#define M_HASH_FLAT_MIN_SIZE 8
+#define M_HASH_FLAT_MAX_NODES 0xfffffffeULL /*keeps the probe distance + 1 within 32 bits*/
+/*
+ * Incremental resizing moves at most M_HASH_MIGRATE_STEP buckets
+ * (and visits at most 10 times as many empty ones) per operation.
+ */
+#define M_HASH_MIGRATE_STEP  4
+
+typedef struct mln_hash_s      mln_hash_t;
+typedef struct mln_hash_mgr_s  mln_hash_mgr_t;
+typedef struct mln_hash_flat_s mln_hash_flat_t;
 
 typedef int (*hash_iterate_handler)(mln_hash_t * /*h*/, void * /*key*/, void * /*val*/, void *);
+/*
+ * calc_handler returns the bucket index (less than h->len), or,
+ * if full_hash is set, the whole 64-bit hash value of the key.
+ */
 typedef mln_u64_t (*hash_calc_handler)(mln_hash_t *, void *);
 /*
  * cmp_handler's return value: 0 -- not matched, !0 -- matched.
@@ -36,6 +55,8 @@ struct mln_hash_attr {
     mln_u64_t                len_base;
     mln_u32_t                expandable:1;
     mln_u32_t                calc_prime:1;
+    mln_u32_t                incremental:1;
+    mln_u32_t                full_hash:1;
     void                    *pool;
     hash_pool_alloc_handler  pool_alloc;
     hash_pool_free_handler   pool_free;
@@ -49,6 +70,7 @@ typedef struct mln_hash_entry_s {
     struct mln_hash_entry_s *iter_prev;
     struct mln_hash_entry_s *iter_next;
     mln_hash_mgr_t          *mgr;
+    mln_u64_t                hval;/*hash value, only valid with full_hash*/
     mln_hash_flag_t          remove_flag;
     mln_u32_t                removed:1;
     mln_u32_t                padding:31;
@@ -70,14 +92,42 @@ struct mln_hash_s {
     mln_u32_t                threshold;
     mln_u32_t                expandable:1;
     mln_u32_t                calc_prime:1;
+    mln_u32_t                incremental:1;
+    mln_u32_t                full_hash:1;
     void                    *pool;
     hash_pool_alloc_handler  pool_alloc;
     hash_pool_free_handler   pool_free;
+    /*the table being migrated in incremental mode*/
+    mln_hash_mgr_t          *old_tbl;
+    mln_u64_t                old_len;
+    mln_u64_t                migrate_idx;
     mln_hash_entry_t        *iter_head;
     mln_hash_entry_t        *iter_tail;
     mln_hash_entry_t        *iter;
 };
 
+typedef struct {
+    void                    *key;
+    void                    *val;
+    mln_u32_t                hash;
+    mln_u32_t                dist;/*probe distance + 1, 0 means empty*/
+    mln_u32_t                removed:1;
+    mln_u32_t                remove_flag:2;
+    mln_u32_t                padding:29;
+} mln_hash_slot_t;
+
+struct mln_hash_flat_s {
+    mln_hash_t               base;/*attributes and callbacks*/
+    mln_hash_slot_t         *slots;
+    mln_u64_t                cap;/*power of 2*/
+    mln_u64_t                min_cap;
+    mln_u64_t                nr_nodes;
+    mln_u64_t                nr_removed;
+    mln_u32_t                iterating:1;
+};
+
+#define mln_hash_flat_nr_nodes(h) ((h)->nr_nodes)
+
 extern int
 mln_hash_init(mln_hash_t *h, struct mln_hash_attr *attr) __NONNULL2(1,2);
 extern void mln_hash_destroy(mln_hash_t *h, mln_hash_flag_t flg);
@@ -107,6 +157,18 @@ extern void *
 mln_hash_change_value(mln_hash_t *h, void *key, void *new_value) __NONNULL2(1,2);
 extern int mln_hash_key_exist(mln_hash_t *h, void *key) __NONNULL2(1,2);
 extern void mln_hash_reset(mln_hash_t *h, mln_hash_flag_t flg) __NONNULL1(1);
+extern mln_hash_flat_t *
+mln_hash_flat_new(struct mln_hash_attr *attr) __NONNULL1(1);
+extern void
+mln_hash_flat_free(mln_hash_flat_t *h, mln_hash_flag_t flg);
+extern void *
+mln_hash_flat_search(mln_hash_flat_t *h, void *key) __NONNULL2(1,2);
+extern int
+mln_hash_flat_insert(mln_hash_flat_t *h, void *key, void *val) __NONNULL2(1,2);
+extern void
+mln_hash_flat_remove(mln_hash_flat_t *h, void *key, mln_hash_flag_t flg) __NONNULL2(1,2);
+extern int
+mln_hash_flat_iterate(mln_hash_flat_t *h, hash_iterate_handler handler, void *udata) __NONNULL1(1);
 
 #endif
 
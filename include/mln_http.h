@@ -108,6 +108,8 @@ struct mln_http_s {
     mln_hash_t             *header_fields;
     mln_chain_t            *body_head;
     mln_chain_t            *body_tail;
+    mln_chain_t            *hold_head;/*receive buffers referenced by the parsed strings*/
+    mln_chain_t            *hold_tail;
     mln_http_handler        body_handler;
     void                   *data;
     mln_string_t           *uri;
@@ -168,6 +170,8 @@ extern void mln_http_reset(mln_http_t *http);
  * you have processed should be freed in this callback function.
  * And the third argument of this callback function will be
  * set NULL. Just ignore it.
+ * The parsed strings refer to the input buffers, the buffers consumed
+ * are moved from 'in' to http and released by mln_http_reset().
  */
 extern int mln_http_parse(mln_http_t *http, mln_chain_t **in);
 /*
@@ -20,7 +20,6 @@ typedef void *(*mln_iothread_entry_t)(void *);
 typedef void (*mln_iothread_msg_process_t)(mln_iothread_t *, mln_iothread_ep_type_t, mln_iothread_msg_t *);
 
 struct mln_iothread_msg_s {
-    struct mln_iothread_msg_s  *prev;
     struct mln_iothread_msg_s  *next;
     mln_u32_t                   feedback:1;
     mln_u32_t                   hold:1;
@@ -37,20 +36,23 @@ struct mln_iothread_attr {
     mln_iothread_msg_process_t  handler;
 };
 
+/*
+ * io_head and user_head are lock-free stacks. Senders push messages with CAS,
+ * receivers take the whole stack away at once and handle it in FIFO order.
+ * Only the sender that finds the stack empty notifies the other side, so one
+ * wakeup covers a whole batch. The notification is sent by eventfd if
+ * MLN_EVENTFD is defined, otherwise by socketpair.
+ */
 struct mln_iothread_s {
-    pthread_mutex_t             io_lock;
-    pthread_mutex_t             user_lock;
     int                         io_fd;
     int                         user_fd;
     mln_iothread_msg_process_t  handler;
     mln_iothread_msg_t         *io_head;
-    mln_iothread_msg_t         *io_tail;
     mln_iothread_entry_t        entry;
     void                       *args;
     pthread_t                  *tids;
     mln_u32_t                   nthread;
     mln_iothread_msg_t         *user_head;
-    mln_iothread_msg_t         *user_tail;
 };
 
 #define mln_iothread_sockfd_get(p,t)   ((t) == io_thread? (p)->io_fd: (p)->user_fd)
@@ -521,6 +521,8 @@ SCOPE int PREFIX_NAME##_preprocess(struct PREFIX_NAME##_preprocess_attr *attr)\
     hattr.len_base = M_PG_DFL_HASHLEN;\
     hattr.expandable = 1;\
     hattr.calc_prime = 0;\
+    hattr.incremental = 0;\
+    hattr.full_hash = 0;\
     attr->map_tbl = mln_hash_new(&hattr);\
     if (attr->map_tbl == NULL) {\
         mln_log(error, "No memory.\n");\
@@ -191,6 +191,51 @@ rbtree_insert_fixup(mln_rbtree_t *t, mln_rbtree_node_t *n)
     ret_node;\
 })
 
+/*
+ * Intrusive mode
+ * The node is embedded in the user's structure and set up by mln_rbtree_node_init,
+ * so nothing is allocated on insertion. compare gets nodes instead of data:
+ * compare(node1, node2) on insertion and compare(key, node) on searching,
+ * and reaches the structures by mln_rbtree_entry, so no data pointer is loaded.
+ * compare can be a macro or an inline function, it is expanded in place.
+ */
+#define mln_rbtree_entry(node, type, member) mln_container_of(node, type, member)
+
+#define mln_rbtree_inline_node_insert(t, n, compare) ({\
+    mln_rbtree_t *tree = (t);\
+    mln_rbtree_node_t *y = &(tree->nil);\
+    mln_rbtree_node_t *x = tree->root;\
+    mln_rbtree_node_t *nil = &(tree->nil);\
+    int ret = 0;\
+    while (x != nil) {\
+        y = x;\
+        if ((ret = compare((n), x)) < 0) x = x->left;\
+        else x = x->right;\
+    }\
+    (n)->parent = y;\
+    if (y == nil) tree->root = (n);\
+    else if (ret < 0) y->left = (n);\
+    else y->right = (n);\
+    (n)->left = (n)->right = nil;\
+    (n)->color = M_RB_RED;\
+    rbtree_insert_fixup(tree, (n));\
+    if (tree->min == nil) tree->min = (n);\
+    else if (tree->min == y && ret < 0) tree->min = (n);\
+    ++(tree->nr_node);\
+    mln_rbtree_chain_add(&(tree->head), &(tree->tail), (n));\
+})
+
+#define mln_rbtree_inline_node_search(t, key, compare) ({\
+    mln_rbtree_t *tree = (t);\
+    mln_rbtree_node_t *ret_node = tree->root;\
+    int ret;\
+    while ((ret_node != &(tree->nil)) && ((ret = compare(key, ret_node)) != 0)) {\
+        if (ret < 0) ret_node = ret_node->left;\
+        else ret_node = ret_node->right;\
+    }\
+    ret_node;\
+})
+
 /*rbtree free node*/
 #define mln_rbtree_inline_node_free(t, n, freer) ({\
     mln_u32_t nofree = (n)->nofree;\
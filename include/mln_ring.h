@@ -0,0 +1,106 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#ifndef __MLN_RING_H
+#define __MLN_RING_H
+
+#include "mln_types.h"
+
+/*
+ * Lock-free bounded ring queues of void pointers.
+ * mln_ring_spsc_t: one producer thread and one consumer thread.
+ * mln_ring_mpmc_t: any number of producers and consumers, each slot
+ *                  carries a sequence number telling whose turn it is.
+ * The length is rounded up to a power of 2. Indexes are never wrapped,
+ * only masked, so full and empty are told apart without a spare slot.
+ * Members written by different sides are padded to separate cache lines,
+ * and the queues are allocated on a cache line boundary.
+ */
+#define M_RING_CACHELINE 64
+/*pad n word-sized members to a full cache line*/
+#define M_RING_PAD(name,n) char pad_##name[M_RING_CACHELINE - sizeof(mln_uauto_t) * (n)]
+
+typedef void (*ring_free)(void *);
+
+struct mln_ring_attr {
+    mln_uauto_t            qlen;
+    ring_free              free_handler;
+};
+
+typedef struct {
+    char                   pad_0[M_RING_CACHELINE];
+    /*consumer*/
+    mln_uauto_t            head;
+    mln_uauto_t            tail_cache;
+    M_RING_PAD(1, 2);
+    /*producer*/
+    mln_uauto_t            tail;
+    mln_uauto_t            head_cache;
+    M_RING_PAD(2, 2);
+    /*read only*/
+    mln_uauto_t            mask;
+    void                 **buf;
+    ring_free              free_handler;
+    M_RING_PAD(3, 3);
+} __attribute__((aligned(M_RING_CACHELINE))) mln_ring_spsc_t;
+
+typedef struct {
+    mln_uauto_t            seq;
+    void                  *data;
+} mln_ring_cell_t;
+
+typedef struct {
+    char                   pad_0[M_RING_CACHELINE];
+    mln_uauto_t            head;
+    M_RING_PAD(1, 1);
+    mln_uauto_t            tail;
+    M_RING_PAD(2, 1);
+    /*read only*/
+    mln_uauto_t            mask;
+    mln_ring_cell_t       *cells;
+    ring_free              free_handler;
+    M_RING_PAD(3, 3);
+} __attribute__((aligned(M_RING_CACHELINE))) mln_ring_mpmc_t;
+
+#define mln_ring_length(q) ((q)->mask + 1)
+/*
+ * mln_ring_*_element():
+ * a snapshot, it may be out of date as soon as it is returned.
+ */
+#define mln_ring_spsc_element(q) \
+    (__atomic_load_n(&((q)->tail), __ATOMIC_ACQUIRE) - __atomic_load_n(&((q)->head), __ATOMIC_ACQUIRE))
+#define mln_ring_mpmc_element(q) ({\
+    mln_uauto_t __h = __atomic_load_n(&((q)->head), __ATOMIC_ACQUIRE);\
+    mln_uauto_t __t = __atomic_load_n(&((q)->tail), __ATOMIC_ACQUIRE);\
+    __t > __h? __t - __h: 0;\
+})
+
+/*
+ * new and free must not run concurrently with other operations.
+ * free calls free_handler on the elements left in the queue.
+ */
+extern mln_ring_spsc_t *mln_ring_spsc_new(struct mln_ring_attr *attr) __NONNULL1(1);
+extern void mln_ring_spsc_free(mln_ring_spsc_t *q);
+/*
+ * return value: 0 - on success   -1 - full/empty
+ */
+extern int mln_ring_spsc_enqueue(mln_ring_spsc_t *q, void *data) __NONNULL1(1);
+extern int mln_ring_spsc_dequeue(mln_ring_spsc_t *q, void **data) __NONNULL2(1,2);
+/*
+ * Enqueue/dequeue up to n elements at once.
+ * Return the number of elements enqueued/dequeued, which may be 0.
+ */
+extern mln_uauto_t mln_ring_spsc_enqueue_bulk(mln_ring_spsc_t *q, void **data, mln_uauto_t n) __NONNULL2(1,2);
+extern mln_uauto_t mln_ring_spsc_dequeue_bulk(mln_ring_spsc_t *q, void **data, mln_uauto_t n) __NONNULL2(1,2);
+
+extern mln_ring_mpmc_t *mln_ring_mpmc_new(struct mln_ring_attr *attr) __NONNULL1(1);
+extern void mln_ring_mpmc_free(mln_ring_mpmc_t *q);
+extern int mln_ring_mpmc_enqueue(mln_ring_mpmc_t *q, void *data) __NONNULL1(1);
+extern int mln_ring_mpmc_dequeue(mln_ring_mpmc_t *q, void **data) __NONNULL2(1,2);
+extern mln_uauto_t mln_ring_mpmc_enqueue_bulk(mln_ring_mpmc_t *q, void **data, mln_uauto_t n) __NONNULL2(1,2);
+extern mln_uauto_t mln_ring_mpmc_dequeue_bulk(mln_ring_mpmc_t *q, void **data, mln_uauto_t n) __NONNULL2(1,2);
+
+#endif
+
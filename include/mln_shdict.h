@@ -0,0 +1,97 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#ifndef __MLN_SHDICT_H
+#define __MLN_SHDICT_H
+
+#include "mln_types.h"
+#include "mln_alloc.h"
+
+/*
+ * Shared memory key/value cache.
+ * Everything is allocated from a shared memory pool created by
+ * mln_alloc_shm_init, so a dictionary created before fork is read and
+ * written by all processes. Links are offsets from the beginning of the
+ * pool instead of pointers.
+ * Each bucket has its own lock and keeps its entries in LRU order. When
+ * the pool is exhausted, expired entries and then the least recently used
+ * entries of the buckets are evicted in turn.
+ * All locks are mln_spin_t words in the shared memory, locked and unlocked
+ * by the callbacks given in the attribute. The pool lock and a bucket
+ * lock are never held at the same time.
+ */
+#define M_SHDICT_DFL_BUCKETS 1024
+#define M_SHDICT_EVICT_TRIES 32 /*evictions tried before an allocation fails*/
+#define M_SHDICT_EVICT_NUM   8  /*buckets visited by one eviction at most*/
+
+struct mln_shdict_attr {
+    mln_size_t                size;/*pool size, at least M_ALLOC_SHM_DEFAULT_SIZE+1024*/
+    mln_u32_t                 nbucket;/*rounded up to a power of 2, 0 means M_SHDICT_DFL_BUCKETS*/
+    mln_alloc_shm_lock_cb_t   lock;/*NULL means mln_spin_lock*/
+    mln_alloc_shm_lock_cb_t   unlock;/*NULL means mln_spin_unlock*/
+};
+
+typedef struct {
+    mln_u64_t                 prev;
+    mln_u64_t                 next;
+    mln_u64_t                 hval;
+    mln_u64_t                 expire;/*milliseconds, 0 means never*/
+    mln_u32_t                 klen;
+    mln_u32_t                 vlen;
+    /*key and value follow*/
+} mln_shdict_entry_t;
+
+typedef struct {
+    mln_spin_t                lock;
+    mln_u64_t                 head;/*the most recently used*/
+    mln_u64_t                 tail;
+} mln_shdict_bucket_t;
+
+typedef struct {
+    mln_alloc_t              *pool;
+    mln_alloc_shm_lock_cb_t   lock;
+    mln_alloc_shm_lock_cb_t   unlock;
+    mln_spin_t                alloc_lock;/*locker of the pool*/
+    mln_u64_t                 mask;/*number of buckets - 1*/
+    mln_u64_t                 buckets;
+    mln_u64_t                 hand;/*the next bucket to evict*/
+    mln_u64_t                 nr;
+} mln_shdict_t;
+
+#define mln_shdict_num(d) __atomic_load_n(&((d)->nr), __ATOMIC_RELAXED)
+
+extern mln_shdict_t *mln_shdict_new(struct mln_shdict_attr *attr) __NONNULL1(1);
+extern void mln_shdict_free(mln_shdict_t *d);
+/*
+ * ttl is in milliseconds, 0 means never expire.
+ * return value: 0 - on success   -1 - no memory even after eviction
+ */
+extern int
+mln_shdict_set(mln_shdict_t *d, void *key, mln_u32_t klen, void *val, mln_u32_t vlen, mln_u64_t ttl) __NONNULL1(1);
+/*
+ * Copy at most size bytes of the value into buf.
+ * return value: the length of the value, -1 if not found or expired
+ */
+extern mln_s64_t
+mln_shdict_get(mln_shdict_t *d, void *key, mln_u32_t klen, void *buf, mln_u32_t size) __NONNULL1(1);
+/*
+ * return value: 0 - on success   -1 - not found
+ */
+extern int mln_shdict_delete(mln_shdict_t *d, void *key, mln_u32_t klen) __NONNULL1(1);
+/*
+ * Add delta to a mln_s64_t value, a missing key is created with delta
+ * and no ttl.
+ * return value: 0 - on success   -1 - no memory or the value is not 8 bytes
+ */
+extern int
+mln_shdict_incr(mln_shdict_t *d, void *key, mln_u32_t klen, mln_s64_t delta, mln_s64_t *result) __NONNULL1(1);
+/*
+ * Remove all expired entries.
+ * return value: the number of entries removed
+ */
+extern mln_u64_t mln_shdict_expire(mln_shdict_t *d) __NONNULL1(1);
+
+#endif
+
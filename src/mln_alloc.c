@@ -9,6 +9,15 @@
 #include <string.h>
 #include "mln_func.h"
 
+#if defined(WIN32)
+#define MLN_ALLOC_TLS __declspec(thread)
+#else
+#define MLN_ALLOC_TLS __thread
+#endif
+
+/*its address identifies the calling thread*/
+static MLN_ALLOC_TLS char mln_alloc_thread_tag;
+#define mln_alloc_thread_self() ((void *)&mln_alloc_thread_tag)
 
 MLN_CHAIN_FUNC_DECLARE(mln_blk, \
                        mln_alloc_blk_t, \
@@ -29,6 +38,15 @@ static inline int mln_alloc_shm_allowed(mln_alloc_shm_t *as, mln_off_t *Boff, ml
 static inline void *mln_alloc_shm_set_bitmap(mln_alloc_shm_t *as, mln_off_t Boff, mln_off_t boff, mln_size_t size);
 static inline mln_alloc_shm_t *mln_alloc_shm_new_block(mln_alloc_t *pool, mln_off_t *Boff, mln_off_t *boff, mln_size_t size);
 static inline void mln_alloc_free_shm(void *ptr);
+static inline void mln_alloc_tcache_remote_free(mln_alloc_t *pool, void *ptr);
+static inline void mln_alloc_tcache_drain(mln_alloc_t *pool);
+static inline void *mln_alloc_arena_m(mln_alloc_t *pool, mln_size_t size);
+static inline mln_alloc_slab_t *mln_alloc_arena_slab_new(mln_alloc_t *pool, mln_size_t size);
+static inline void mln_alloc_arena_slab_free(mln_alloc_t *pool, mln_alloc_slab_t *slab);
+static inline void mln_alloc_stats_live(mln_alloc_t *pool, mln_size_t size);
+static inline void mln_alloc_stats_site(mln_alloc_t *pool, void *addr, mln_size_t size);
+static inline void mln_alloc_stats_shm(mln_alloc_t *pool, mln_alloc_stats_t *stats);
+static inline void *mln_alloc_arena_re(mln_alloc_t *pool, void *ptr, mln_size_t size);
 
 static inline mln_alloc_shm_t * mln_alloc_shm_new (mln_alloc_t *pool, mln_size_t size, int is_large)
 {
@@ -123,14 +141,24 @@ MLN_FUNC(mln_alloc_t *, mln_alloc_shm_init, (struct mln_alloc_shm_attr_s *attr),
 
 #if defined(MLN_MMAP)
     pool = (mln_alloc_t *)mmap(NULL, attr->size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
-    if (pool == NULL) return NULL;
+    if (pool == MAP_FAILED) return NULL;
 #else
     return NULL;
 #endif
 #endif
     pool->parent = NULL;
+    pool->owner = NULL;
+    pool->remote_free = NULL;
     pool->large_used_head = pool->large_used_tail = NULL;
     pool->shm_head = pool->shm_tail = NULL;
+    pool->arena_pos = pool->arena_end = NULL;
+    pool->slab_head = pool->slab_cur = pool->slab_large = NULL;
+    pool->arena = 0;
+    pool->live_bytes = pool->live_bytes_hwm = 0;
+    pool->large_nr = pool->large_bytes = 0;
+    pool->sample_rate = pool->sample_cnt = 0;
+    pool->sample_site = NULL;
+    pool->sites = NULL;
     pool->mem = pool;
     pool->shm_size = attr->size;
     pool->locker = attr->locker;
@@ -152,11 +180,11 @@ MLN_FUNC(mln_alloc_t *, mln_alloc_init, (mln_alloc_t *parent), (parent), {
 #endif
 
     if (parent != NULL) {
-        if (mln_alloc_is_shm(parent)) {
+        if (mln_alloc_is_shared(parent)) {
             if (parent->lock(parent->locker) != 0) return NULL;
         }
         pool = (mln_alloc_t *)mln_alloc_m(parent, sizeof(mln_alloc_t));
-        if (mln_alloc_is_shm(parent)) {
+        if (mln_alloc_is_shared(parent)) {
             (void)parent->unlock(parent->locker);
         }
     } else {
@@ -165,8 +193,18 @@ MLN_FUNC(mln_alloc_t *, mln_alloc_init, (mln_alloc_t *parent), (parent), {
     if (pool == NULL) return pool;
     mln_alloc_mgr_table_init(pool->mgr_tbl);
     pool->parent = parent;
+    pool->owner = NULL;
+    pool->remote_free = NULL;
     pool->large_used_head = pool->large_used_tail = NULL;
     pool->shm_head = pool->shm_tail = NULL;
+    pool->arena_pos = pool->arena_end = NULL;
+    pool->slab_head = pool->slab_cur = pool->slab_large = NULL;
+    pool->arena = 0;
+    pool->live_bytes = pool->live_bytes_hwm = 0;
+    pool->large_nr = pool->large_bytes = 0;
+    pool->sample_rate = pool->sample_cnt = 0;
+    pool->sample_site = NULL;
+    pool->sites = NULL;
     pool->mem = NULL;
     pool->shm_size = 0;
     pool->locker = NULL;
@@ -175,6 +213,182 @@ MLN_FUNC(mln_alloc_t *, mln_alloc_init, (mln_alloc_t *parent), (parent), {
     return pool;
 })
 
+/*
+ * A thread cache is a heap pool owned by the calling thread. The owner allocates
+ * and frees without any lock, blocks are cached in the pool's size-class lists
+ * and only chunk refills go to the parent, under the parent's lock. Other threads
+ * may free blocks of the cache, these blocks are pushed onto a lock-free stack
+ * and reclaimed by the owner on its next allocation.
+ *
+ * The parent is shared by all caches, so it must be the heap (NULL) or a pool
+ * with lock callbacks. A heap pool has no lock, its own mln_alloc_m and
+ * mln_alloc_free could never take one, so it is refused.
+ */
+MLN_FUNC(mln_alloc_t *, mln_alloc_tcache_init, (mln_alloc_t *parent), (parent), {
+    mln_alloc_t *pool;
+
+    if (parent != NULL && !mln_alloc_is_shared(parent)) return NULL;
+
+    if ((pool = mln_alloc_init(parent)) == NULL) return NULL;
+    pool->owner = mln_alloc_thread_self();
+    return pool;
+})
+
+/*
+ * Only the owner pops, and it takes the whole stack at once,
+ * so the push needs no ABA protection.
+ * The link is kept in the freed memory itself.
+ */
+static inline void mln_alloc_tcache_remote_free(mln_alloc_t *pool, void *ptr)
+{
+    void *head;
+
+    do {
+        head = __atomic_load_n(&(pool->remote_free), __ATOMIC_RELAXED);
+        *(void **)ptr = head;
+    } while (!__sync_bool_compare_and_swap(&(pool->remote_free), head, ptr));
+}
+
+static inline void mln_alloc_tcache_drain(mln_alloc_t *pool)
+{
+    void *ptr, *next;
+
+    ptr = __sync_lock_test_and_set(&(pool->remote_free), NULL);
+    for (; ptr != NULL; ptr = next) {
+        next = *(void **)ptr;
+        mln_alloc_free(ptr);
+    }
+}
+
+/*
+ * An arena bump-allocates from slabs. Each allocation costs a
+ * mln_alloc_arena_hdr_t (the requested size, and the arena itself so that
+ * mln_alloc_free can recognize and ignore it) instead of a mln_alloc_blk_t.
+ * Memory is recycled all at once by mln_alloc_reset or mln_alloc_destroy.
+ */
+MLN_FUNC(mln_alloc_t *, mln_alloc_arena_init, (mln_alloc_t *parent), (parent), {
+    mln_alloc_t *pool;
+
+    if ((pool = mln_alloc_init(parent)) == NULL) return NULL;
+    pool->arena = 1;
+    return pool;
+})
+
+/*
+ * Slabs are kept and reused, only the slabs of large allocations are freed.
+ */
+MLN_FUNC_VOID(void, mln_alloc_reset, (mln_alloc_t *pool), (pool), {
+    mln_alloc_slab_t *slab;
+
+    if (!mln_alloc_is_arena(pool)) return;
+
+    while ((slab = pool->slab_large) != NULL) {
+        pool->slab_large = slab->next;
+        mln_alloc_arena_slab_free(pool, slab);
+    }
+    if ((slab = pool->slab_cur = pool->slab_head) != NULL) {
+        pool->arena_pos = (mln_u8ptr_t)(slab + 1);
+        pool->arena_end = (mln_u8ptr_t)slab + slab->size;
+    } else {
+        pool->arena_pos = pool->arena_end = NULL;
+    }
+    pool->live_bytes = 0;
+})
+
+static inline mln_alloc_slab_t *mln_alloc_arena_slab_new(mln_alloc_t *pool, mln_size_t size)
+{
+    mln_alloc_slab_t *slab;
+
+    if (pool->parent != NULL) {
+        if (mln_alloc_is_shared(pool->parent)) {
+            if (pool->parent->lock(pool->parent->locker) != 0)
+                return NULL;
+        }
+        slab = (mln_alloc_slab_t *)mln_alloc_m(pool->parent, size);
+        if (mln_alloc_is_shared(pool->parent)) {
+            (void)pool->parent->unlock(pool->parent->locker);
+        }
+    } else {
+        slab = (mln_alloc_slab_t *)malloc(size);
+    }
+    if (slab == NULL) return NULL;
+    slab->next = NULL;
+    slab->size = size;
+    return slab;
+}
+
+static inline void mln_alloc_arena_slab_free(mln_alloc_t *pool, mln_alloc_slab_t *slab)
+{
+    if (pool->parent != NULL) {
+        if (mln_alloc_is_shared(pool->parent)) {
+            if (pool->parent->lock(pool->parent->locker) != 0)
+                return;
+        }
+        mln_alloc_free(slab);
+        if (mln_alloc_is_shared(pool->parent)) {
+            (void)pool->parent->unlock(pool->parent->locker);
+        }
+    } else {
+        free(slab);
+    }
+}
+
+static inline void *mln_alloc_arena_m(mln_alloc_t *pool, mln_size_t size)
+{
+    mln_u8ptr_t ptr;
+    mln_alloc_slab_t *slab;
+    mln_alloc_arena_hdr_t *hdr;
+    mln_size_t need = sizeof(mln_alloc_arena_hdr_t) + ((size + sizeof(void *) - 1) & ~(sizeof(void *) - 1));
+
+    if ((mln_size_t)(pool->arena_end - pool->arena_pos) < need) {
+        if (need > M_ALLOC_ARENA_LARGE_SIZE) {
+            if ((slab = mln_alloc_arena_slab_new(pool, sizeof(mln_alloc_slab_t) + need)) == NULL)
+                return NULL;
+            slab->next = pool->slab_large;
+            pool->slab_large = slab;
+            ptr = (mln_u8ptr_t)(slab + 1);
+            goto out;
+        }
+        if (pool->slab_cur != NULL && pool->slab_cur->next != NULL) {
+            slab = pool->slab_cur->next;
+        } else {
+            if ((slab = mln_alloc_arena_slab_new(pool, M_ALLOC_ARENA_SLAB_SIZE)) == NULL)
+                return NULL;
+            if (pool->slab_cur == NULL) pool->slab_head = slab;
+            else pool->slab_cur->next = slab;
+        }
+        pool->slab_cur = slab;
+        pool->arena_pos = (mln_u8ptr_t)(slab + 1);
+        pool->arena_end = (mln_u8ptr_t)slab + slab->size;
+    }
+    ptr = pool->arena_pos;
+    pool->arena_pos += need;
+
+out:
+    mln_alloc_stats_live(pool, need);
+    hdr = (mln_alloc_arena_hdr_t *)ptr;
+    hdr->size = size;
+    hdr->pool = pool;
+    return hdr + 1;
+}
+
+/*
+ * 'ptr' is arena memory. Arena memory is never freed one by one, so the
+ * old block is left in place and only min(old size, new size) is copied.
+ */
+static inline void *mln_alloc_arena_re(mln_alloc_t *pool, void *ptr, mln_size_t size)
+{
+    mln_u8ptr_t new_ptr;
+    mln_alloc_arena_hdr_t *hdr = (mln_alloc_arena_hdr_t *)ptr - 1;
+    mln_size_t n = hdr->size;
+
+    if (hdr->pool == pool && n >= size) return ptr;
+
+    if ((new_ptr = mln_alloc_m(pool, size)) == NULL) return NULL;
+    memcpy(new_ptr, ptr, n < size? n: size);
+    return new_ptr;
+}
+
 static inline void mln_alloc_mgr_table_init(mln_alloc_mgr_t *tbl)
 {
     int i, j;
@@ -190,11 +404,15 @@ static inline void mln_alloc_mgr_table_init(mln_alloc_mgr_t *tbl)
         am->used_head = am->used_tail = NULL;
         am->chunk_head = am->chunk_tail = NULL;
         am->blk_size = blk_size + 1;
+        am->nr_used = am->nr_used_hwm = am->nr_chunk = 0;
+        am->nr_alloc = 0;
         if (i != 0) {
             amprev = &tbl[i-1];
             amprev->free_head = amprev->free_tail = NULL;
             amprev->used_head = amprev->used_tail = NULL;
             amprev->chunk_head = amprev->chunk_tail = NULL;
+            amprev->nr_used = amprev->nr_used_hwm = amprev->nr_chunk = 0;
+            amprev->nr_alloc = 0;
             amprev->blk_size = (am->blk_size + tbl[i-2].blk_size) >> 1;
         }
     }
@@ -204,10 +422,21 @@ MLN_FUNC_VOID(void, mln_alloc_destroy, (mln_alloc_t *pool), (pool), {
     if (pool == NULL) return;
 
     mln_alloc_t *parent = pool->parent;
-    if (parent != NULL && mln_alloc_is_shm(parent))
+    if (parent != NULL && mln_alloc_is_shared(parent))
         if (parent->lock(parent->locker) != 0)
             return;
     if (pool->mem == NULL) {
+        mln_alloc_slab_t *slab;
+        while ((slab = pool->slab_large) != NULL) {
+            pool->slab_large = slab->next;
+            if (parent != NULL) mln_alloc_free(slab);
+            else free(slab);
+        }
+        while ((slab = pool->slab_head) != NULL) {
+            pool->slab_head = slab->next;
+            if (parent != NULL) mln_alloc_free(slab);
+            else free(slab);
+        }
         mln_alloc_mgr_t *am, *amend;
         amend = pool->mgr_tbl + M_ALLOC_MGR_LEN;
         mln_alloc_chunk_t *ch;
@@ -223,6 +452,7 @@ MLN_FUNC_VOID(void, mln_alloc_destroy, (mln_alloc_t *pool), (pool), {
             if (parent != NULL) mln_alloc_free(ch);
             else free(ch);
         }
+        if (pool->sites != NULL) free(pool->sites);
         if (parent != NULL) mln_alloc_free(pool);
         else free(pool);
     } else {
@@ -236,7 +466,7 @@ MLN_FUNC_VOID(void, mln_alloc_destroy, (mln_alloc_t *pool), (pool), {
 #endif
 #endif
     }
-    if (parent != NULL && mln_alloc_is_shm(parent))
+    if (parent != NULL && mln_alloc_is_shared(parent))
         (void)parent->unlock(parent->locker);
 })
 
@@ -250,22 +480,38 @@ MLN_FUNC(void *, mln_alloc_m, (mln_alloc_t *pool, mln_size_t size), (pool, size)
     mln_u8ptr_t ptr;
     mln_size_t n;
 
+    if (pool->sample_rate) {
+        if (++(pool->sample_cnt) >= pool->sample_rate) {
+            pool->sample_cnt = 0;
+            mln_alloc_stats_site(pool, pool->sample_site != NULL? pool->sample_site: __builtin_return_address(0), size);
+        }
+        pool->sample_site = NULL;
+    }
+
     if (pool->mem != NULL) {
         return mln_alloc_shm_m(pool, size);
     }
 
+    if (mln_alloc_is_arena(pool)) {
+        return mln_alloc_arena_m(pool, size);
+    }
+
+    if (pool->owner != NULL && __atomic_load_n(&(pool->remote_free), __ATOMIC_RELAXED) != NULL) {
+        mln_alloc_tcache_drain(pool);
+    }
+
     am = mln_alloc_get_mgr_by_size(pool->mgr_tbl, size);
 
     if (am == NULL) {
         n = (size + sizeof(mln_alloc_blk_t) + sizeof(mln_alloc_chunk_t) + 3) >> 2;
         size = n << 2;
         if (pool->parent != NULL) {
-            if (mln_alloc_is_shm(pool->parent)) {
+            if (mln_alloc_is_shared(pool->parent)) {
                 if (pool->parent->lock(pool->parent->locker) != 0)
                     return NULL;
             }
             ptr = (mln_u8ptr_t)mln_alloc_c(pool->parent, size);
-            if (mln_alloc_is_shm(pool->parent)) {
+            if (mln_alloc_is_shared(pool->parent)) {
                 (void)pool->parent->unlock(pool->parent->locker);
             }
         } else {
@@ -283,6 +529,9 @@ MLN_FUNC(void *, mln_alloc_m, (mln_alloc_t *pool, mln_size_t size), (pool, size)
         blk->is_large = 1;
         blk->in_used = 1;
         ch->blks[0] = blk;
+        ++(pool->large_nr);
+        pool->large_bytes += blk->blk_size;
+        mln_alloc_stats_live(pool, blk->blk_size);
         return blk->data;
     }
 
@@ -293,12 +542,12 @@ MLN_FUNC(void *, mln_alloc_m, (mln_alloc_t *pool, mln_size_t size), (pool, size)
         n = (sizeof(mln_alloc_chunk_t) + M_ALLOC_BLK_NUM * size + 3) >> 2;
 
         if (pool->parent != NULL) {
-            if (mln_alloc_is_shm(pool->parent)) {
+            if (mln_alloc_is_shared(pool->parent)) {
                 if (pool->parent->lock(pool->parent->locker) != 0)
                     return NULL;
             }
             ptr = (mln_u8ptr_t)mln_alloc_c(pool->parent, n << 2);
-            if (mln_alloc_is_shm(pool->parent)) {
+            if (mln_alloc_is_shared(pool->parent)) {
                 (void)pool->parent->unlock(pool->parent->locker);
             }
         } else {
@@ -312,6 +561,7 @@ MLN_FUNC(void *, mln_alloc_m, (mln_alloc_t *pool, mln_size_t size), (pool, size)
         }
         ch = (mln_alloc_chunk_t *)ptr;
         ch->mgr = am;
+        ++(am->nr_chunk);
         mln_chunk_chain_add(&(am->chunk_head), &(am->chunk_tail), ch);
         ptr += sizeof(mln_alloc_chunk_t);
         for (n = 0; n < M_ALLOC_BLK_NUM; ++n) {
@@ -332,6 +582,9 @@ out:
     mln_blk_chain_add(&(am->used_head), &(am->used_tail), blk);
     blk->in_used = 1;
     ++(blk->chunk->refer);
+    ++(am->nr_alloc);
+    if (++(am->nr_used) > am->nr_used_hwm) am->nr_used_hwm = am->nr_used;
+    mln_alloc_stats_live(pool, am->blk_size);
     return blk->data;
 #endif
 })
@@ -366,6 +619,7 @@ MLN_FUNC(void *, mln_alloc_c, (mln_alloc_t *pool, mln_size_t size), (pool, size)
 #ifdef __DEBUG__
     return calloc(1, size);
 #else
+    if (pool->sample_rate) pool->sample_site = __builtin_return_address(0);
     mln_u8ptr_t ptr = mln_alloc_m(pool, size);
     if (ptr == NULL) return NULL;
     memset(ptr, 0, size);
@@ -383,6 +637,10 @@ MLN_FUNC(void *, mln_alloc_re, (mln_alloc_t *pool, void *ptr, mln_size_t size),
     }
 
     mln_alloc_blk_t *old_blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
+    if (pool->sample_rate) pool->sample_site = __builtin_return_address(0);
+    if (mln_alloc_is_arena(old_blk->pool)) {
+        return mln_alloc_arena_re(pool, ptr, size);
+    }
     if (old_blk->pool == pool && old_blk->blk_size >= size) {
         return ptr;
     }
@@ -410,24 +668,35 @@ MLN_FUNC_VOID(void, mln_alloc_free, (void *ptr), (ptr), {
     mln_alloc_blk_t *blk;
 
     blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
+    pool = blk->pool;
+    if (mln_alloc_is_arena(pool)) {
+        return;
+    }
 
     ASSERT(blk->in_used);
 
-    pool = blk->pool;
     if (pool->mem) {
         return mln_alloc_free_shm(ptr);
     }
 
+    if (pool->owner != NULL && pool->owner != mln_alloc_thread_self()) {
+        mln_alloc_tcache_remote_free(pool, ptr);
+        return;
+    }
+
     if (blk->is_large) {
+        --(pool->large_nr);
+        pool->large_bytes -= blk->blk_size;
+        pool->live_bytes -= blk->blk_size;
         mln_chunk_chain_del(&(pool->large_used_head), &(pool->large_used_tail), blk->chunk);
         if (pool->parent != NULL) {
-            if (mln_alloc_is_shm(pool->parent)) {
+            if (mln_alloc_is_shared(pool->parent)) {
                 if (pool->parent->lock(pool->parent->locker) != 0) {
                     return;
                 }
             }
             mln_alloc_free(blk->chunk);
-            if (mln_alloc_is_shm(pool->parent)) {
+            if (mln_alloc_is_shared(pool->parent)) {
                 (void)pool->parent->unlock(pool->parent->locker);
             }
         } else
@@ -437,6 +706,8 @@ MLN_FUNC_VOID(void, mln_alloc_free, (void *ptr), (ptr), {
     ch = blk->chunk;
     am = ch->mgr;
     blk->in_used = 0;
+    --(am->nr_used);
+    pool->live_bytes -= am->blk_size;
     mln_blk_chain_del(&(am->used_head), &(am->used_tail), blk);
     mln_blk_chain_add(&(am->free_head), &(am->free_tail), blk);
     if (!--(ch->refer) && ++(ch->count) > M_ALLOC_CHUNK_COUNT) {
@@ -445,14 +716,15 @@ MLN_FUNC_VOID(void, mln_alloc_free, (void *ptr), (ptr), {
             mln_blk_chain_del(&(am->free_head), &(am->free_tail), *(blks++));
         }
         mln_chunk_chain_del(&(am->chunk_head), &(am->chunk_tail), ch);
+        --(am->nr_chunk);
         if (pool->parent != NULL) {
-            if (mln_alloc_is_shm(pool->parent)) {
+            if (mln_alloc_is_shared(pool->parent)) {
                 if (pool->parent->lock(pool->parent->locker) != 0) {
                     return;
                 }
             }
             mln_alloc_free(ch);
-            if (mln_alloc_is_shm(pool->parent)) {
+            if (mln_alloc_is_shared(pool->parent)) {
                 (void)pool->parent->unlock(pool->parent->locker);
             }
         } else
@@ -503,6 +775,9 @@ static inline void *mln_alloc_shm_large_m(mln_alloc_t *pool, mln_size_t size)
     blk->chunk = (mln_alloc_chunk_t *)as;
     blk->is_large = 1;
     blk->in_used = 1;
+    ++(pool->large_nr);
+    pool->large_bytes += size;
+    mln_alloc_stats_live(pool, size);
     return blk->data;
 }
 
@@ -580,6 +855,7 @@ mln_alloc_shm_set_bitmap(mln_alloc_shm_t *as, mln_off_t Boff, mln_off_t boff, ml
     blk->padding = ((Boff & 0xffff) << 8) | (boff & 0xff);
     blk->is_large = 0;
     blk->in_used = 1;
+    mln_alloc_stats_live(as->pool, size);
     p = as->bitmap + Boff;
     pend = p + M_ALLOC_SHM_BITMAP_LEN;
     for (i = boff; p < pend;) {
@@ -605,7 +881,11 @@ static inline void mln_alloc_free_shm(void *ptr)
 
     blk = (mln_alloc_blk_t *)((mln_u8ptr_t)ptr - sizeof(mln_alloc_blk_t));
     as = (mln_alloc_shm_t *)(blk->chunk);
-    if (!as->large) {
+    as->pool->live_bytes -= blk->blk_size;
+    if (as->large) {
+        --(as->pool->large_nr);
+        as->pool->large_bytes -= blk->blk_size;
+    } else {
         Boff = (blk->padding >> 8) & 0xffff;
         boff = blk->padding & 0xff;
         blk->in_used = 0;
@@ -627,6 +907,131 @@ static inline void mln_alloc_free_shm(void *ptr)
     }
 }
 
+/*
+ * statistics
+ */
+static inline void mln_alloc_stats_live(mln_alloc_t *pool, mln_size_t size)
+{
+    if ((pool->live_bytes += size) > pool->live_bytes_hwm)
+        pool->live_bytes_hwm = pool->live_bytes;
+}
+
+/*
+ * Sites are kept in a small table searched linearly.
+ * Once the table is full, samples of new sites go to the last entry.
+ */
+static inline void mln_alloc_stats_site(mln_alloc_t *pool, void *addr, mln_size_t size)
+{
+    mln_alloc_site_t *site, *end;
+
+    if (pool->sites == NULL) return;
+    end = pool->sites + M_ALLOC_STATS_SITES - 1;
+    for (site = pool->sites; site < end; ++site) {
+        if (site->addr == addr) break;
+        if (site->addr == NULL) {
+            site->addr = addr;
+            break;
+        }
+    }
+    ++(site->count);
+    site->bytes += size;
+}
+
+MLN_FUNC(int, mln_alloc_stats_sample, (mln_alloc_t *pool, mln_u32_t rate), (pool, rate), {
+    /*the site table lives in the heap of one process*/
+    if (mln_alloc_is_shm(pool)) return -1;
+    if (rate && pool->sites == NULL) {
+        if ((pool->sites = (mln_alloc_site_t *)calloc(M_ALLOC_STATS_SITES, sizeof(mln_alloc_site_t))) == NULL)
+            return -1;
+    }
+    pool->sample_rate = rate;
+    pool->sample_cnt = 0;
+    pool->sample_site = NULL;
+    return 0;
+})
+
+static inline void mln_alloc_stats_shm(mln_alloc_t *pool, mln_alloc_stats_t *stats)
+{
+    mln_alloc_shm_t *as;
+    mln_size_t run, nfree = 0, largest = 0, i, nbits;
+    mln_u8ptr_t p = pool->mem + sizeof(mln_alloc_t);
+
+    for (as = pool->shm_head; as != NULL; as = as->next) {
+        /*the gap before this block*/
+        run = (mln_u8ptr_t)(as->addr) - p;
+        nfree += run;
+        if (run > largest) largest = run;
+        p = as->addr + as->size;
+
+        ++(stats->shm_blocks);
+        if (as->large) continue;
+        nbits = as->size / M_ALLOC_SHM_BIT_SIZE;
+        for (i = 0, run = 0; i < nbits; ++i) {
+            if (as->bitmap[i >> 3] & (1 << (7 - (i & 7)))) {
+                run = 0;
+                continue;
+            }
+            nfree += M_ALLOC_SHM_BIT_SIZE;
+            run += M_ALLOC_SHM_BIT_SIZE;
+            if (run > largest) largest = run;
+        }
+    }
+    run = (mln_u8ptr_t)(pool->mem + pool->shm_size) - p;
+    nfree += run;
+    if (run > largest) largest = run;
+
+    stats->shm_free_bytes = nfree;
+    stats->shm_largest_free = largest;
+    stats->shm_frag = nfree? (mln_u32_t)(100 - largest * 100 / nfree): 0;
+}
+
+/*
+ * Counters are maintained on the allocation paths, this function only
+ * collects them. For a shared memory pool, the caller should hold its lock.
+ */
+MLN_FUNC_VOID(void, mln_alloc_stats, (mln_alloc_t *pool, mln_alloc_stats_t *stats), (pool, stats), {
+    mln_u32_t i;
+    mln_alloc_mgr_t *am;
+    mln_alloc_slab_t *slab;
+    mln_alloc_class_stats_t *cs;
+
+    memset(stats, 0, sizeof(mln_alloc_stats_t));
+    stats->live_bytes = pool->live_bytes;
+    stats->live_bytes_hwm = pool->live_bytes_hwm;
+    stats->large_nr = pool->large_nr;
+    stats->large_bytes = pool->large_bytes;
+
+    if (mln_alloc_is_shm(pool)) {
+        mln_alloc_stats_shm(pool, stats);
+    } else {
+        for (i = 0; i < M_ALLOC_MGR_LEN; ++i) {
+            am = &(pool->mgr_tbl[i]);
+            cs = &(stats->classes[i]);
+            cs->blk_size = am->blk_size;
+            cs->used = am->nr_used;
+            cs->used_hwm = am->nr_used_hwm;
+            cs->chunks = am->nr_chunk;
+            cs->cached = am->nr_chunk * M_ALLOC_BLK_NUM - am->nr_used;
+            cs->allocs = am->nr_alloc;
+            stats->cached_bytes += cs->cached * cs->blk_size;
+        }
+        for (slab = pool->slab_head; slab != NULL; slab = slab->next) {
+            ++(stats->slabs);
+            stats->slab_bytes += slab->size;
+        }
+        for (slab = pool->slab_large; slab != NULL; slab = slab->next) {
+            ++(stats->slabs);
+            stats->slab_bytes += slab->size;
+        }
+    }
+
+    if (pool->sites != NULL) {
+        for (i = 0; i < M_ALLOC_STATS_SITES && pool->sites[i].count; ++i)
+            stats->sites[i] = pool->sites[i];
+        stats->nr_sites = i;
+    }
+})
+
 /*
  * chain
  */
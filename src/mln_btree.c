@@ -0,0 +1,557 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "mln_btree.h"
+
+typedef struct {
+    mln_btree_node_t *node;
+    mln_u32_t         idx;
+} mln_btree_path_t;
+
+static inline mln_btree_node_t *mln_btree_node_new(mln_btree_t *t, int leaf);
+static inline void mln_btree_node_free(mln_btree_t *t, mln_btree_node_t *n);
+static void mln_btree_destroy(mln_btree_t *t, mln_btree_node_t *n, int free_data);
+static inline mln_u32_t
+mln_btree_bsearch(mln_btree_t *t, mln_btree_node_t *n, mln_u32_t from, void *key, int upper);
+static inline mln_btree_node_t *
+mln_btree_descend(mln_btree_t *t, void *key, int upper, mln_btree_path_t *path);
+static inline void mln_btree_leaf_fix(mln_btree_t *t, mln_btree_path_t *path, mln_u32_t depth);
+static inline void mln_btree_inner_fix(mln_btree_t *t, mln_btree_path_t *path, mln_u32_t depth);
+
+mln_btree_t *mln_btree_new(struct mln_btree_attr *attr)
+{
+    mln_btree_t *t;
+
+    if (attr->cmp == NULL) return NULL;
+
+    if (attr->pool != NULL) {
+        t = (mln_btree_t *)attr->pool_alloc(attr->pool, sizeof(mln_btree_t));
+    } else {
+        t = (mln_btree_t *)malloc(sizeof(mln_btree_t));
+    }
+    if (t == NULL) return NULL;
+
+    t->pool = attr->pool;
+    t->pool_alloc = attr->pool_alloc;
+    t->pool_free = attr->pool_free;
+    t->cmp = attr->cmp;
+    t->data_free = attr->data_free;
+    if ((t->root = mln_btree_node_new(t, 1)) == NULL) {
+        if (t->pool != NULL) t->pool_free(t);
+        else free(t);
+        return NULL;
+    }
+    t->head = t->tail = t->root;
+    t->nr_data = 0;
+    t->height = 1;
+    return t;
+}
+
+void mln_btree_free(mln_btree_t *t)
+{
+    if (t == NULL) return;
+
+    mln_btree_destroy(t, t->root, 1);
+    if (t->pool != NULL) t->pool_free(t);
+    else free(t);
+}
+
+/*
+ * The root node is kept as an empty leaf. An inner node is larger than a leaf,
+ * so it can be reused as one.
+ */
+void mln_btree_reset(mln_btree_t *t)
+{
+    mln_btree_node_t *root = t->root;
+    mln_u32_t i;
+
+    if (root->leaf) {
+        if (t->data_free != NULL) {
+            for (i = 0; i < root->nr; ++i) t->data_free(root->data[i]);
+        }
+    } else {
+        for (i = 0; i < root->nr; ++i) mln_btree_destroy(t, root->child[i], 1);
+    }
+    root->leaf = 1;
+    root->nr = 0;
+    root->prev = root->next = NULL;
+    t->head = t->tail = root;
+    t->nr_data = 0;
+    t->height = 1;
+}
+
+static void mln_btree_destroy(mln_btree_t *t, mln_btree_node_t *n, int free_data)
+{
+    mln_u32_t i;
+
+    if (n->leaf) {
+        if (free_data && t->data_free != NULL) {
+            for (i = 0; i < n->nr; ++i) t->data_free(n->data[i]);
+        }
+    } else {
+        for (i = 0; i < n->nr; ++i) mln_btree_destroy(t, n->child[i], free_data);
+    }
+    mln_btree_node_free(t, n);
+}
+
+static inline mln_btree_node_t *mln_btree_node_new(mln_btree_t *t, int leaf)
+{
+    mln_btree_node_t *n;
+    mln_size_t size = leaf? mln_offsetof(mln_btree_node_t, child): sizeof(mln_btree_node_t);
+
+    if (t->pool != NULL) n = (mln_btree_node_t *)t->pool_alloc(t->pool, size);
+    else n = (mln_btree_node_t *)malloc(size);
+    if (n == NULL) return NULL;
+    n->leaf = leaf;
+    n->nr = 0;
+    n->prev = n->next = NULL;
+    return n;
+}
+
+static inline void mln_btree_node_free(mln_btree_t *t, mln_btree_node_t *n)
+{
+    if (t->pool != NULL) t->pool_free(n);
+    else free(n);
+}
+
+/*
+ * Return the first index i in [from, n->nr) that
+ * upper: key < data[i], otherwise: key <= data[i].
+ * n->nr is returned if not found.
+ */
+static inline mln_u32_t
+mln_btree_bsearch(mln_btree_t *t, mln_btree_node_t *n, mln_u32_t from, void *key, int upper)
+{
+    mln_u32_t lo = from, hi = n->nr, mid;
+    int ret;
+
+    while (lo < hi) {
+        mid = (lo + hi) >> 1;
+        ret = t->cmp(key, n->data[mid]);
+        if (ret < 0 || (!upper && ret == 0)) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+/*
+ * upper: go to the last child whose smallest element <= key,
+ * otherwise: go to the last child whose smallest element < key.
+ * So the leaf returned contains the last element <= key (upper),
+ * or the first element >= key is in it or at the head of the next leaf.
+ */
+static inline mln_btree_node_t *
+mln_btree_descend(mln_btree_t *t, void *key, int upper, mln_btree_path_t *path)
+{
+    mln_btree_node_t *n = t->root;
+    mln_u32_t i, depth = 0;
+
+    while (!n->leaf) {
+        i = mln_btree_bsearch(t, n, 1, key, upper) - 1;
+        if (path != NULL) {
+            path[depth].node = n;
+            path[depth].idx = i;
+        }
+        ++depth;
+        n = n->child[i];
+    }
+    return n;
+}
+
+int mln_btree_insert(mln_btree_t *t, void *data)
+{
+    mln_btree_path_t path[M_BTREE_MAX_DEPTH];
+    mln_btree_node_t *spare[M_BTREE_MAX_DEPTH + 1];
+    mln_btree_node_t *n, *r, *child;
+    void *tmp[M_BTREE_ORDER + 1], *sep;
+    mln_btree_node_t *tmpc[M_BTREE_ORDER + 1];
+    mln_u32_t pos, i, m, nr_spare = 0, need, depth = t->height - 1;
+    int d;
+
+    if (t->height >= M_BTREE_MAX_DEPTH) return -1;
+
+    n = mln_btree_descend(t, data, 1, path);
+    pos = mln_btree_bsearch(t, n, 0, data, 1);
+
+    if (n->nr < M_BTREE_ORDER) {
+        memmove(&n->data[pos + 1], &n->data[pos], (n->nr - pos) * sizeof(void *));
+        n->data[pos] = data;
+        ++(n->nr);
+        ++(t->nr_data);
+        return 0;
+    }
+
+    /*allocate all nodes needed by the splits first, so a failure leaves the tree intact*/
+    for (d = depth - 1; d >= 0 && path[d].node->nr == M_BTREE_ORDER; --d)
+        ;
+    need = depth - (d + 1);
+    for (nr_spare = 0; nr_spare <= need; ++nr_spare) {
+        spare[nr_spare] = mln_btree_node_new(t, nr_spare == 0);
+        if (spare[nr_spare] == NULL) goto err;
+    }
+    if (d < 0) {
+        if ((spare[nr_spare] = mln_btree_node_new(t, 0)) == NULL) goto err;
+        ++nr_spare;
+    }
+
+    /*split the leaf*/
+    memcpy(tmp, n->data, pos * sizeof(void *));
+    tmp[pos] = data;
+    memcpy(&tmp[pos + 1], &n->data[pos], (M_BTREE_ORDER - pos) * sizeof(void *));
+    m = (M_BTREE_ORDER + 1) >> 1;
+    r = spare[0];
+    memcpy(n->data, tmp, m * sizeof(void *));
+    n->nr = m;
+    memcpy(r->data, &tmp[m], (M_BTREE_ORDER + 1 - m) * sizeof(void *));
+    r->nr = M_BTREE_ORDER + 1 - m;
+    r->prev = n;
+    r->next = n->next;
+    if (n->next != NULL) n->next->prev = r;
+    else t->tail = r;
+    n->next = r;
+    ++(t->nr_data);
+
+    sep = r->data[0];
+    child = r;
+    for (i = 1, d = depth - 1; d >= 0; --d) {
+        n = path[d].node;
+        pos = path[d].idx + 1;
+        if (n->nr < M_BTREE_ORDER) {
+            memmove(&n->data[pos + 1], &n->data[pos], (n->nr - pos) * sizeof(void *));
+            memmove(&n->child[pos + 1], &n->child[pos], (n->nr - pos) * sizeof(mln_btree_node_t *));
+            n->data[pos] = sep;
+            n->child[pos] = child;
+            ++(n->nr);
+            return 0;
+        }
+        /*split the inner node, data[0] of the right one is pushed up*/
+        memcpy(tmp, n->data, pos * sizeof(void *));
+        memcpy(tmpc, n->child, pos * sizeof(mln_btree_node_t *));
+        tmp[pos] = sep;
+        tmpc[pos] = child;
+        memcpy(&tmp[pos + 1], &n->data[pos], (M_BTREE_ORDER - pos) * sizeof(void *));
+        memcpy(&tmpc[pos + 1], &n->child[pos], (M_BTREE_ORDER - pos) * sizeof(mln_btree_node_t *));
+        r = spare[i++];
+        memcpy(n->data, tmp, m * sizeof(void *));
+        memcpy(n->child, tmpc, m * sizeof(mln_btree_node_t *));
+        n->nr = m;
+        memcpy(r->data, &tmp[m], (M_BTREE_ORDER + 1 - m) * sizeof(void *));
+        memcpy(r->child, &tmpc[m], (M_BTREE_ORDER + 1 - m) * sizeof(mln_btree_node_t *));
+        r->nr = M_BTREE_ORDER + 1 - m;
+        sep = r->data[0];
+        child = r;
+    }
+
+    /*new root*/
+    r = spare[i];
+    r->child[0] = t->root;
+    r->child[1] = child;
+    r->data[1] = sep;
+    r->nr = 2;
+    t->root = r;
+    ++(t->height);
+    return 0;
+
+err:
+    while (nr_spare-- > 0) mln_btree_node_free(t, spare[nr_spare]);
+    return -1;
+}
+
+/*
+ * Build the tree from n elements sorted in ascending order.
+ * The tree must be empty. Nodes are filled up evenly, the leaves are
+ * allocated first, then each level of inner nodes on top of them.
+ */
+int mln_btree_load(mln_btree_t *t, void **data, mln_size_t n)
+{
+    mln_btree_node_t **level, *node, *prev = NULL;
+    void **mins;
+    mln_size_t nr_nodes, nr_child, i, j, k, cnt;
+    mln_u32_t height = 1;
+
+    if (t->nr_data) return -1;
+    if (n <= M_BTREE_ORDER) {
+        if (n) memcpy(t->root->data, data, n * sizeof(void *));
+        t->root->nr = n;
+        t->nr_data = n;
+        return 0;
+    }
+
+    nr_nodes = (n + M_BTREE_ORDER - 1) / M_BTREE_ORDER;
+    level = (mln_btree_node_t **)malloc(nr_nodes * (sizeof(mln_btree_node_t *) + sizeof(void *)));
+    if (level == NULL) return -1;
+    mins = (void **)(level + nr_nodes);
+
+    for (i = 0, k = 0; i < nr_nodes; ++i) {
+        if ((node = mln_btree_node_new(t, 1)) == NULL) {
+            nr_child = k = i;
+            goto err;
+        }
+        cnt = n / nr_nodes + (i < n % nr_nodes);
+        memcpy(node->data, &data[k], cnt * sizeof(void *));
+        node->nr = cnt;
+        k += cnt;
+        node->prev = prev;
+        if (prev != NULL) prev->next = node;
+        prev = node;
+        level[i] = node;
+        mins[i] = node->data[0];
+    }
+
+    while (nr_nodes > 1) {
+        nr_child = nr_nodes;
+        nr_nodes = (nr_child + M_BTREE_ORDER - 1) / M_BTREE_ORDER;
+        for (i = 0, k = 0; i < nr_nodes; ++i) {
+            if ((node = mln_btree_node_new(t, 0)) == NULL) goto err;
+            cnt = nr_child / nr_nodes + (i < nr_child % nr_nodes);
+            for (j = 0; j < cnt; ++j, ++k) {
+                node->child[j] = level[k];
+                node->data[j] = mins[k];
+            }
+            node->nr = cnt;
+            /*k > i, the slot has been consumed*/
+            level[i] = node;
+            mins[i] = node->data[0];
+        }
+        ++height;
+    }
+
+    mln_btree_node_free(t, t->root);
+    t->root = level[0];
+    t->head = level[0];
+    while (!t->head->leaf) t->head = t->head->child[0];
+    t->tail = prev;
+    t->height = height;
+    t->nr_data = n;
+    free(level);
+    return 0;
+
+err:
+    /*level[0, i) are built on this level, level[k, nr_child) are not consumed yet*/
+    for (j = 0; j < i; ++j) mln_btree_destroy(t, level[j], 0);
+    for (j = k; j < nr_child; ++j) mln_btree_destroy(t, level[j], 0);
+    free(level);
+    return -1;
+}
+
+void *mln_btree_search(mln_btree_t *t, void *key)
+{
+    mln_btree_node_t *n = mln_btree_descend(t, key, 1, NULL);
+    mln_u32_t pos = mln_btree_bsearch(t, n, 0, key, 1);
+
+    if (pos == 0 || t->cmp(key, n->data[pos - 1])) return NULL;
+    return n->data[pos - 1];
+}
+
+void *mln_btree_lower_bound(mln_btree_t *t, void *key, mln_btree_iter_t *it)
+{
+    mln_btree_node_t *n = mln_btree_descend(t, key, 0, NULL);
+
+    it->leaf = n;
+    it->idx = mln_btree_bsearch(t, n, 0, key, 0);
+    if (it->idx >= n->nr) {
+        it->leaf = n->next;
+        it->idx = 0;
+    }
+    return it->leaf == NULL? NULL: it->leaf->data[it->idx];
+}
+
+void *mln_btree_upper_bound(mln_btree_t *t, void *key, mln_btree_iter_t *it)
+{
+    mln_btree_node_t *n = mln_btree_descend(t, key, 1, NULL);
+
+    it->leaf = n;
+    it->idx = mln_btree_bsearch(t, n, 0, key, 1);
+    if (it->idx >= n->nr) {
+        it->leaf = n->next;
+        it->idx = 0;
+    }
+    return it->leaf == NULL? NULL: it->leaf->data[it->idx];
+}
+
+void *mln_btree_first(mln_btree_t *t, mln_btree_iter_t *it)
+{
+    it->leaf = t->nr_data? t->head: NULL;
+    it->idx = 0;
+    return it->leaf == NULL? NULL: it->leaf->data[0];
+}
+
+void *mln_btree_last(mln_btree_t *t, mln_btree_iter_t *it)
+{
+    it->leaf = t->nr_data? t->tail: NULL;
+    it->idx = it->leaf == NULL? 0: it->leaf->nr - 1;
+    return it->leaf == NULL? NULL: it->leaf->data[it->idx];
+}
+
+void *mln_btree_next(mln_btree_iter_t *it)
+{
+    if (it->leaf == NULL) return NULL;
+    if (++(it->idx) >= it->leaf->nr) {
+        it->leaf = it->leaf->next;
+        it->idx = 0;
+    }
+    return it->leaf == NULL? NULL: it->leaf->data[it->idx];
+}
+
+void *mln_btree_prev(mln_btree_iter_t *it)
+{
+    if (it->leaf == NULL) return NULL;
+    if (it->idx-- == 0) {
+        it->leaf = it->leaf->prev;
+        it->idx = it->leaf == NULL? 0: it->leaf->nr - 1;
+    }
+    return it->leaf == NULL? NULL: it->leaf->data[it->idx];
+}
+
+int mln_btree_iterate(mln_btree_t *t, btree_iterate_handler handler, void *udata)
+{
+    mln_btree_node_t *n;
+    mln_u32_t i;
+
+    for (n = t->head; n != NULL; n = n->next) {
+        for (i = 0; i < n->nr; ++i) {
+            if (handler(n->data[i], udata) < 0) return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Remove the last element equal to key, and return it.
+ * The element is not freed.
+ */
+void *mln_btree_remove(mln_btree_t *t, void *key)
+{
+    mln_btree_path_t path[M_BTREE_MAX_DEPTH];
+    mln_btree_node_t *n = mln_btree_descend(t, key, 1, path);
+    mln_u32_t pos = mln_btree_bsearch(t, n, 0, key, 1), depth = t->height - 1;
+    void *data;
+    int d;
+
+    if (pos == 0 || t->cmp(key, n->data[pos - 1])) return NULL;
+    data = n->data[--pos];
+    memmove(&n->data[pos], &n->data[pos + 1], (n->nr - pos - 1) * sizeof(void *));
+    --(n->nr);
+    --(t->nr_data);
+
+    if (pos == 0 && n->nr) {
+        /*the smallest element of the leaf is kept by the nearest ancestor which has it as a separator*/
+        for (d = depth - 1; d >= 0 && path[d].idx == 0; --d)
+            ;
+        if (d >= 0) path[d].node->data[path[d].idx] = n->data[0];
+    }
+
+    if (depth && n->nr < M_BTREE_MIN) mln_btree_leaf_fix(t, path, depth);
+    return data;
+}
+
+/*
+ * Borrow an element from a sibling, or merge with it.
+ */
+static inline void mln_btree_leaf_fix(mln_btree_t *t, mln_btree_path_t *path, mln_u32_t depth)
+{
+    mln_btree_node_t *p = path[depth - 1].node, *l, *r;
+    mln_u32_t i = path[depth - 1].idx;
+    mln_btree_node_t *n = p->child[i];
+
+    if (i > 0 && (l = p->child[i - 1])->nr > M_BTREE_MIN) {
+        memmove(&n->data[1], &n->data[0], n->nr * sizeof(void *));
+        n->data[0] = l->data[--(l->nr)];
+        ++(n->nr);
+        p->data[i] = n->data[0];
+        return;
+    }
+    if (i + 1 < p->nr && (r = p->child[i + 1])->nr > M_BTREE_MIN) {
+        n->data[(n->nr)++] = r->data[0];
+        memmove(&r->data[0], &r->data[1], (--(r->nr)) * sizeof(void *));
+        p->data[i + 1] = r->data[0];
+        return;
+    }
+
+    /*merge the right one into the left one*/
+    if (i > 0) {
+        l = p->child[i - 1];
+        r = n;
+    } else {
+        l = n;
+        r = p->child[++i];
+    }
+    memcpy(&l->data[l->nr], r->data, r->nr * sizeof(void *));
+    l->nr += r->nr;
+    l->next = r->next;
+    if (r->next != NULL) r->next->prev = l;
+    else t->tail = l;
+    mln_btree_node_free(t, r);
+
+    memmove(&p->data[i], &p->data[i + 1], (p->nr - i - 1) * sizeof(void *));
+    memmove(&p->child[i], &p->child[i + 1], (p->nr - i - 1) * sizeof(mln_btree_node_t *));
+    --(p->nr);
+    mln_btree_inner_fix(t, path, depth - 1);
+}
+
+static inline void mln_btree_inner_fix(mln_btree_t *t, mln_btree_path_t *path, mln_u32_t depth)
+{
+    mln_btree_node_t *n, *p, *l, *r;
+    mln_u32_t i;
+
+    while (1) {
+        n = path[depth].node;
+        if (depth == 0) {
+            if (n->nr == 1) {
+                t->root = n->child[0];
+                mln_btree_node_free(t, n);
+                --(t->height);
+            }
+            return;
+        }
+        if (n->nr >= M_BTREE_MIN) return;
+
+        p = path[depth - 1].node;
+        i = path[depth - 1].idx;
+
+        if (i > 0 && (l = p->child[i - 1])->nr > M_BTREE_MIN) {
+            memmove(&n->data[1], &n->data[0], n->nr * sizeof(void *));
+            memmove(&n->child[1], &n->child[0], n->nr * sizeof(mln_btree_node_t *));
+            n->data[1] = p->data[i];
+            --(l->nr);
+            n->child[0] = l->child[l->nr];
+            p->data[i] = l->data[l->nr];
+            ++(n->nr);
+            return;
+        }
+        if (i + 1 < p->nr && (r = p->child[i + 1])->nr > M_BTREE_MIN) {
+            n->data[n->nr] = p->data[i + 1];
+            n->child[n->nr] = r->child[0];
+            ++(n->nr);
+            p->data[i + 1] = r->data[1];
+            --(r->nr);
+            memmove(&r->data[0], &r->data[1], r->nr * sizeof(void *));
+            memmove(&r->child[0], &r->child[1], r->nr * sizeof(mln_btree_node_t *));
+            return;
+        }
+
+        if (i > 0) {
+            l = p->child[i - 1];
+            r = n;
+        } else {
+            l = n;
+            r = p->child[++i];
+        }
+        l->data[l->nr] = p->data[i];
+        l->child[l->nr] = r->child[0];
+        memcpy(&l->data[l->nr + 1], &r->data[1], (r->nr - 1) * sizeof(void *));
+        memcpy(&l->child[l->nr + 1], &r->child[1], (r->nr - 1) * sizeof(mln_btree_node_t *));
+        l->nr += r->nr;
+        mln_btree_node_free(t, r);
+
+        memmove(&p->data[i], &p->data[i + 1], (p->nr - i - 1) * sizeof(void *));
+        memmove(&p->child[i], &p->child[i + 1], (p->nr - i - 1) * sizeof(mln_btree_node_t *));
+        --(p->nr);
+        --depth;
+    }
+}
+
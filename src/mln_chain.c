@@ -3,6 +3,8 @@
  * Copyright (C) Niklaus F.Schen.
  */
 
+#include <stdlib.h>
+#include <string.h>
 #include "mln_chain.h"
 
 mln_buf_t *mln_buf_new(mln_alloc_t *pool)
@@ -11,6 +13,7 @@ mln_buf_t *mln_buf_new(mln_alloc_t *pool)
     b->left_pos = b->pos = b->last = NULL;
     b->start = b->end = NULL;
     b->shadow = NULL;
+    b->shared = NULL;
     b->file_left_pos = b->file_pos = b->file_last = 0;
     b->file = NULL;
     b->temporary = b->in_memory = b->in_file = 0;
@@ -33,6 +36,12 @@ void mln_buf_pool_release(mln_buf_t *b)
 {
     if (b == NULL) return;
 
+    if (b->shared != NULL) {
+        mln_buf_shared_free(b->shared);
+        mln_alloc_free(b);
+        return;
+    }
+
     if (b->shadow != NULL || b->temporary) {
         mln_alloc_free(b);
         return;
@@ -90,3 +99,39 @@ void mln_chain_pool_release_all(mln_chain_t *c)
     }
 }
 
+/*
+ * mln_buf_shared_t
+ */
+mln_buf_shared_t *mln_buf_shared_new(void *data, mln_size_t size)
+{
+    mln_buf_shared_t *sb;
+
+    if ((sb = (mln_buf_shared_t *)malloc(sizeof(mln_buf_shared_t) + size)) == NULL)
+        return NULL;
+    sb->refs = 1;
+    sb->size = size;
+    sb->data = (mln_u8ptr_t)(sb + 1);
+    if (data != NULL) memcpy(sb->data, data, size);
+    return sb;
+}
+
+void mln_buf_shared_free(mln_buf_shared_t *sb)
+{
+    if (sb == NULL) return;
+
+    if (__atomic_sub_fetch(&(sb->refs), 1, __ATOMIC_ACQ_REL) == 0)
+        free(sb);
+}
+
+mln_buf_t *mln_buf_shared_ref(mln_alloc_t *pool, mln_buf_shared_t *sb)
+{
+    mln_buf_t *b;
+
+    if ((b = mln_buf_new(pool)) == NULL) return NULL;
+    __atomic_add_fetch(&(sb->refs), 1, __ATOMIC_RELAXED);
+    b->left_pos = b->pos = b->start = sb->data;
+    b->last = b->end = sb->data + sb->size;
+    b->in_memory = 1;
+    b->shared = sb;
+    return b;
+}
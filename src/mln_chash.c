@@ -0,0 +1,310 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "mln_chash.h"
+
+#if defined(WIN32)
+#define MLN_CHASH_TLS __declspec(thread)
+#else
+#define MLN_CHASH_TLS __thread
+#endif
+
+/*
+ * The hash value of the key being operated by this thread. Shards are
+ * mln_hash_t with full_hash set, so it is passed to them without calling
+ * the user's hash callback again.
+ */
+static MLN_CHASH_TLS void *mln_chash_cur_key;
+static MLN_CHASH_TLS mln_u64_t mln_chash_cur_hval;
+
+static inline void mln_chash_rdlock(mln_chash_shard_t *s);
+static inline void mln_chash_rdunlock(mln_chash_shard_t *s);
+static inline void mln_chash_wrlock(mln_chash_shard_t *s);
+static inline void mln_chash_wrunlock(mln_chash_shard_t *s);
+static inline mln_u64_t mln_chash_calc(mln_chash_t *ch, void *key);
+static inline mln_chash_shard_t *mln_chash_shard(mln_chash_t *ch, void *key);
+static mln_u64_t mln_chash_shard_hash(mln_hash_t *h, void *key);
+static inline mln_chash_shard_t *mln_chash_shards_alloc(mln_chash_t *ch, mln_u64_t n);
+static inline void mln_chash_shards_free(mln_chash_t *ch);
+
+mln_chash_t *mln_chash_new(struct mln_hash_attr *attr, mln_u32_t nr_shards)
+{
+    mln_chash_t *ch;
+    mln_chash_shard_t *s;
+    struct mln_hash_attr sattr;
+    mln_u64_t n = 1, i;
+
+    if (attr->hash == NULL || attr->cmp == NULL) return NULL;
+
+    if (!nr_shards) nr_shards = M_CHASH_DFL_SHARDS;
+    if (nr_shards > M_CHASH_MAX_SHARDS) nr_shards = M_CHASH_MAX_SHARDS;
+    while (n < nr_shards) n <<= 1;
+
+    if (attr->pool != NULL) {
+        ch = (mln_chash_t *)attr->pool_alloc(attr->pool, sizeof(mln_chash_t));
+    } else {
+        ch = (mln_chash_t *)malloc(sizeof(mln_chash_t));
+    }
+    if (ch == NULL) return NULL;
+
+    memset(&(ch->base), 0, sizeof(mln_hash_t));
+    ch->base.pool = attr->pool;
+    ch->base.pool_alloc = attr->pool_alloc;
+    ch->base.pool_free = attr->pool_free;
+    ch->base.hash = attr->hash;
+    ch->base.cmp = attr->cmp;
+    ch->base.free_key = attr->free_key;
+    ch->base.free_val = attr->free_val;
+    ch->base.len = M_HASH_FLAT_SPACE;
+    ch->base.full_hash = attr->full_hash;
+    ch->mask = n - 1;
+
+    if ((ch->shards = mln_chash_shards_alloc(ch, n)) == NULL) goto err1;
+
+    sattr = *attr;
+    sattr.hash = mln_chash_shard_hash;
+    sattr.len_base = attr->len_base / n;
+    if (sattr.len_base == 0) sattr.len_base = 1;
+    sattr.full_hash = 1;
+    /*lookups run under the read lock, they must not migrate buckets*/
+    sattr.incremental = 0;
+
+    for (i = 0; i < n; ++i) {
+        s = &(ch->shards[i]);
+        s->ch = ch;
+        s->lock = 0;
+        if (mln_hash_init(&(s->hash), &sattr) < 0) goto err2;
+    }
+    return ch;
+
+err2:
+    while (i-- > 0) {
+        mln_hash_destroy(&(ch->shards[i].hash), M_HASH_F_NONE);
+    }
+    mln_chash_shards_free(ch);
+err1:
+    if (attr->pool != NULL) attr->pool_free(ch);
+    else free(ch);
+    return NULL;
+}
+
+void mln_chash_free(mln_chash_t *ch, mln_hash_flag_t flg)
+{
+    if (ch == NULL) return;
+
+    mln_chash_shard_t *s, *end = ch->shards + ch->mask + 1;
+    for (s = ch->shards; s < end; ++s) {
+        mln_hash_destroy(&(s->hash), flg);
+    }
+    mln_chash_shards_free(ch);
+    if (ch->base.pool != NULL) ch->base.pool_free(ch);
+    else free(ch);
+}
+
+/*
+ * Shards are cache line aligned, so that the locks of neighbouring shards
+ * never share a line. Pools give no such alignment, the block is
+ * over-allocated and aligned by hand.
+ */
+static inline mln_chash_shard_t *mln_chash_shards_alloc(mln_chash_t *ch, mln_u64_t n)
+{
+    mln_size_t size = n * sizeof(mln_chash_shard_t);
+
+    if (ch->base.pool != NULL) {
+        ch->shards_mem = ch->base.pool_alloc(ch->base.pool, size + M_CHASH_CACHELINE - 1);
+        if (ch->shards_mem == NULL) return NULL;
+        return (mln_chash_shard_t *)(((mln_uauto_t)ch->shards_mem + M_CHASH_CACHELINE - 1) & ~((mln_uauto_t)M_CHASH_CACHELINE - 1));
+    }
+#if defined(WIN32)
+    ch->shards_mem = _aligned_malloc(size, M_CHASH_CACHELINE);
+#else
+    if (posix_memalign(&(ch->shards_mem), M_CHASH_CACHELINE, size)) ch->shards_mem = NULL;
+#endif
+    return (mln_chash_shard_t *)ch->shards_mem;
+}
+
+static inline void mln_chash_shards_free(mln_chash_t *ch)
+{
+    if (ch->base.pool != NULL) {
+        ch->base.pool_free(ch->shards_mem);
+        return;
+    }
+#if defined(WIN32)
+    _aligned_free(ch->shards_mem);
+#else
+    free(ch->shards_mem);
+#endif
+}
+
+/*
+ * A reader adds 2 and backs off if the writer bit is set.
+ * A writer sets the writer bit, then waits for the readers to leave.
+ */
+#define mln_chash_wait(cond) do {\
+    int n;\
+    for (n = 0; (cond); ++n) {\
+        if (n >= 64) sched_yield();\
+    }\
+} while (0)
+
+static inline void mln_chash_rdlock(mln_chash_shard_t *s)
+{
+    while (__atomic_fetch_add(&(s->lock), 2, __ATOMIC_ACQUIRE) & 1) {
+        __atomic_fetch_sub(&(s->lock), 2, __ATOMIC_RELAXED);
+        mln_chash_wait(__atomic_load_n(&(s->lock), __ATOMIC_RELAXED) & 1);
+    }
+}
+
+static inline void mln_chash_rdunlock(mln_chash_shard_t *s)
+{
+    __atomic_fetch_sub(&(s->lock), 2, __ATOMIC_RELEASE);
+}
+
+static inline void mln_chash_wrlock(mln_chash_shard_t *s)
+{
+    while (__atomic_fetch_or(&(s->lock), 1, __ATOMIC_ACQUIRE) & 1) {
+        mln_chash_wait(__atomic_load_n(&(s->lock), __ATOMIC_RELAXED) & 1);
+    }
+    mln_chash_wait(__atomic_load_n(&(s->lock), __ATOMIC_ACQUIRE) != 1);
+}
+
+static inline void mln_chash_wrunlock(mln_chash_shard_t *s)
+{
+    __atomic_fetch_and(&(s->lock), ~(mln_uauto_t)1, __ATOMIC_RELEASE);
+}
+
+static inline mln_u64_t mln_chash_calc(mln_chash_t *ch, void *key)
+{
+    mln_u64_t v = ch->base.hash(&(ch->base), key);
+
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    return v;
+}
+
+/*
+ * Shards take the bucket index from the low bits (modulo the bucket length),
+ * so the shard index is taken from the high 32 bits.
+ */
+static inline mln_chash_shard_t *mln_chash_shard(mln_chash_t *ch, void *key)
+{
+    mln_u64_t v = mln_chash_calc(ch, key);
+
+    mln_chash_cur_key = key;
+    mln_chash_cur_hval = v;
+    return &(ch->shards[(v >> 32) & ch->mask]);
+}
+
+/*
+ * Keys other than the current one come from the callers of mln_hash_*
+ * on the shard itself, e.g. mln_hash_remove in an iterate handler.
+ */
+static mln_u64_t mln_chash_shard_hash(mln_hash_t *h, void *key)
+{
+    if (key == mln_chash_cur_key) return mln_chash_cur_hval;
+    return mln_chash_calc(((mln_chash_shard_t *)h)->ch, key);
+}
+
+void *mln_chash_search(mln_chash_t *ch, void *key)
+{
+    void *val;
+    mln_chash_shard_t *s = mln_chash_shard(ch, key);
+
+    mln_chash_rdlock(s);
+    val = mln_hash_search(&(s->hash), key);
+    mln_chash_rdunlock(s);
+    return val;
+}
+
+int mln_chash_access(mln_chash_t *ch, void *key, hash_iterate_handler handler, void *udata)
+{
+    int rc = -1;
+    mln_hash_entry_t *he;
+    mln_hash_mgr_t *mgr;
+    mln_chash_shard_t *s = mln_chash_shard(ch, key);
+
+    mln_chash_rdlock(s);
+    mgr = &(s->hash.tbl[mln_chash_cur_hval % s->hash.len]);
+    for (he = mgr->head; he != NULL; he = he->next) {
+        if (he->hval != mln_chash_cur_hval) continue;
+        if (s->hash.cmp(&(s->hash), key, he->key)) {
+            rc = handler(&(s->hash), he->key, he->val, udata);
+            break;
+        }
+    }
+    mln_chash_rdunlock(s);
+    return rc;
+}
+
+int mln_chash_insert(mln_chash_t *ch, void *key, void *val)
+{
+    int rc;
+    mln_chash_shard_t *s = mln_chash_shard(ch, key);
+
+    mln_chash_wrlock(s);
+    rc = mln_hash_insert(&(s->hash), key, val);
+    mln_chash_wrunlock(s);
+    return rc;
+}
+
+int mln_chash_update(mln_chash_t *ch, void *key, void *val)
+{
+    int rc;
+    mln_chash_shard_t *s = mln_chash_shard(ch, *(void **)key);
+
+    mln_chash_wrlock(s);
+    rc = mln_hash_update(&(s->hash), key, val);
+    mln_chash_wrunlock(s);
+    return rc;
+}
+
+void mln_chash_remove(mln_chash_t *ch, void *key, mln_hash_flag_t flg)
+{
+    mln_chash_shard_t *s = mln_chash_shard(ch, key);
+
+    mln_chash_wrlock(s);
+    mln_hash_remove(&(s->hash), key, flg);
+    mln_chash_wrunlock(s);
+}
+
+/*
+ * Shards are iterated one by one, each under its write lock.
+ * handler receives the shard's mln_hash_t, so it can call
+ * mln_hash_remove on it, but must not call mln_chash_* functions.
+ */
+int mln_chash_iterate(mln_chash_t *ch, hash_iterate_handler handler, void *udata)
+{
+    int rc;
+    mln_chash_shard_t *s, *end = ch->shards + ch->mask + 1;
+
+    for (s = ch->shards; s < end; ++s) {
+        mln_chash_wrlock(s);
+        mln_chash_cur_key = NULL;
+        rc = mln_hash_iterate(&(s->hash), handler, udata);
+        mln_chash_wrunlock(s);
+        if (rc < 0) return -1;
+    }
+    return 0;
+}
+
+mln_u64_t mln_chash_nr_nodes(mln_chash_t *ch)
+{
+    mln_u64_t n = 0;
+    mln_chash_shard_t *s, *end = ch->shards + ch->mask + 1;
+
+    for (s = ch->shards; s < end; ++s) {
+        mln_chash_rdlock(s);
+        n += s->hash.nr_nodes;
+        mln_chash_rdunlock(s);
+    }
+    return n;
+}
+
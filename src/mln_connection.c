@@ -2,6 +2,9 @@
 /*
  * Copyright (C) Niklaus F.Schen.
  */
+#if defined(MLN_SPLICE) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /*for splice*/
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -20,6 +23,13 @@
 #if defined(MLN_SENDFILE)
 #include <sys/sendfile.h>
 #endif
+#if !defined(WIN32)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+#if defined(MLN_ZEROCOPY)
+#include <linux/errqueue.h>
+#endif
 
 
 static inline int mln_fd_is_nonblock(int fd);
@@ -28,16 +38,11 @@ mln_tcp_conn_pop_inline(mln_tcp_conn_t *tc, int type);
 static inline int
 mln_tcp_conn_recv_chain(mln_tcp_conn_t *tc, mln_u32_t flag);
 static inline int
-mln_tcp_conn_recv_chain_file(int sockfd, \
-                             mln_alloc_t *pool, \
-                             mln_buf_t *b, \
-                             mln_buf_t *last);
+mln_tcp_conn_recv_chain_file(mln_tcp_conn_t *tc, mln_u32_t flag);
 static inline int
-mln_tcp_conn_recv_chain_mem(int sockfd, mln_alloc_t *pool, mln_buf_t *b);
-static inline ssize_t
-mln_tcp_conn_send_chain_memory(mln_tcp_conn_t *tc);
-static inline ssize_t
-mln_tcp_conn_send_chain_file(mln_tcp_conn_t *tc);
+mln_tcp_conn_recv_chain_mem(mln_tcp_conn_t *tc);
+static inline ssize_t mln_tcp_conn_send_memory(mln_tcp_conn_t *tc);
+static inline ssize_t mln_tcp_conn_send_file(mln_tcp_conn_t *tc, mln_buf_t *b);
 
 
 static inline int mln_fd_is_nonblock(int fd)
@@ -63,6 +68,16 @@ int mln_tcp_conn_init(mln_tcp_conn_t *tc, int sockfd)
     tc->rcv_head = tc->rcv_tail = NULL;
     tc->snd_head = tc->snd_tail = NULL;
     tc->sent_head = tc->sent_tail = NULL;
+    tc->rcv_buf = NULL;
+    tc->rcv_spare = NULL;
+    tc->rcv_spare_size = 0;
+    tc->rcv_size = M_C_RCV_MIN;
+    tc->rcv_pipe[0] = tc->rcv_pipe[1] = -1;
+    tc->zc_head = tc->zc_tail = NULL;
+    tc->zc_wait_head = tc->zc_wait_tail = NULL;
+    tc->zc_in = tc->zc_out = 0;
+    tc->zc_seq = 0;
+    tc->zc_min = 0;
     tc->sockfd = sockfd;
     return 0;
 }
@@ -71,9 +86,15 @@ void mln_tcp_conn_destroy(mln_tcp_conn_t *tc)
 {
     if (tc == NULL) return;
 
+    if (tc->rcv_spare != NULL) mln_alloc_free(tc->rcv_spare);
+    if (tc->rcv_pipe[0] >= 0) {
+        close(tc->rcv_pipe[0]);
+        close(tc->rcv_pipe[1]);
+    }
     mln_chain_pool_release_all(mln_tcp_conn_remove(tc, M_C_SEND));
     mln_chain_pool_release_all(mln_tcp_conn_remove(tc, M_C_RECV));
     mln_chain_pool_release_all(mln_tcp_conn_remove(tc, M_C_SENT));
+    mln_chain_pool_release_all(tc->zc_head);
     mln_alloc_destroy(tc->pool);
 }
 
@@ -159,6 +180,7 @@ mln_chain_t *mln_tcp_conn_remove(mln_tcp_conn_t *tc, int type)
     } else if (type == M_C_RECV) {
         rc = tc->rcv_head;
         tc->rcv_head = tc->rcv_tail = NULL;
+        tc->rcv_buf = NULL;
     } else if (type == M_C_SENT) {
         rc = tc->sent_head;
         tc->sent_head = tc->sent_tail = NULL;
@@ -186,6 +208,7 @@ mln_chain_t *mln_tcp_conn_pop(mln_tcp_conn_t *tc, int type)
     }
 
     mln_chain_t *rc = *head;
+    if (rc != NULL && rc->buf == tc->rcv_buf) tc->rcv_buf = NULL;
     if (rc == *tail) {
         *head = *tail = NULL;
         return rc;
@@ -213,477 +236,319 @@ mln_chain_t *mln_tcp_conn_tail(mln_tcp_conn_t *tc, int type)
     return rc;
 }
 
-int mln_tcp_conn_send(mln_tcp_conn_t *tc)
+/*
+ * send
+ */
+static inline void mln_tcp_conn_sent(mln_tcp_conn_t *tc, mln_chain_t *c)
 {
-    ssize_t n;
-
-    if (tc->snd_head == NULL) return M_C_NOTYET;
-
-me:
-    n = mln_tcp_conn_send_chain_memory(tc);
-    if (n == 0 && \
-        tc->snd_head != NULL && \
-        tc->snd_head->buf != NULL && \
-        tc->snd_head->buf->in_file)
-    {
-        goto fi;
-    }
-    if (n == 0) return M_C_NOTYET;
-    if (n > 0) return M_C_FINISH;
-    return M_C_ERROR;
-
-fi:
-    n = mln_tcp_conn_send_chain_file(tc);
-    if (n == 0 && \
-        tc->snd_head != NULL && \
-        tc->snd_head->buf != NULL && \
-        tc->snd_head->buf->in_memory)
-    {
-        goto me;
-    }
-    if (n == 0) return M_C_NOTYET;
-    if (n > 0) return M_C_FINISH;
-    return M_C_ERROR;
+    if (tc->zc_wait_head != NULL) {
+        mln_chain_add(&(tc->zc_head), &(tc->zc_tail), c);
+        ++(tc->zc_in);
+        return;
+    }
+    mln_tcp_conn_append(tc, c, M_C_SENT);
 }
 
-
-#if defined(MLN_WRITEV)
-static inline ssize_t
-mln_tcp_conn_send_chain_memory(mln_tcp_conn_t *tc)
+/*
+ * Move the empty buffers at the head of the send queue to the sent queue.
+ * return value: 1 - a buffer with last_in_chain set is moved   0 - otherwise
+ */
+static inline int mln_tcp_conn_send_skip(mln_tcp_conn_t *tc)
 {
     mln_chain_t *c;
     mln_buf_t *b;
-    ssize_t n, is_done = 0;
-    register mln_size_t buf_left_size;
-    int proc_vec, nvec = 256;
-    struct iovec vector[256];
-
-    if (mln_fd_is_nonblock(tc->sockfd)) {
-        while (1) {
-            proc_vec = 0;
-            for (c = tc->snd_head; c != NULL; c = c->next) {
-                if (proc_vec >= nvec) break;
-                if ((b = c->buf) == NULL) continue;
-                if (!b->in_memory) break;
-                buf_left_size = mln_buf_left_size(b);
-                if (buf_left_size) {
-                    vector[proc_vec].iov_base = b->left_pos;
-                    vector[proc_vec].iov_len = buf_left_size;
-                    ++proc_vec;
-                }
-                if (b->last_in_chain) break;
-            }
-
-            if (!proc_vec) {
-                if (tc->snd_head != NULL) mln_chain_pool_release_all(tc->snd_head);
-                tc->snd_head = tc->snd_tail = NULL;
-                return 0;
-            }
-
-non:
-            n = writev(tc->sockfd, vector, proc_vec);
-            if (n <= 0) {
-                if (errno == EINTR) goto non;
-                if (errno == EAGAIN) return 0;
-                return -1;
-            }
 
-            while ((c = tc->snd_head) != NULL) {
-                if ((b = c->buf) == NULL) {
-                    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                    mln_tcp_conn_append(tc, c, M_C_SENT);
-                    continue;
-                }
-                if (!b->in_memory) break;
-                if (b->last_in_chain) is_done = 1;
-
-                buf_left_size = mln_buf_left_size(b);
-                if (n >= buf_left_size) {
-                    b->left_pos += buf_left_size;
-                    n -= buf_left_size;
-                    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                    mln_tcp_conn_append(tc, c, M_C_SENT);
-                } else {
-                    b->left_pos += n;
-                    n = 0;
-                }
-                if (is_done || n == 0) break;
-            }
-
-            if (is_done) break;
-        }
-        return 1;
-    }
-
-    proc_vec = 0;
-    for (c = tc->snd_head; c != NULL; c = c->next) {
-        if (proc_vec >= nvec) break;
-        if ((b = c->buf) == NULL) continue;
-        if (!b->in_memory) break;
-        buf_left_size = mln_buf_left_size(b);
-        if (buf_left_size) {
-            vector[proc_vec].iov_base = b->left_pos;
-            vector[proc_vec].iov_len = buf_left_size;
-            ++proc_vec;
-        }
-        if (b->last_in_chain) break;
-    }
-
-    if (!proc_vec) {
-        if (tc->snd_head != NULL) mln_chain_pool_release_all(tc->snd_head);
-        tc->snd_head = tc->snd_tail = NULL;
-        return 0;
-    }
-
-blk:
-    n = writev(tc->sockfd, vector, proc_vec);
-    if (n <= 0) {
-        if (errno == EINTR) goto blk;
-        return -1;
+    while ((c = tc->snd_head) != NULL) {
+        b = c->buf;
+        if (mln_buf_left_size(b)) break;
+        mln_tcp_conn_sent(tc, mln_tcp_conn_pop_inline(tc, M_C_SEND));
+        if (b != NULL && b->last_in_chain) return 1;
     }
+    return 0;
+}
 
-    while ((c = tc->snd_head) != NULL) {
-        if ((b = c->buf) == NULL) {
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-            continue;
-        }
-        if (!b->in_memory) break;
-        if (b->last_in_chain) is_done = 1;
-
-        buf_left_size = mln_buf_left_size(b);
-        if (n >= buf_left_size) {
-            b->left_pos += buf_left_size;
-            n -= buf_left_size;
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-        } else {
-            b->left_pos += n;
-            n = 0;
+/*
+ * Advance the send queue by n bytes.
+ * return value: 1 - a buffer with last_in_chain set is done   0 - otherwise
+ */
+static inline int mln_tcp_conn_send_consume(mln_tcp_conn_t *tc, mln_size_t n)
+{
+    mln_chain_t *c;
+    mln_buf_t *b;
+    mln_size_t left;
+
+    while (n && (c = tc->snd_head) != NULL) {
+        b = c->buf;
+        left = mln_buf_left_size(b);
+        if (left > n) left = n;
+        if (b != NULL) {
+            if (b->in_file) b->file_left_pos += left;
+            else b->left_pos += left;
         }
-        if (is_done || n == 0) break;
+        n -= left;
+        if (mln_buf_left_size(b)) break;
+        mln_tcp_conn_sent(tc, mln_tcp_conn_pop_inline(tc, M_C_SEND));
+        if (b != NULL && b->last_in_chain) return 1;
     }
+    return 0;
+}
 
-    return is_done;
+#if defined(TCP_CORK)
+static inline int mln_tcp_conn_cork(int sockfd, int on)
+{
+    return setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
 }
-#else
-static inline ssize_t
-mln_tcp_conn_send_chain_memory(mln_tcp_conn_t *tc)
+#endif
+
+/*
+ * In non-blocking mode, send until the buffer with last_in_chain set is
+ * done, the send queue is empty or the socket is full. In blocking mode,
+ * only one system call is made.
+ */
+int mln_tcp_conn_send(mln_tcp_conn_t *tc)
 {
-    mln_u8_t buf[8192], *p;
     mln_chain_t *c;
     mln_buf_t *b;
-    mln_size_t left_size;
-    register mln_size_t buf_left_size;
-    ssize_t n, is_done = 0;
+    ssize_t n;
+    int nonblock, ret = M_C_NOTYET, corked = 0;
 
-    if (mln_fd_is_nonblock(tc->sockfd)) {
-        while (1) {
-            p = buf;
-            left_size = sizeof(buf);
-
-            for (c = tc->snd_head; c != NULL; c = c->next) {
-                if ((b = c->buf) == NULL) continue;
-                if (!b->in_memory) break;
-                buf_left_size = mln_buf_left_size(b);
-
-                if (buf_left_size > left_size) {
-                    memcpy(p, b->left_pos, left_size);
-                    p += left_size;
-                    left_size = 0; 
-                    break;
-                } else {
-                    if (buf_left_size > 0) {
-                        memcpy(p, b->left_pos, buf_left_size);
-                        p += buf_left_size;
-                        left_size -= buf_left_size;
-                    }
-                    if (b->last_in_chain) break;
-                }
-            }
+    if (tc->zc_wait_head != NULL) (void)mln_tcp_conn_zerocopy_reap(tc);
+    if (tc->snd_head == NULL) return M_C_NOTYET;
 
-            if (left_size == sizeof(buf)) return 0;
+    nonblock = mln_fd_is_nonblock(tc->sockfd);
+    while (1) {
+        if (mln_tcp_conn_send_skip(tc)) {
+            ret = M_C_FINISH;
+            break;
+        }
+        if ((c = tc->snd_head) == NULL) break;
 
-non:
-#if defined(WIN32)
-            n = send(tc->sockfd, (char *)buf, sizeof(buf) - left_size, 0);
-#else
-            n = send(tc->sockfd, buf, sizeof(buf) - left_size, 0);
+        b = c->buf;
+        if (b->in_file) {
+#if defined(TCP_CORK)
+            if (!corked && !b->last_in_chain && c->next != NULL)
+                corked = mln_tcp_conn_cork(tc->sockfd, 1) == 0;
 #endif
-            if (n <= 0) {
-                if (errno == EINTR) goto non;
-                if (errno == EAGAIN) return 0;
-                return -1;
-            }
-
-            while ((c = tc->snd_head) != NULL) {
-                if ((b = c->buf) == NULL) {
-                    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                    mln_tcp_conn_append(tc, c, M_C_SENT);
-                    continue;
-                }
-                buf_left_size = mln_buf_left_size(b);
-                if (buf_left_size > n) {
-                    b->left_pos += n;
-                    n = 0;
-                } else {
-                    if (b->last_in_chain) is_done = 1;
-                    n -= buf_left_size;
-                    b->left_pos += buf_left_size;
-                    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                    mln_tcp_conn_append(tc, c, M_C_SENT);
-                }
-                if (is_done || n == 0) break;
-            }
-
-            if (is_done) break;
+            n = mln_tcp_conn_send_file(tc, b);
+        } else {
+            n = mln_tcp_conn_send_memory(tc);
+        }
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && errno == EAGAIN) break;
+            ret = M_C_ERROR;
+            break;
         }
 
-        return 1;
-    }
-
-    p = buf;
-    left_size = sizeof(buf);
-
-    for (c = tc->snd_head; c != NULL; c = c->next) {
-        if ((b = c->buf) == NULL) continue;
-        if (!b->in_memory) break;
-        buf_left_size = mln_buf_left_size(b);
-
-        if (buf_left_size > left_size) {
-            memcpy(p, b->left_pos, left_size);
-            p += left_size;
-            left_size = 0;
+        if (mln_tcp_conn_send_consume(tc, n)) {
+            ret = M_C_FINISH;
             break;
-        } else {
-            if (buf_left_size > 0) {
-                memcpy(p, b->left_pos, buf_left_size);
-                p += buf_left_size;
-                left_size -= buf_left_size;
-            }
-            if (b->last_in_chain) break;
         }
+        if (!nonblock) break;
     }
 
-    if (left_size == sizeof(buf)) return 0;
+#if defined(TCP_CORK)
+    if (corked) (void)mln_tcp_conn_cork(tc->sockfd, 0);
+#endif
+    return ret;
+}
 
-blk:
-#if defined(WIN32)
-    n = send(tc->sockfd, (char *)buf, sizeof(buf) - left_size, 0);
-#else
-    n = send(tc->sockfd, buf, sizeof(buf) - left_size, 0);
+#if defined(MLN_WRITEV)
+/*
+ * Send the memory buffers from the head of the send queue, up to a file
+ * buffer, a buffer with last_in_chain set or M_C_IOV_MAX buffers.
+ */
+static inline ssize_t mln_tcp_conn_send_memory(mln_tcp_conn_t *tc)
+{
+    mln_chain_t *c;
+    mln_buf_t *b;
+    mln_size_t left;
+    int nvec = 0, flags = 0;
+    struct iovec vector[M_C_IOV_MAX];
+    struct msghdr msg;
+#if defined(MLN_ZEROCOPY)
+    struct mln_tcp_conn_zc_s *w = NULL;
+    mln_size_t size = 0;
+    ssize_t n;
 #endif
-    if (n <= 0) {
-        if (errno == EINTR) goto blk;
-        return -1;
-    }
 
-    while ((c = tc->snd_head) != NULL) {
-        if ((b = c->buf) == NULL) {
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
+    for (c = tc->snd_head; c != NULL; c = c->next) {
+        if ((b = c->buf) == NULL) continue;
+        if ((left = mln_buf_left_size(b)) == 0) {
+            if (b->last_in_chain) break;
             continue;
         }
-        buf_left_size = mln_buf_left_size(b);
-        if (buf_left_size > n) {
-            b->left_pos += n;
-            n = 0;
-        } else {
-            if (b->last_in_chain) is_done = 1;
-            n -= buf_left_size;
-            b->left_pos += buf_left_size;
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
+        if (b->in_file || nvec >= M_C_IOV_MAX) {
+#if defined(MSG_MORE)
+            flags |= MSG_MORE;
+#endif
+            break;
         }
-        if (is_done || n == 0) break;
+        vector[nvec].iov_base = b->left_pos;
+        vector[nvec].iov_len = left;
+        ++nvec;
+#if defined(MLN_ZEROCOPY)
+        size += left;
+#endif
+        if (b->last_in_chain) break;
     }
 
-    return is_done;
-}
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = vector;
+    msg.msg_iovlen = nvec;
+
+#if defined(MLN_ZEROCOPY)
+    if (tc->zc_min && size >= tc->zc_min) {
+        if ((w = (struct mln_tcp_conn_zc_s *)mln_alloc_m(tc->pool, sizeof(*w))) != NULL) {
+            n = sendmsg(tc->sockfd, &msg, flags | MSG_ZEROCOPY);
+            if (n > 0) {
+                w->first = tc->zc_in;
+                w->seq = tc->zc_seq++;
+                w->done = 0;
+                w->next = NULL;
+                if (tc->zc_wait_head == NULL) tc->zc_wait_head = tc->zc_wait_tail = w;
+                else tc->zc_wait_tail = tc->zc_wait_tail->next = w;
+                return n;
+            }
+            mln_alloc_free(w);
+            if (n == 0 || errno != ENOBUFS) return n;
+        }
+    }
 #endif
-
-
-#if defined(MLN_SENDFILE)
-static inline ssize_t
-mln_tcp_conn_send_chain_file(mln_tcp_conn_t *tc)
+    return sendmsg(tc->sockfd, &msg, flags);
+}
+#else
+static inline ssize_t mln_tcp_conn_send_memory(mln_tcp_conn_t *tc)
 {
-    int sockfd = tc->sockfd;
-    ssize_t n, is_done = 0;
+    mln_u8_t buf[8192], *p = buf;
     mln_chain_t *c;
     mln_buf_t *b;
-    mln_size_t buf_left_size;
+    mln_size_t left;
 
-    if (mln_fd_is_nonblock(sockfd)) {
-        while ((c = tc->snd_head) != NULL) {
-            if ((b = c->buf) == NULL) {
-                c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                mln_tcp_conn_append(tc, c, M_C_SENT);
-                continue;
-            }
-            if (!b->in_file) break;
-            buf_left_size = mln_buf_left_size(b);
-            if (b->last_in_chain) is_done = 1;
-
-            if (buf_left_size) {
-non:
-                n = sendfile(sockfd, \
-                             mln_file_fd(b->file), \
-                             &b->file_left_pos, \
-                             buf_left_size);
-                if (n <= 0) {
-                    if (errno == EINTR) goto non;
-                    if (errno == EAGAIN) return 0;
-                    return -1;
-                }
-
-                if (mln_buf_left_size(b)) {
-                    goto non;
-                }
-            }
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-            if (is_done) break;
-        }
-        return 1;
+    for (c = tc->snd_head; c != NULL && p < buf + sizeof(buf); c = c->next) {
+        if ((b = c->buf) == NULL) continue;
+        if (b->in_file) break;
+        if ((left = mln_buf_left_size(b)) > (mln_size_t)(buf + sizeof(buf) - p))
+            left = buf + sizeof(buf) - p;
+        memcpy(p, b->left_pos, left);
+        p += left;
+        if (b->last_in_chain) break;
     }
 
-    while ((c = tc->snd_head) != NULL) {
-        if ((b = c->buf) != NULL) {
-            if (mln_buf_left_size(b)) break;
-            if (b->last_in_chain) is_done = 1;
-        }
-        c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-        mln_tcp_conn_append(tc, c, M_C_SENT);
-        if (is_done) return 1;
-    }
-    if (tc->snd_head == NULL) return 0;
-    if (!b->in_file) return 0;
-
-blk:
-    n = sendfile(sockfd, \
-                 mln_file_fd(b->file), \
-                 &b->file_left_pos, \
-                 mln_buf_left_size(b));
-    if (n <= 0) {
-        if (errno == EINTR) goto blk;
-        return -1;
-    }
+#if defined(WIN32)
+    return send(tc->sockfd, (char *)buf, p - buf, 0);
+#else
+    return send(tc->sockfd, buf, p - buf, 0);
+#endif
+}
+#endif
 
-    if (mln_buf_left_size(b)) goto blk;
-    if (b->last_in_chain) is_done = 1;
-    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-    mln_tcp_conn_append(tc, c, M_C_SENT);
+#if defined(MLN_SENDFILE)
+static inline ssize_t mln_tcp_conn_send_file(mln_tcp_conn_t *tc, mln_buf_t *b)
+{
+    off_t off = b->file_left_pos;
 
-    return is_done;
+    return sendfile(tc->sockfd, mln_file_fd(b->file), &off, mln_buf_left_size(b));
 }
 #else
-static inline ssize_t
-mln_tcp_conn_send_chain_file(mln_tcp_conn_t *tc)
+static inline ssize_t mln_tcp_conn_send_file(mln_tcp_conn_t *tc, mln_buf_t *b)
 {
-    int sockfd = tc->sockfd;
+    mln_u8_t buf[16384];
+    mln_size_t len = mln_buf_left_size(b);
     ssize_t n;
-    mln_buf_t *b;
-    mln_chain_t *c;
-    mln_u8_t buf[4096];
-    mln_size_t len, buf_left_size;
-
-    if (mln_fd_is_nonblock(sockfd)) {
-        while ((c = tc->snd_head) != NULL) {
-            if ((b = c->buf) == NULL) {
-                c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                mln_tcp_conn_append(tc, c, M_C_SENT);
-                continue;
-            }
-            if (!b->in_file) break;
 
-            buf_left_size = mln_buf_left_size(b);
-            if (buf_left_size == 0) {
-                c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-                mln_tcp_conn_append(tc, c, M_C_SENT);
-                if (b->last_in_chain) return 1;
-                continue;
-            }
-
-            lseek(mln_file_fd(b->file), b->file_left_pos, SEEK_SET);
-            len = buf_left_size > sizeof(buf)? sizeof(buf): buf_left_size;
-non_rd:
-            n = read(mln_file_fd(b->file), buf, len);
-            if (n <= 0) {
-                if (errno == EINTR) goto non_rd;
-                return -1;
-            }
+    if (len > sizeof(buf)) len = sizeof(buf);
+    if (lseek(mln_file_fd(b->file), b->file_left_pos, SEEK_SET) < 0) return -1;
+    if ((n = read(mln_file_fd(b->file), buf, len)) <= 0) return -1;
 
-            len = n;
-non_snd:
 #if defined(WIN32)
-            n = send(sockfd, (char *)buf, len, 0);
+    return send(tc->sockfd, (char *)buf, n, 0);
 #else
-            n = send(sockfd, buf, len, 0);
+    return send(tc->sockfd, buf, n, 0);
+#endif
+}
 #endif
-            if (n <= 0) {
-                if (errno == EINTR) goto non_snd;
-                if (errno == EAGAIN) return 0;
-                return -1;
-            }
-            b->file_left_pos += n;
-            if (mln_buf_left_size(b)) continue;
 
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-            if (b->last_in_chain) return 1;
-        }
+int mln_tcp_conn_zerocopy_set(mln_tcp_conn_t *tc, mln_u32_t min)
+{
+    if (min == 0) {
+        tc->zc_min = 0;
         return 0;
     }
+#if defined(MLN_ZEROCOPY)
+    int on = 1;
 
-    while ((c = tc->snd_head) != NULL) {
-        if ((b = c->buf) == NULL) {
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-            continue;
+    if (setsockopt(tc->sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0)
+        return -1;
+    tc->zc_min = min;
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/*
+ * A completion covers the sends numbered from ee_info to ee_data. The
+ * chains of the sends completed in order are moved to the sent queue, as
+ * long as no send still waiting has touched them.
+ * If the kernel had to copy the data anyway, e.g. on loopback, zerocopy is
+ * turned off for this connection.
+ */
+int mln_tcp_conn_zerocopy_reap(mln_tcp_conn_t *tc)
+{
+#if defined(MLN_ZEROCOPY)
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    struct mln_tcp_conn_zc_s *w;
+    mln_chain_t *c;
+    mln_u32_t lo, hi;
+
+    while (tc->zc_wait_head != NULL) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(tc->sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) break;
+            return -1;
         }
-        if (!b->in_file) return 0;
 
-        buf_left_size = mln_buf_left_size(b);
-        if (buf_left_size == 0) {
-            c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-            mln_tcp_conn_append(tc, c, M_C_SENT);
-            if (b->last_in_chain) return 1;
-            continue;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR) && \
+                !(cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) continue;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) tc->zc_min = 0;
+            lo = serr->ee_info;
+            hi = serr->ee_data;
+            for (w = tc->zc_wait_head; w != NULL; w = w->next) {
+                if ((mln_s32_t)(w->seq - lo) >= 0 && (mln_s32_t)(hi - w->seq) >= 0)
+                    w->done = 1;
+            }
         }
 
-        break;
+        while ((w = tc->zc_wait_head) != NULL && w->done) {
+            if ((tc->zc_wait_head = w->next) == NULL) tc->zc_wait_tail = NULL;
+            mln_alloc_free(w);
+        }
     }
-    if (c == NULL) return 0;
 
-    lseek(mln_file_fd(b->file), b->file_left_pos, SEEK_SET);
-    len = buf_left_size > sizeof(buf)? sizeof(buf): buf_left_size;
-blk_rd:
-    n = read(mln_file_fd(b->file), buf, len);
-    if (n <= 0) {
-        if (errno == EINTR) goto blk_rd;
-        return -1;
+    while ((c = tc->zc_head) != NULL) {
+        if (tc->zc_wait_head != NULL && tc->zc_out >= tc->zc_wait_head->first) break;
+        if ((tc->zc_head = c->next) == NULL) tc->zc_tail = NULL;
+        c->next = NULL;
+        ++(tc->zc_out);
+        mln_tcp_conn_append(tc, c, M_C_SENT);
     }
-
-    len = n;
-blk_snd:
-#if defined(WIN32)
-    n = send(sockfd, (char *)buf, len, 0);
-#else
-    n = send(sockfd, buf, len, 0);
 #endif
-    if (n <= 0) {
-        if (errno == EINTR) goto blk_snd;
-        return -1;
-    }
-    b->file_left_pos += n;
-    if (mln_buf_left_size(b)) return 0;
-
-    c = mln_tcp_conn_pop_inline(tc, M_C_SEND);
-    mln_tcp_conn_append(tc, c, M_C_SENT);
-
-    return b->last_in_chain == 0? 0: 1;
+    return 0;
 }
-#endif
 
 static inline mln_chain_t *
 mln_tcp_conn_pop_inline(mln_tcp_conn_t *tc, int type)
@@ -703,6 +568,7 @@ mln_tcp_conn_pop_inline(mln_tcp_conn_t *tc, int type)
     }
 
     mln_chain_t *rc = *head;
+    if (rc != NULL && rc->buf == tc->rcv_buf) tc->rcv_buf = NULL;
     if (rc == *tail) {
         *head = *tail = NULL;
         return rc;
@@ -715,14 +581,14 @@ mln_tcp_conn_pop_inline(mln_tcp_conn_t *tc, int type)
 
 int mln_tcp_conn_recv(mln_tcp_conn_t *tc, mln_u32_t flag)
 {
-    ASSERT(flag == M_C_TYPE_MEMORY || flag == M_C_TYPE_FILE);
+    ASSERT((flag & ~M_C_TYPE_FOLLOW) == M_C_TYPE_MEMORY || (flag & ~M_C_TYPE_FOLLOW) == M_C_TYPE_FILE);
 
     int n;
 
     if (mln_fd_is_nonblock(tc->sockfd)) {
 goon_non:
         while ((n = mln_tcp_conn_recv_chain(tc, flag)) > 0) {
-            /*do nothing*/
+            flag |= M_C_TYPE_FOLLOW;/*the rest of this round goes to the same file*/
         }
     } else {
 goon_blk:
@@ -747,109 +613,291 @@ goon_blk:
     return M_C_ERROR;
 }
 
-static inline int
-mln_tcp_conn_recv_chain(mln_tcp_conn_t *tc, mln_u32_t flag)
+/*
+ * The data is copied into the room left in the tail buffer first, the rest
+ * goes to a new buffer of at least rcv_size, which may be the spare one.
+ */
+int mln_tcp_conn_recv_feed(mln_tcp_conn_t *tc, mln_u8ptr_t data, int n)
 {
-    mln_buf_t *last = NULL;
-    int n = -1;
-    mln_buf_t *b;
-    mln_chain_t *c;
     mln_alloc_t *pool = mln_tcp_conn_pool_get(tc);
+    mln_buf_t *last, *b;
+    mln_chain_t *c;
+    mln_u8ptr_t buf;
+    mln_u32_t room, size;
 
+    if (n == 0) return M_C_CLOSED;
+    if (n < 0) {
+        errno = -n;
+        return M_C_ERROR;
+    }
+
+    if (tc->rcv_buf != NULL && tc->rcv_tail != NULL && tc->rcv_tail->buf == tc->rcv_buf) {
+        last = tc->rcv_buf;
+        if ((room = last->end - last->last) > (mln_u32_t)n) room = n;
+        memcpy(last->last, data, room);
+        last->last += room;
+        data += room;
+        if (!(n -= room)) return M_C_NOTYET;
+    }
+
+    if (tc->rcv_spare != NULL && tc->rcv_spare_size >= (mln_u32_t)n) {
+        buf = tc->rcv_spare;
+        size = tc->rcv_spare_size;
+        tc->rcv_spare = NULL;
+    } else {
+        size = tc->rcv_size > (mln_u32_t)n? tc->rcv_size: n;
+        if ((buf = (mln_u8ptr_t)mln_alloc_m(pool, size)) == NULL) {
+            errno = ENOMEM;
+            return M_C_ERROR;
+        }
+    }
     c = mln_chain_new(pool);
     b = mln_buf_new(pool);
     if (c == NULL || b == NULL) {
+        if (c != NULL) mln_alloc_free(c);
+        if (b != NULL) mln_alloc_free(b);
+        mln_alloc_free(buf);
         errno = ENOMEM;
-        return -1;
+        return M_C_ERROR;
     }
+
+    memcpy(buf, data, n);
+    b->left_pos = b->pos = b->start = buf;
+    b->last = buf + n;
+    b->end = buf + size;
+    b->in_memory = 1;
+    b->last_buf = 1;
     c->buf = b;
+    mln_tcp_conn_append(tc, c, M_C_RECV);
+    tc->rcv_buf = b;
 
-    if (flag & M_C_TYPE_FILE) {
-        if (flag & M_C_TYPE_FOLLOW && tc->rcv_tail != NULL && tc->rcv_tail->buf != NULL) {
-            last = tc->rcv_tail->buf;
-            if (!last->in_file) {
-                last = NULL;
-            }
-        }
-        n = mln_tcp_conn_recv_chain_file(tc->sockfd, pool, b, last);
-    } else if (flag & M_C_TYPE_MEMORY) {
-        n = mln_tcp_conn_recv_chain_mem(tc->sockfd, pool, b);
-    } else {
-        ASSERT(0);
-    }
+    return M_C_NOTYET;
+}
 
-    if (n <= 0) {
-        mln_chain_pool_release(c);
-    } else {
-        mln_tcp_conn_append(tc, c, M_C_RECV);
+static inline int
+mln_tcp_conn_recv_chain(mln_tcp_conn_t *tc, mln_u32_t flag)
+{
+    if (flag & M_C_TYPE_FILE) {
+        return mln_tcp_conn_recv_chain_file(tc, flag);
     }
+    ASSERT(flag & M_C_TYPE_MEMORY);
+    return mln_tcp_conn_recv_chain_mem(tc);
+}
 
-    return n;
+#if defined(MLN_SPLICE)
+static inline void mln_tcp_conn_pipe_close(mln_tcp_conn_t *tc)
+{
+    close(tc->rcv_pipe[0]);
+    close(tc->rcv_pipe[1]);
+    tc->rcv_pipe[0] = tc->rcv_pipe[1] = -1;
 }
+#endif
 
+/*
+ * With M_C_TYPE_FOLLOW, data is appended to the file of the tail buffer.
+ * If the tail buffer was filled by the last read, it is extended in place,
+ * otherwise a shadow buffer sharing its file is added.
+ * Data is moved by splice if possible, the pipe is drained before
+ * returning, so it is empty at the beginning of every read.
+ */
 static inline int
-mln_tcp_conn_recv_chain_file(int sockfd, \
-                             mln_alloc_t *pool, \
-                             mln_buf_t *b, \
-                             mln_buf_t *last)
+mln_tcp_conn_recv_chain_file(mln_tcp_conn_t *tc, mln_u32_t flag)
 {
+    mln_alloc_t *pool = mln_tcp_conn_pool_get(tc);
+    mln_buf_t *last = NULL, *b = NULL;
+    mln_chain_t *c = NULL;
+    mln_file_t *file;
+    mln_off_t off;
     int n;
+#if defined(MLN_SPLICE)
+    loff_t loff;
+    ssize_t left, m;
+#else
     mln_u8_t buf[1024];
+#endif
 
-#if defined(WIN32)
-    n = recv(sockfd, (char *)buf, sizeof(buf), 0);
+    if (flag & M_C_TYPE_FOLLOW && tc->rcv_tail != NULL && tc->rcv_tail->buf != NULL) {
+        last = tc->rcv_tail->buf;
+        if (!last->in_file) {
+            last = NULL;
+        }
+    }
+
+#if defined(MLN_SPLICE)
+    if (tc->rcv_pipe[0] < 0) {
+        if (pipe(tc->rcv_pipe) < 0) return -1;
+        (void)fcntl(tc->rcv_pipe[1], F_SETPIPE_SZ, M_C_SPLICE_SIZE);
+    }
+    n = splice(tc->sockfd, NULL, tc->rcv_pipe[1], NULL, M_C_SPLICE_SIZE, SPLICE_F_MOVE);
+#elif defined(WIN32)
+    n = recv(tc->sockfd, (char *)buf, sizeof(buf), 0);
 #else
-    n = recv(sockfd, buf, sizeof(buf), 0);
+    n = recv(tc->sockfd, buf, sizeof(buf), 0);
 #endif
     if (n <= 0) return n;
 
-    if (last == NULL) {
-        if ((b->file = mln_file_tmp_open(pool)) == NULL) {
-            return -1;
-        }
-        b->file_left_pos = b->file_pos = 0;
+    if (last != NULL && last == tc->rcv_buf) {
+        file = last->file;
+        off = last->file_last;
     } else {
-        b->file_left_pos = b->file_pos = last->file_last;
-        b->file = last->file;
-        last->shadow = b;
+        c = mln_chain_new(pool);
+        b = mln_buf_new(pool);
+        if (c == NULL || b == NULL) {
+            errno = ENOMEM;
+            goto err;
+        }
+        c->buf = b;
+        if (last == NULL) {
+            if ((b->file = mln_file_tmp_open(pool)) == NULL) {
+                goto err;
+            }
+            off = 0;
+        } else {
+            b->file = last->file;
+            off = last->file_last;
+        }
+        file = b->file;
     }
-    b->file_last = b->file_pos + n;
-    b->in_file = 1;
-    b->last_buf = 1;
 
-    if (write(mln_file_fd(b->file), buf, n) < 0) {
-        return -1;
+#if defined(MLN_SPLICE)
+    for (loff = off, left = n; left > 0; left -= m) {
+        if ((m = splice(tc->rcv_pipe[0], NULL, mln_file_fd(file), &loff, left, SPLICE_F_MOVE)) <= 0) {
+            if (m < 0 && errno == EINTR) {
+                m = 0;
+                continue;
+            }
+            goto err;
+        }
+    }
+#else
+    if (write(mln_file_fd(file), buf, n) < 0) {
+        goto err;
+    }
+#endif
+
+    if (c == NULL) {
+        last->file_last += n;
+        return n;
     }
 
+    b->file_left_pos = b->file_pos = off;
+    b->file_last = off + n;
+    b->in_file = 1;
+    b->last_buf = 1;
+    if (last != NULL) last->shadow = b;
+    mln_tcp_conn_append(tc, c, M_C_RECV);
+    tc->rcv_buf = b;
+
     return n;
+
+err:
+#if defined(MLN_SPLICE)
+    mln_tcp_conn_pipe_close(tc);
+#endif
+    if (b != NULL && b->file != NULL && last == NULL) {
+        mln_file_close(b->file);
+    }
+    if (b != NULL) mln_alloc_free(b);
+    if (c != NULL) mln_alloc_free(c);
+    return -1;
 }
 
+/*
+ * Receive into the room left in the tail buffer and a new buffer with one
+ * readv. The chain node and buffer are allocated before reading, so that
+ * no data read is lost on allocation failure, and are freed if the tail
+ * buffer takes all the data. A new buffer left unused is kept for the next
+ * read.
+ */
 static inline int
-mln_tcp_conn_recv_chain_mem(int sockfd, mln_alloc_t *pool, mln_buf_t *b)
+mln_tcp_conn_recv_chain_mem(mln_tcp_conn_t *tc)
 {
+    mln_alloc_t *pool = mln_tcp_conn_pool_get(tc);
+    mln_buf_t *last = NULL, *b;
+    mln_chain_t *c;
     mln_u8ptr_t buf;
-    int n;
+    mln_u32_t size, room = 0, offered;
+    int n, used;
+#if defined(MLN_WRITEV)
+    struct iovec vector[2];
+#endif
 
-    buf = (mln_u8ptr_t)mln_alloc_m(pool, 1024);
-    if (buf == NULL) {
+    if (tc->rcv_buf != NULL && tc->rcv_tail != NULL && tc->rcv_tail->buf == tc->rcv_buf) {
+        last = tc->rcv_buf;
+        room = last->end - last->last;
+    }
+
+    if (tc->rcv_spare != NULL) {
+        buf = tc->rcv_spare;
+        size = tc->rcv_spare_size;
+        tc->rcv_spare = NULL;
+    } else {
+        size = tc->rcv_size;
+        if ((buf = (mln_u8ptr_t)mln_alloc_m(pool, size)) == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    c = mln_chain_new(pool);
+    b = mln_buf_new(pool);
+    if (c == NULL || b == NULL) {
+        if (c != NULL) mln_alloc_free(c);
+        if (b != NULL) mln_alloc_free(b);
+        tc->rcv_spare = buf;
+        tc->rcv_spare_size = size;
         errno = ENOMEM;
         return -1;
     }
 
-#if defined(WIN32)
-    n = recv(sockfd, (char *)buf, 1024, 0);
+#if defined(MLN_WRITEV)
+    if (room) {
+        vector[0].iov_base = last->last;
+        vector[0].iov_len = room;
+        vector[1].iov_base = buf;
+        vector[1].iov_len = size;
+        n = readv(tc->sockfd, vector, 2);
+        offered = room + size;
+    } else {
+        n = recv(tc->sockfd, buf, size, 0);
+        offered = size;
+    }
 #else
-    n = recv(sockfd, buf, 1024, 0);
+    if (room) {
+        n = recv(tc->sockfd, (char *)(last->last), room, 0);
+        offered = room;
+    } else {
+        n = recv(tc->sockfd, (char *)buf, size, 0);
+        offered = size;
+    }
 #endif
-    if (n <= 0) {
-        mln_alloc_free(buf);
+
+    if (n > 0) {
+        if ((mln_u32_t)n == offered) {
+            if (tc->rcv_size < M_C_RCV_MAX) tc->rcv_size <<= 1;
+        } else if ((mln_u32_t)n <= (offered >> 2)) {
+            if (tc->rcv_size > M_C_RCV_MIN) tc->rcv_size >>= 1;
+        }
+    }
+
+    used = n > (int)room? n - room: 0;
+    if (n > 0 && room) last->last += n - used;
+
+    if (used == 0) {
+        mln_alloc_free(c);
+        mln_alloc_free(b);
+        tc->rcv_spare = buf;
+        tc->rcv_spare_size = size;
         return n;
     }
 
     b->left_pos = b->pos = b->start = buf;
-    b->last = b->end = buf + n;
+    b->last = buf + used;
+    b->end = buf + size;
     b->in_memory = 1;
     b->last_buf = 1;
+    c->buf = b;
+    mln_tcp_conn_append(tc, c, M_C_RECV);
+    tc->rcv_buf = b;
 
     return n;
 }
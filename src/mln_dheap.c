@@ -0,0 +1,86 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mln_dheap.h"
+
+mln_dheap_t *mln_dheap_new(struct mln_dheap_attr *attr)
+{
+    mln_dheap_t *dh;
+    if (attr != NULL && attr->pool != NULL)
+        dh = (mln_dheap_t *)attr->pool_alloc(attr->pool, sizeof(mln_dheap_t));
+    else
+        dh = (mln_dheap_t *)malloc(sizeof(mln_dheap_t));
+    if (dh == NULL) return NULL;
+
+    if (attr != NULL) {
+        dh->pool = attr->pool;
+        dh->pool_alloc = attr->pool_alloc;
+        dh->pool_free = attr->pool_free;
+        dh->cmp = attr->cmp;
+        dh->copy = attr->copy;
+        dh->key_free = attr->key_free;
+    } else {
+        dh->pool = NULL;
+        dh->pool_alloc = NULL;
+        dh->pool_free = NULL;
+        dh->cmp = NULL;
+        dh->copy = NULL;
+        dh->key_free = NULL;
+    }
+    dh->nodes = NULL;
+    dh->num = 0;
+    dh->len = 0;
+    return dh;
+}
+
+int mln_dheap_insert(mln_dheap_t *dh, mln_dheap_node_t *dn)
+{
+    return mln_dheap_inline_insert(dh, dn, NULL);
+}
+
+mln_dheap_node_t *mln_dheap_extract_min(mln_dheap_t *dh)
+{
+    return mln_dheap_inline_extract_min(dh, NULL);
+}
+
+int mln_dheap_decrease_key(mln_dheap_t *dh, mln_dheap_node_t *node, void *key)
+{
+    return mln_dheap_inline_decrease_key(dh, node, key, NULL, NULL);
+}
+
+void mln_dheap_delete(mln_dheap_t *dh, mln_dheap_node_t *node)
+{
+    mln_dheap_inline_delete(dh, node, NULL);
+}
+
+void mln_dheap_free(mln_dheap_t *dh)
+{
+    mln_dheap_inline_free(dh, NULL);
+}
+
+/*mln_dheap_node_t*/
+mln_dheap_node_t *mln_dheap_node_new(mln_dheap_t *dh, void *key)
+{
+    mln_dheap_node_t *dn;
+
+    if (dh->pool != NULL)
+        dn = (mln_dheap_node_t *)dh->pool_alloc(dh->pool, sizeof(mln_dheap_node_t));
+    else
+        dn = (mln_dheap_node_t *)malloc(sizeof(mln_dheap_node_t));
+    if (dn == NULL) return NULL;
+
+    dn->key = key;
+    dn->idx = M_DHEAP_NIL;
+    dn->nofree = 0;
+    return dn;
+}
+
+void mln_dheap_node_free(mln_dheap_t *dh, mln_dheap_node_t *dn)
+{
+    mln_dheap_inline_node_free(dh, dn, NULL);
+}
+
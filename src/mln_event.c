@@ -15,6 +15,11 @@
 #if !defined(WIN32)
 #include <sys/socket.h>
 #endif
+#if defined(MLN_IOURING)
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
 
 /*declarations*/
 MLN_CHAIN_FUNC_DECLARE(ev_fd_wait, \
@@ -23,10 +28,17 @@ MLN_CHAIN_FUNC_DECLARE(ev_fd_wait, \
 MLN_CHAIN_FUNC_DECLARE(ev_fd_active, \
                        mln_event_desc_t, \
                        static inline void,);
+MLN_CHAIN_FUNC_DECLARE(ev_tw, \
+                       mln_event_desc_t, \
+                       static inline void,);
 static inline void
 mln_event_desc_free(void *data);
-static int
-mln_event_rbtree_fd_cmp(const void *k1, const void *k2) __NONNULL2(1,2);
+static inline mln_event_desc_t *
+mln_event_fd_search(mln_event_t *event, int fd) __NONNULL1(1);
+static inline int
+mln_event_fd_insert(mln_event_t *event, mln_event_desc_t *ed) __NONNULL2(1,2);
+static inline void
+mln_event_fd_remove(mln_event_t *event, mln_event_desc_t *ed) __NONNULL2(1,2);
 static inline int
 mln_event_fd_timeout_cmp(const void *k1, const void *k2);
 static inline void
@@ -65,6 +77,50 @@ mln_event_fd_append_set(mln_event_t *event, \
                         int other_mark);
 static int
 mln_event_fd_timeout_set(mln_event_t *ev, mln_event_desc_t *ed, int timeout_ms);
+static inline void
+mln_event_fd_timeout_unset(mln_event_t *ev, mln_event_desc_t *ed) __NONNULL2(1,2);
+static mln_event_wheel_t *mln_event_wheel_new(mln_u32_t tick_ms);
+static void mln_event_wheel_free(mln_event_wheel_t *w, void (*freer)(void *));
+static inline void
+mln_event_wheel_add(mln_event_wheel_t *w, mln_event_desc_t *ed) __NONNULL2(1,2);
+static inline void
+mln_event_wheel_del(mln_event_wheel_t *w, mln_event_desc_t *ed) __NONNULL2(1,2);
+static inline mln_event_desc_t *
+mln_event_wheel_expired(mln_event_wheel_t *w, mln_u64_t now) __NONNULL1(1);
+static inline int
+mln_event_wheel_next(mln_event_wheel_t *w, mln_u64_t *end_us) __NONNULL2(1,2);
+static inline mln_s64_t mln_event_wait_us(mln_event_t *event) __NONNULL1(1);
+static void mln_event_ms_handler(mln_event_t *event, int fd, void *data);
+#if defined(MLN_IOURING)
+static mln_event_uring_t *mln_event_uring_new(void);
+static void mln_event_uring_free(mln_event_uring_t *r);
+static inline void
+mln_event_uring_update(mln_event_t *event, mln_event_desc_t *ed) __NONNULL2(1,2);
+static inline void
+mln_event_uring_cancel(mln_event_t *event, mln_event_desc_t *ed) __NONNULL2(1,2);
+static void mln_event_uring_br_init(mln_event_uring_t *r) __NONNULL1(1);
+static void mln_event_uring_dispatch(mln_event_t *event) __NONNULL1(1);
+#endif
+
+/*
+ * locks
+ * An event created with the nolock attribute is only used by its owner thread,
+ * so all these become no-ops.
+ */
+static inline void mln_event_lock(mln_event_t *ev, pthread_mutex_t *lock)
+{
+    if (!ev->nolock) pthread_mutex_lock(lock);
+}
+
+static inline void mln_event_unlock(mln_event_t *ev, pthread_mutex_t *lock)
+{
+    if (!ev->nolock) pthread_mutex_unlock(lock);
+}
+
+static inline int mln_event_trylock(mln_event_t *ev, pthread_mutex_t *lock)
+{
+    return ev->nolock? 0: pthread_mutex_trylock(lock);
+}
 
 /*varliables*/
 mln_event_desc_t fheap_min = {
@@ -75,57 +131,108 @@ mln_event_desc_t fheap_min = {
 
 mln_event_t *mln_event_new(void)
 {
-    int rc;
+    return mln_event_new_attr(NULL);
+}
+
+mln_event_t *mln_event_new_attr(struct mln_event_attr *attr)
+{
+    int rc = 0;
     mln_event_t *ev;
     ev = (mln_event_t *)malloc(sizeof(mln_event_t));
     if (ev == NULL) {
         return NULL;
     }
+    ev->nolock = (attr != NULL && attr->nolock)? 1: 0;
+    ev->timer_wheel = (attr != NULL && attr->timer_wheel)? 1: 0;
     ev->callback = NULL;
     ev->callback_data = NULL;
+#if defined(MLN_EPOLL) || defined(MLN_KQUEUE)
+    ev->ev_fd_tbl = NULL;
+    ev->ev_fd_tbl_len = 0;
+#else
     ev->ev_fd_tree = mln_rbtree_new(NULL);
     if (ev->ev_fd_tree == NULL) {
         goto err1;
     }
+#endif
     ev->ev_fd_wait_head = NULL;
     ev->ev_fd_wait_tail = NULL;
     ev->ev_fd_active_head = NULL;
     ev->ev_fd_active_tail = NULL;
-
-    ev->ev_fd_timeout_heap = mln_fheap_new(&fheap_min, NULL);
-    if (ev->ev_fd_timeout_heap == NULL) {
-        goto err2;
-    }
-    /*timer heap*/
-    struct mln_fheap_attr fattr;
-    fattr.pool = NULL;
-    fattr.pool_alloc = NULL;
-    fattr.pool_free = NULL;
-    fattr.cmp = mln_event_fheap_timer_cmp;
-    fattr.copy = mln_event_fheap_timer_copy;
-    fattr.key_free = mln_event_desc_free;
-    ev->ev_timer_heap = mln_fheap_new(&fheap_min, &fattr);
-    if (ev->ev_timer_heap == NULL) {
-        goto err3;
+    ev->ev_fd_timeout_heap = NULL;
+    ev->ev_timer_heap = NULL;
+    ev->ev_fd_timeout_wheel = NULL;
+    ev->ev_timer_wheel = NULL;
+
+    if (ev->timer_wheel) {
+        if ((ev->ev_fd_timeout_wheel = mln_event_wheel_new(attr->timer_tick_ms)) == NULL) {
+            goto err2;
+        }
+        if ((ev->ev_timer_wheel = mln_event_wheel_new(attr->timer_tick_ms)) == NULL) {
+            goto err3;
+        }
+    } else {
+        ev->ev_fd_timeout_heap = mln_fheap_new(&fheap_min, NULL);
+        if (ev->ev_fd_timeout_heap == NULL) {
+            goto err2;
+        }
+        /*timer heap*/
+        struct mln_fheap_attr fattr;
+        fattr.pool = NULL;
+        fattr.pool_alloc = NULL;
+        fattr.pool_free = NULL;
+        fattr.cmp = mln_event_fheap_timer_cmp;
+        fattr.copy = mln_event_fheap_timer_copy;
+        fattr.key_free = mln_event_desc_free;
+        ev->ev_timer_heap = mln_fheap_new(&fheap_min, &fattr);
+        if (ev->ev_timer_heap == NULL) {
+            goto err3;
+        }
     }
     ev->is_break = 0;
+    ev->nr_wakeups = 0;
+    ev->nr_idle_wakeups = 0;
 #if defined(MLN_EPOLL)
     ev->epollfd = epoll_create(M_EV_EPOLL_SIZE);
     if (ev->epollfd < 0) {
         goto err4;
     }
-    ev->unusedfd = epoll_create(M_EV_EPOLL_SIZE);
-    if (ev->unusedfd < 0) {
+    if (ev->nolock) {
+        ev->unusedfd = -1;
+    } else if ((ev->unusedfd = epoll_create(M_EV_EPOLL_SIZE)) < 0) {
         close(ev->epollfd);
         goto err4;
     }
+    ev->timerfd = -1;
+    if (attr != NULL && attr->precise_timer) {
+        struct epoll_event tev;
+        if ((ev->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0) {
+            close(ev->epollfd);
+            if (ev->unusedfd >= 0) close(ev->unusedfd);
+            goto err4;
+        }
+        memset(&tev, 0, sizeof(tev));
+        tev.events = EPOLLIN;
+        tev.data.ptr = NULL;/*no descriptor, see mln_event_dispatch*/
+        if (epoll_ctl(ev->epollfd, EPOLL_CTL_ADD, ev->timerfd, &tev) < 0) {
+            close(ev->timerfd);
+            close(ev->epollfd);
+            if (ev->unusedfd >= 0) close(ev->unusedfd);
+            goto err4;
+        }
+    }
+#if defined(MLN_IOURING)
+    /*opt-in, fall back to epoll if io_uring is not available at runtime*/
+    ev->uring = (attr != NULL && attr->iouring)? mln_event_uring_new(): NULL;
+#endif
 #elif defined(MLN_KQUEUE)
     ev->kqfd = kqueue();
     if (ev->kqfd < 0) {
         goto err4;
     }
-    ev->unusedfd = kqueue();
-    if (ev->unusedfd < 0) {
+    if (ev->nolock) {
+        ev->unusedfd = -1;
+    } else if ((ev->unusedfd = kqueue()) < 0) {
         close(ev->kqfd);
         goto err4;
     }
@@ -136,19 +243,27 @@ mln_event_t *mln_event_new(void)
     FD_ZERO(&(ev->err_set));
 #endif
 
-    rc = pthread_mutex_init(&ev->fd_lock, NULL);
-    if (pthread_mutex_init(&ev->timer_lock, NULL) != 0)
-        rc = -1;
-    if (pthread_mutex_init(&ev->cb_lock, NULL) != 0)
-        rc = -1;
+    if (!ev->nolock) {
+        rc = pthread_mutex_init(&ev->fd_lock, NULL);
+        if (pthread_mutex_init(&ev->timer_lock, NULL) != 0)
+            rc = -1;
+        if (pthread_mutex_init(&ev->cb_lock, NULL) != 0)
+            rc = -1;
+    }
     if (rc) {
         pthread_mutex_destroy(&ev->fd_lock);
         pthread_mutex_destroy(&ev->timer_lock);
         pthread_mutex_destroy(&ev->cb_lock);
 #if defined(MLN_EPOLL)
         close(ev->epollfd);
+        close(ev->unusedfd);
+        if (ev->timerfd >= 0) close(ev->timerfd);
+#if defined(MLN_IOURING)
+        mln_event_uring_free(ev->uring);
+#endif
 #elif defined(MLN_KQUEUE)
         close(ev->kqfd);
+        close(ev->unusedfd);
 #endif
         goto err4;
     }
@@ -157,11 +272,17 @@ mln_event_t *mln_event_new(void)
 
 err4:
     mln_fheap_inline_free(ev->ev_timer_heap, mln_event_fheap_timer_cmp, mln_event_desc_free);
+    mln_event_wheel_free(ev->ev_timer_wheel, mln_event_desc_free);
 err3:
     mln_fheap_inline_free(ev->ev_fd_timeout_heap, mln_event_fd_timeout_cmp, NULL);
+    mln_event_wheel_free(ev->ev_fd_timeout_wheel, NULL);
 err2:
+#if defined(MLN_EPOLL) || defined(MLN_KQUEUE)
+    /*fd table is allocated lazily, nothing to do.*/
+#else
     mln_rbtree_free(ev->ev_fd_tree);
 err1:
+#endif
     free(ev);
     return NULL;
 }
@@ -171,7 +292,12 @@ void mln_event_free(mln_event_t *ev)
     if (ev == NULL) return;
     mln_event_desc_t *ed;
     mln_fheap_inline_free(ev->ev_fd_timeout_heap, mln_event_fd_timeout_cmp, NULL);
+    mln_event_wheel_free(ev->ev_fd_timeout_wheel, NULL);
+#if defined(MLN_EPOLL) || defined(MLN_KQUEUE)
+    if (ev->ev_fd_tbl != NULL) free(ev->ev_fd_tbl);
+#else
     mln_rbtree_free(ev->ev_fd_tree);
+#endif
     while ((ed = ev->ev_fd_wait_head) != NULL) {
         ev_fd_wait_chain_del(&(ev->ev_fd_wait_head), \
                              &(ev->ev_fd_wait_tail), \
@@ -179,18 +305,25 @@ void mln_event_free(mln_event_t *ev)
         mln_event_desc_free(ed);
     }
     mln_fheap_inline_free(ev->ev_timer_heap, mln_event_fheap_timer_cmp, mln_event_desc_free);
+    mln_event_wheel_free(ev->ev_timer_wheel, mln_event_desc_free);
 #if defined(MLN_EPOLL)
     close(ev->epollfd);
-    close(ev->unusedfd);
+    if (ev->unusedfd >= 0) close(ev->unusedfd);
+    if (ev->timerfd >= 0) close(ev->timerfd);
+#if defined(MLN_IOURING)
+    mln_event_uring_free(ev->uring);
+#endif
 #elif defined(MLN_KQUEUE)
     close(ev->kqfd);
-    close(ev->unusedfd);
+    if (ev->unusedfd >= 0) close(ev->unusedfd);
 #else
     /*select do nothing.*/
 #endif
-    pthread_mutex_destroy(&ev->fd_lock);
-    pthread_mutex_destroy(&ev->timer_lock);
-    pthread_mutex_destroy(&ev->cb_lock);
+    if (!ev->nolock) {
+        pthread_mutex_destroy(&ev->fd_lock);
+        pthread_mutex_destroy(&ev->timer_lock);
+        pthread_mutex_destroy(&ev->cb_lock);
+    }
     free(ev);
 }
 
@@ -226,23 +359,40 @@ mln_event_timer_t *mln_event_timer_set(mln_event_t *event, \
     ed->next = NULL;
     ed->act_prev = NULL;
     ed->act_next = NULL;
+    ed->tw_prev = NULL;
+    ed->tw_next = NULL;
+    ed->tw_slot = NULL;
+    ed->data.tm.node = NULL;
+    if (event->timer_wheel) {
+        mln_event_lock(event, &event->timer_lock);
+        mln_event_wheel_add(event->ev_timer_wheel, ed);
+        mln_event_unlock(event, &event->timer_lock);
+        return ed;
+    }
     mln_fheap_node_t *fn = mln_fheap_node_new(event->ev_timer_heap, ed);
     if (fn == NULL) {
         free(ed);
         return NULL;
     }
-    pthread_mutex_lock(&event->timer_lock);
+    ed->data.tm.node = fn;
+    mln_event_lock(event, &event->timer_lock);
     mln_fheap_inline_insert(event->ev_timer_heap, fn, mln_event_fheap_timer_cmp);
-    pthread_mutex_unlock(&event->timer_lock);
-    return fn;
+    mln_event_unlock(event, &event->timer_lock);
+    return ed;
 }
 
 void mln_event_timer_cancel(mln_event_t *event, mln_event_timer_t *timer)
 {
-    pthread_mutex_lock(&event->timer_lock);
-    mln_fheap_inline_delete(event->ev_timer_heap, timer, mln_event_fheap_timer_copy, mln_event_fheap_timer_cmp);
-    mln_fheap_inline_node_free(event->ev_timer_heap, timer, mln_event_desc_free);
-    pthread_mutex_unlock(&event->timer_lock);
+    mln_event_lock(event, &event->timer_lock);
+    if (event->timer_wheel) {
+        mln_event_wheel_del(event->ev_timer_wheel, timer);
+        mln_event_desc_free(timer);
+    } else {
+        mln_fheap_node_t *fn = timer->data.tm.node;
+        mln_fheap_inline_delete(event->ev_timer_heap, fn, mln_event_fheap_timer_copy, mln_event_fheap_timer_cmp);
+        mln_fheap_inline_node_free(event->ev_timer_heap, fn, mln_event_desc_free);
+    }
+    mln_event_unlock(event, &event->timer_lock);
 }
 
 static inline void mln_event_timer_process(mln_event_t *event)
@@ -252,32 +402,43 @@ static inline void mln_event_timer_process(mln_event_t *event)
     gettimeofday(&tv, NULL);
     now = tv.tv_sec * 1000000 + tv.tv_usec;
     mln_event_desc_t *ed;
-    mln_fheap_node_t *fn;
+    mln_fheap_node_t *fn = NULL;
 
 lp:
-    if (pthread_mutex_trylock(&event->timer_lock))
+    if (mln_event_trylock(event, &event->timer_lock))
         return;
 
-    fn = mln_fheap_minimum(event->ev_timer_heap);
-    if (fn == NULL) {
-        pthread_mutex_unlock(&event->timer_lock);
-        return;
-    }
+    if (event->timer_wheel) {
+        ed = mln_event_wheel_expired(event->ev_timer_wheel, now);
+        if (ed == NULL) {
+            mln_event_unlock(event, &event->timer_lock);
+            return;
+        }
+    } else {
+        fn = mln_fheap_minimum(event->ev_timer_heap);
+        if (fn == NULL) {
+            mln_event_unlock(event, &event->timer_lock);
+            return;
+        }
 
-    ed = (mln_event_desc_t *)mln_fheap_node_key(fn);
-    if (ed->data.tm.end_tm > now) {
-        pthread_mutex_unlock(&event->timer_lock);
-        return;
-    }
+        ed = (mln_event_desc_t *)mln_fheap_node_key(fn);
+        if (ed->data.tm.end_tm > now) {
+            mln_event_unlock(event, &event->timer_lock);
+            return;
+        }
 
-    fn = mln_fheap_inline_extract_min(event->ev_timer_heap, mln_event_fheap_timer_cmp);
+        fn = mln_fheap_inline_extract_min(event->ev_timer_heap, mln_event_fheap_timer_cmp);
+    }
 
-    pthread_mutex_unlock(&event->timer_lock);
+    mln_event_unlock(event, &event->timer_lock);
 
     if (ed->data.tm.handler != NULL)
         ed->data.tm.handler(event, ed->data.tm.data);
 
-    mln_fheap_inline_node_free(event->ev_timer_heap, fn, mln_event_desc_free);
+    if (fn != NULL)
+        mln_fheap_inline_node_free(event->ev_timer_heap, fn, mln_event_desc_free);
+    else
+        mln_event_desc_free(ed);
 
     if (!event->is_break)
         goto lp;
@@ -291,17 +452,12 @@ void mln_event_fd_timeout_handler_set(mln_event_t *event, \
                                       void *data, \
                                       ev_fd_handler timeout_handler)
 {
-    pthread_mutex_lock(&event->fd_lock);
-    mln_event_desc_t tmp;
-    memset(&tmp, 0, sizeof(tmp));
-    tmp.type = M_EV_FD;
-    tmp.data.fd.fd = fd;
-    mln_rbtree_node_t *rn = mln_rbtree_inline_search(event->ev_fd_tree, &tmp, mln_event_rbtree_fd_cmp);
-    ASSERT(!mln_rbtree_null(rn, event->ev_fd_tree));
-    mln_event_desc_t *ed = (mln_event_desc_t *)mln_rbtree_node_data_get(rn);
+    mln_event_lock(event, &event->fd_lock);
+    mln_event_desc_t *ed = mln_event_fd_search(event, fd);
+    ASSERT(ed != NULL);
     ed->data.fd.timeout_data = data;
     ed->data.fd.timeout_handler = timeout_handler;
-    pthread_mutex_unlock(&event->fd_lock);
+    mln_event_unlock(event, &event->fd_lock);
 }
 
 int mln_event_fd_set(mln_event_t *event, \
@@ -313,27 +469,22 @@ int mln_event_fd_set(mln_event_t *event, \
 {
     ASSERT(fd >= 0 && !(flag & ~M_EV_FD_MASK) && flag <= M_EV_CLR && !((flag & M_EV_NONBLOCK) && (flag & M_EV_BLOCK)));
 
-    pthread_mutex_lock(&event->fd_lock);
+    mln_event_lock(event, &event->fd_lock);
     if (flag == M_EV_CLR) {
         mln_event_fd_clr_set(event, fd);
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, &event->fd_lock);
         return 0;
     }
-    mln_event_desc_t tmp;
-    memset(&tmp, 0, sizeof(tmp));
-    tmp.type = M_EV_FD;
-    tmp.data.fd.fd = fd;
-    mln_rbtree_node_t *rn;
-    rn = mln_rbtree_inline_search(event->ev_fd_tree, &tmp, mln_event_rbtree_fd_cmp);
-    if (!mln_rbtree_null(rn, event->ev_fd_tree)) {
+    mln_event_desc_t *ed = mln_event_fd_search(event, fd);
+    if (ed != NULL) {
         if (flag & M_EV_APPEND) {
             if (flag & M_EV_NONBLOCK) mln_event_fd_nonblock_set(fd);
             if (flag & M_EV_BLOCK) mln_event_fd_block_set(fd);
 
-            ASSERT(!(((mln_event_desc_t *)mln_rbtree_node_data_get(rn))->data.fd.is_clear));
+            ASSERT(!ed->data.fd.is_clear);
 
             if (mln_event_fd_append_set(event, \
-                                        (mln_event_desc_t *)mln_rbtree_node_data_get(rn), \
+                                        ed, \
                                         fd, \
                                         flag, \
                                         timeout_ms, \
@@ -341,7 +492,7 @@ int mln_event_fd_set(mln_event_t *event, \
                                         fd_handler, \
                                         1) < 0)
             {
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, &event->fd_lock);
                 return -1;
             }
         } else {
@@ -351,19 +502,19 @@ int mln_event_fd_set(mln_event_t *event, \
                 mln_event_fd_block_set(fd);
             }
             if (mln_event_fd_normal_set(event, \
-                                        (mln_event_desc_t *)(rn->data), \
+                                        ed, \
                                         fd, \
                                         flag, \
                                         timeout_ms, \
                                         data, \
                                         fd_handler, \
-                                        ((mln_event_desc_t *)(rn->data))->data.fd.is_clear?0:1) < 0)
+                                        ed->data.fd.is_clear?0:1) < 0)
             {
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, &event->fd_lock);
                 return -1;
             }
         }
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, &event->fd_lock);
         return 0;
     }
     if (flag & M_EV_NONBLOCK) {
@@ -372,13 +523,108 @@ int mln_event_fd_set(mln_event_t *event, \
         mln_event_fd_block_set(fd);
     }
     if (mln_event_fd_normal_set(event, NULL, fd, flag, timeout_ms, data, fd_handler, 0) < 0) {
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, &event->fd_lock);
         return -1;
     }
-    pthread_mutex_unlock(&event->fd_lock);
+    mln_event_unlock(event, &event->fd_lock);
     return 0;
 }
 
+/*
+ * multishot accept and recv
+ * The descriptor is set readable with mln_event_ms_handler, which accepts or
+ * receives when it is called. The io_uring backend replaces the readable poll
+ * with a multishot request instead, see mln_event_uring_update.
+ */
+static int mln_event_ms_set(mln_event_t *event, int fd, mln_event_fd_ms_t *ms)
+{
+    int rc;
+    mln_event_desc_t *ed;
+
+    ASSERT(fd >= 0);
+    mln_event_fd_nonblock_set(fd);
+
+    mln_event_lock(event, &event->fd_lock);
+#if defined(MLN_IOURING)
+    if (ms->recv_handler != NULL && event->uring != NULL && !event->uring->br_tried)
+        mln_event_uring_br_init(event->uring);
+#endif
+    ed = mln_event_fd_search(event, fd);
+    if (ed != NULL && !ed->data.fd.is_clear) {
+        rc = mln_event_fd_append_set(event, ed, fd, M_EV_RECV, M_EV_UNMODIFIED, ms, mln_event_ms_handler, 1);
+    } else {
+        rc = mln_event_fd_normal_set(event, ed, fd, M_EV_RECV, M_EV_UNLIMITED, ms, mln_event_ms_handler, 0);
+    }
+    mln_event_unlock(event, &event->fd_lock);
+    return rc;
+}
+
+int mln_event_accept_set(mln_event_t *event, int fd, void *data, ev_accept_handler handler)
+{
+    mln_event_fd_ms_t ms;
+
+    ASSERT(handler != NULL);
+    ms.accept_handler = handler;
+    ms.recv_handler = NULL;
+    ms.data = data;
+    return mln_event_ms_set(event, fd, &ms);
+}
+
+int mln_event_recv_set(mln_event_t *event, int fd, void *data, ev_recv_handler handler)
+{
+    mln_event_fd_ms_t ms;
+
+    ASSERT(handler != NULL);
+    ms.accept_handler = NULL;
+    ms.recv_handler = handler;
+    ms.data = data;
+    return mln_event_ms_set(event, fd, &ms);
+}
+
+/*
+ * Readable handler of the descriptors set by mln_event_ms_set,
+ * used by all backends but the multishot requests of io_uring.
+ */
+static void mln_event_ms_handler(mln_event_t *event, int fd, void *data)
+{
+    int n;
+    mln_event_desc_t *ed;
+    mln_event_fd_ms_t ms;
+    mln_u8_t buf[M_EV_RECV_BUF_SIZE];
+
+    mln_event_lock(event, &event->fd_lock);
+    ed = mln_event_fd_search(event, fd);
+    ASSERT(ed != NULL);
+    ms = ed->data.fd.ms;
+    mln_event_unlock(event, &event->fd_lock);
+
+    if (ms.accept_handler != NULL) {
+        while (1) {
+            if ((n = accept(fd, NULL, NULL)) < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                ms.accept_handler(event, fd, -errno, ms.data);
+                break;
+            }
+            ms.accept_handler(event, fd, n, ms.data);
+
+            mln_event_lock(event, &event->fd_lock);
+            n = ed->data.fd.is_clear || ed->data.fd.ms.accept_handler == NULL || event->is_break;
+            mln_event_unlock(event, &event->fd_lock);
+            if (n) break;
+        }
+    } else if (ms.recv_handler != NULL) {
+again:
+        if ((n = recv(fd, (char *)buf, sizeof(buf), 0)) < 0) {
+            if (errno == EINTR) goto again;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            ms.recv_handler(event, fd, NULL, -errno, ms.data);
+        } else {
+            ms.recv_handler(event, fd, n? buf: NULL, n, ms.data);
+        }
+    }
+}
+
 static inline int
 mln_event_fd_normal_set(mln_event_t *event, \
                         mln_event_desc_t *ed, \
@@ -402,13 +648,13 @@ mln_event_fd_normal_set(mln_event_t *event, \
         ed->prev = NULL;
         ed->act_next = NULL;
         ed->act_prev = NULL;
-        mln_rbtree_node_t *rn;
-        rn = mln_rbtree_node_new(event->ev_fd_tree, ed);
-        if (rn == NULL) {
+        ed->tw_next = NULL;
+        ed->tw_prev = NULL;
+        ed->tw_slot = NULL;
+        if (mln_event_fd_insert(event, ed) < 0) {
             free(ed);
             return -1;
         }
-        mln_rbtree_inline_insert(event->ev_fd_tree, rn, mln_event_rbtree_fd_cmp);
         ev_fd_wait_chain_add(&(event->ev_fd_wait_head), \
                              &(event->ev_fd_wait_tail), \
                              ed);
@@ -457,6 +703,16 @@ mln_event_fd_append_set(mln_event_t *event, \
 {
     if (mln_event_fd_timeout_set(event, ed, timeout_ms) < 0)
         return -1;
+    if (flag & M_EV_RECV) {
+        /*data of mln_event_ms_handler is the multishot handlers, see mln_event_ms_set*/
+        if (fd_handler == mln_event_ms_handler) {
+            ed->data.fd.ms = *(mln_event_fd_ms_t *)data;
+            data = NULL;
+        } else {
+            memset(&(ed->data.fd.ms), 0, sizeof(mln_event_fd_ms_t));
+        }
+        ed->data.fd.ms_done = 0;
+    }
 #if defined(MLN_EPOLL)
 #define CASE_MACRO(flg); \
     if (other_mark) {\
@@ -507,6 +763,12 @@ mln_event_fd_append_set(mln_event_t *event, \
         if (oneshot) ed->data.fd.err_oneshot = 1;
         mask |= 0x4;
     }
+#if defined(MLN_IOURING)
+    if (event->uring != NULL) {
+        mln_event_uring_update(event, ed);
+        return 0;
+    }
+#endif
     struct epoll_event ev;
     memset(&ev, 0, sizeof(ev));
     switch (mask) {
@@ -611,19 +873,18 @@ mln_event_fd_timeout_set(mln_event_t *ev, mln_event_desc_t *ed, int timeout_ms)
     if (timeout_ms == M_EV_UNMODIFIED) return 0;
     mln_event_fd_t *ef = &(ed->data.fd);
     if (timeout_ms == M_EV_UNLIMITED) {
-        if (ef->timeout_node != NULL) {
-            mln_fheap_inline_delete(ev->ev_fd_timeout_heap, ef->timeout_node, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
-            mln_fheap_inline_node_free(ev->ev_fd_timeout_heap, ef->timeout_node, NULL);
-            ef->timeout_node = NULL;
-            ef->end_us = 0;
-        }
+        mln_event_fd_timeout_unset(ev, ed);
         return 0;
     }
     mln_fheap_node_t *fn;
     struct timeval tv;
     memset(&tv, 0, sizeof(tv));
     gettimeofday(&tv, NULL);
-    if (ef->timeout_node == NULL) {
+    if (ev->timer_wheel) {
+        mln_event_wheel_del(ev->ev_fd_timeout_wheel, ed);
+        ef->end_us = tv.tv_sec*1000000+tv.tv_usec+timeout_ms*1000;
+        mln_event_wheel_add(ev->ev_fd_timeout_wheel, ed);
+    } else if (ef->timeout_node == NULL) {
         ef->end_us = tv.tv_sec*1000000+tv.tv_usec+timeout_ms*1000;
         fn = mln_fheap_node_new(ev->ev_fd_timeout_heap, ed);
         if (fn == NULL) {
@@ -640,30 +901,41 @@ mln_event_fd_timeout_set(mln_event_t *ev, mln_event_desc_t *ed, int timeout_ms)
     return 0;
 }
 
+static inline void
+mln_event_fd_timeout_unset(mln_event_t *ev, mln_event_desc_t *ed)
+{
+    mln_event_fd_t *ef = &(ed->data.fd);
+    if (ev->timer_wheel) {
+        mln_event_wheel_del(ev->ev_fd_timeout_wheel, ed);
+    } else if (ef->timeout_node != NULL) {
+        mln_fheap_inline_delete(ev->ev_fd_timeout_heap, ef->timeout_node, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
+        mln_fheap_inline_node_free(ev->ev_fd_timeout_heap, ef->timeout_node, NULL);
+        ef->timeout_node = NULL;
+    }
+    ef->end_us = 0;
+}
+
 static inline void
 mln_event_fd_clr_set(mln_event_t *event, int fd)
 {
-    mln_event_desc_t tmp, *ed;
-    memset(&tmp, 0, sizeof(tmp));
-    tmp.type = M_EV_FD;
-    tmp.data.fd.fd = fd;
-    mln_rbtree_node_t *rn;
-    rn = mln_rbtree_inline_search(event->ev_fd_tree, &tmp, mln_event_rbtree_fd_cmp);
-    if (mln_rbtree_null(rn, event->ev_fd_tree)) {
+    mln_event_desc_t *ed = mln_event_fd_search(event, fd);
+    if (ed == NULL) {
         return;
     }
-    ed = (mln_event_desc_t *)mln_rbtree_node_data_get(rn);
-    if (ed->data.fd.timeout_node != NULL) {
-        mln_fheap_inline_delete(event->ev_fd_timeout_heap, ed->data.fd.timeout_node, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
-        mln_fheap_inline_node_free(event->ev_fd_timeout_heap, ed->data.fd.timeout_node, NULL);
-        ed->data.fd.timeout_node = NULL;
-        ed->data.fd.end_us = 0;
-    }
+    mln_event_fd_timeout_unset(event, ed);
 #if defined(MLN_EPOLL)
+#if defined(MLN_IOURING)
+    if (event->uring != NULL) {
+        mln_event_uring_cancel(event, ed);
+    } else {
+#endif
     struct epoll_event ev;
     memset(&ev, 0, sizeof(ev));
     ev.data.ptr = ed;
     epoll_ctl(event->epollfd, EPOLL_CTL_DEL, fd, &ev);
+#if defined(MLN_IOURING)
+    }
+#endif
 #elif defined(MLN_KQUEUE)
     struct kevent ev;
     EV_SET(&ev, fd, EVFILT_READ, EV_DELETE, 0, 0, ed);
@@ -682,8 +954,7 @@ mln_event_fd_clr_set(mln_event_t *event, int fd)
         ed->data.fd.is_clear = 1;
         return;
     }
-    mln_rbtree_delete(event->ev_fd_tree, rn);
-    mln_rbtree_node_free(event->ev_fd_tree, rn);
+    mln_event_fd_remove(event, ed);
     if (ed->data.fd.in_active) {
         ev_fd_active_chain_del(&(event->ev_fd_active_head), \
                                &(event->ev_fd_active_tail), \
@@ -704,10 +975,10 @@ void mln_event_callback_set(mln_event_t *ev, \
                             dispatch_callback dc, \
                             void *dc_data)
 {
-    pthread_mutex_lock(&ev->cb_lock);
+    mln_event_lock(ev, &ev->cb_lock);
     ev->callback = dc;
     ev->callback_data = dc_data;
-    pthread_mutex_unlock(&ev->cb_lock);
+    mln_event_unlock(ev, &ev->cb_lock);
 }
 
 /*
@@ -743,6 +1014,76 @@ mln_event_fd_block_set(int fd)
 #endif
 }
 
+/*
+ * wait time
+ * The earliest of fd timeouts (fd_lock is held by the caller) and timers.
+ * Return -1 if there is no deadline.
+ */
+static inline mln_s64_t mln_event_wait_us(mln_event_t *event)
+{
+    struct timeval tv;
+    mln_fheap_node_t *fn;
+    mln_u64_t now, end, next = 0;
+    int found = 0;
+    int bounded = !event->nolock || event->callback != NULL;
+
+    if (event->ev_fd_active_head != NULL) return 0;
+
+    if (event->timer_wheel) {
+        if (!mln_event_wheel_next(event->ev_fd_timeout_wheel, &end)) {
+            next = end;
+            found = 1;
+        }
+    } else if ((fn = mln_fheap_minimum(event->ev_fd_timeout_heap)) != NULL) {
+        next = ((mln_event_desc_t *)mln_fheap_node_key(fn))->data.fd.end_us;
+        found = 1;
+    }
+
+    if (mln_event_trylock(event, &event->timer_lock)) {
+        return M_EV_TIMEOUT_US;
+    }
+    if (event->timer_wheel) {
+        if (!mln_event_wheel_next(event->ev_timer_wheel, &end) && (!found || end < next)) {
+            next = end;
+            found = 1;
+        }
+    } else if ((fn = mln_fheap_minimum(event->ev_timer_heap)) != NULL) {
+        end = ((mln_event_desc_t *)mln_fheap_node_key(fn))->data.tm.end_tm;
+        if (!found || end < next) {
+            next = end;
+            found = 1;
+        }
+    }
+    mln_event_unlock(event, &event->timer_lock);
+
+    if (!found) return bounded? M_EV_TIMEOUT_US: -1;
+
+    gettimeofday(&tv, NULL);
+    now = tv.tv_sec * 1000000 + tv.tv_usec;
+    if (next <= now) return 0;
+    if (bounded && next - now > M_EV_TIMEOUT_US) return M_EV_TIMEOUT_US;
+    return next - now;
+}
+
+#if defined(MLN_EPOLL)
+static inline int mln_event_epoll_timeout(mln_event_t *event, mln_s64_t wait_us)
+{
+    struct itimerspec its;
+
+    if (event->timerfd < 0)
+        return wait_us < 0? -1: (int)((wait_us + 999) / 1000);
+
+    /*zero it_value disarms the timer*/
+    memset(&its, 0, sizeof(its));
+    if (wait_us > 0) {
+        its.it_value.tv_sec = wait_us / 1000000;
+        its.it_value.tv_nsec = (wait_us % 1000000) * 1000;
+    }
+    timerfd_settime(event->timerfd, 0, &its, NULL);
+    return wait_us == 0? 0: -1;
+}
+#endif
+
 /*
  * dispatch
  */
@@ -755,18 +1096,25 @@ void mln_event_dispatch(mln_event_t *event)
 {
     __uint32_t mod_event;
     int nfds, n, oneshot, other_oneshot;
+    mln_u64_t expirations;
     mln_event_desc_t *ed;
     struct epoll_event events[M_EV_EPOLL_SIZE], *ev, mod_ev;
 
+#if defined(MLN_IOURING)
+    if (event->uring != NULL) {
+        mln_event_uring_dispatch(event);
+        return;
+    }
+#endif
     while (1) {
-        if (!pthread_mutex_trylock(&event->cb_lock)) {
+        if (!mln_event_trylock(event, &event->cb_lock)) {
             dispatch_callback cb = event->callback;
             void *data = event->callback_data;
             if (cb != NULL) {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, &event->cb_lock);
                 cb(event, data);
             } else {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, &event->cb_lock);
             }
         }
         BREAK_OUT();
@@ -779,20 +1127,28 @@ void mln_event_dispatch(mln_event_t *event)
         mln_event_timer_process(event);
         BREAK_OUT();
 
-        if (pthread_mutex_trylock(&event->fd_lock)) {
+        if (mln_event_trylock(event, &event->fd_lock)) {
             epoll_wait(event->unusedfd, events, M_EV_EPOLL_SIZE, M_EV_NOLOCK_TIMEOUT_MS);
         } else {
-            nfds = epoll_wait(event->epollfd, events, M_EV_EPOLL_SIZE, M_EV_TIMEOUT_MS);
+            nfds = epoll_wait(event->epollfd, \
+                              events, \
+                              M_EV_EPOLL_SIZE, \
+                              mln_event_epoll_timeout(event, mln_event_wait_us(event)));
+            ++(event->nr_wakeups);
             if (nfds < 0) {
                 if (errno == EINTR) {
-                    pthread_mutex_unlock(&event->fd_lock);
+                    mln_event_unlock(event, &event->fd_lock);
                     continue;
                 } else {
                     ASSERT(0);
                 }
-            } else if (nfds == 0) {
-                pthread_mutex_unlock(&event->fd_lock);
-                epoll_wait(event->unusedfd, events, M_EV_EPOLL_SIZE, M_EV_NOLOCK_TIMEOUT_MS);
+            } else if (nfds == 0 || (nfds == 1 && events[0].data.ptr == NULL)) {
+                ++(event->nr_idle_wakeups);
+            }
+            if (nfds == 0) {
+                mln_event_unlock(event, &event->fd_lock);
+                if (!event->nolock)
+                    epoll_wait(event->unusedfd, events, M_EV_EPOLL_SIZE, M_EV_NOLOCK_TIMEOUT_MS);
                 continue;
             }
             for (n = 0; n < nfds; ++n) {
@@ -801,6 +1157,10 @@ void mln_event_dispatch(mln_event_t *event)
                 other_oneshot = 0;
                 ev = &events[n];
                 ed = (mln_event_desc_t *)(ev->data.ptr);
+                if (ed == NULL) {/*timerfd*/
+                    if (read(event->timerfd, &expirations, sizeof(expirations)) < 0) {/*do nothing*/}
+                    continue;
+                }
                 if (ed->data.fd.is_clear)
                     continue;
 
@@ -896,7 +1256,7 @@ void mln_event_dispatch(mln_event_t *event)
                     }
                 }
             }
-            pthread_mutex_unlock(&event->fd_lock);
+            mln_event_unlock(event, &event->fd_lock);
         }
     }
 }
@@ -907,16 +1267,17 @@ void mln_event_dispatch(mln_event_t *event)
     mln_event_desc_t *ed;
     struct kevent events[M_EV_EPOLL_SIZE], *ev, mod;
     struct timespec ts;
+    mln_s64_t wait_us;
 
     while (1) {
-        if (!pthread_mutex_trylock(&event->cb_lock)) {
+        if (!mln_event_trylock(event, &event->cb_lock)) {
             dispatch_callback cb = event->callback;
             void *data = event->callback_data;
             if (cb != NULL) {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, &event->cb_lock);
                 cb(event, data);
             } else {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, &event->cb_lock);
             }
         }
         BREAK_OUT();
@@ -929,26 +1290,31 @@ void mln_event_dispatch(mln_event_t *event)
         mln_event_timer_process(event);
         BREAK_OUT();
 
-        if (pthread_mutex_trylock(&event->fd_lock)) {
+        if (mln_event_trylock(event, &event->fd_lock)) {
             ts.tv_sec = 0;
             ts.tv_nsec = M_EV_NOLOCK_TIMEOUT_NS;
             kevent(event->unusedfd, NULL, 0, events, M_EV_EPOLL_SIZE, &ts);
         } else {
-            ts.tv_sec = 0;
-            ts.tv_nsec = M_EV_TIMEOUT_NS;
-            nfds = kevent(event->kqfd, NULL, 0, events, M_EV_EPOLL_SIZE, &ts);
+            wait_us = mln_event_wait_us(event);
+            ts.tv_sec = wait_us / 1000000;
+            ts.tv_nsec = (wait_us % 1000000) * 1000;
+            nfds = kevent(event->kqfd, NULL, 0, events, M_EV_EPOLL_SIZE, wait_us < 0? NULL: &ts);
+            ++(event->nr_wakeups);
             if (nfds < 0) {
                 if (errno == EINTR) {
-                    pthread_mutex_unlock(&event->fd_lock);
+                    mln_event_unlock(event, &event->fd_lock);
                     continue;
                 } else {
                     ASSERT(0);
                 }
             } else if (nfds == 0) {
-                pthread_mutex_unlock(&event->fd_lock);
-                ts.tv_sec = 0;
-                ts.tv_nsec = M_EV_NOLOCK_TIMEOUT_NS;
-                kevent(event->unusedfd, NULL, 0, events, M_EV_EPOLL_SIZE, &ts);
+                ++(event->nr_idle_wakeups);
+                mln_event_unlock(event, &event->fd_lock);
+                if (!event->nolock) {
+                    ts.tv_sec = 0;
+                    ts.tv_nsec = M_EV_NOLOCK_TIMEOUT_NS;
+                    kevent(event->unusedfd, NULL, 0, events, M_EV_EPOLL_SIZE, &ts);
+                }
                 continue;
             }
             for (n = 0; n < nfds; ++n) {
@@ -1033,7 +1399,7 @@ void mln_event_dispatch(mln_event_t *event)
                                        ed);
                 ed->data.fd.in_active = 1;
             }
-            pthread_mutex_unlock(&event->fd_lock);
+            mln_event_unlock(event, &event->fd_lock);
         }
     }
 }
@@ -1047,16 +1413,17 @@ void mln_event_dispatch(mln_event_t *event)
     fd_set *err_set = &(event->err_set);
     struct timeval tm;
     mln_u32_t move;
+    mln_s64_t wait_us;
 
     while (1) {
-        if (!pthread_mutex_trylock(&event->cb_lock)) {
+        if (!mln_event_trylock(event, &event->cb_lock)) {
             dispatch_callback cb = event->callback;
             void *data = event->callback_data;
             if (cb != NULL) {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, &event->cb_lock);
                 cb(event, data);
             } else {
-                pthread_mutex_unlock(&event->cb_lock);
+                mln_event_unlock(event, &event->cb_lock);
             }
         }
         BREAK_OUT();
@@ -1073,7 +1440,7 @@ void mln_event_dispatch(mln_event_t *event)
         FD_ZERO(wr_set);
         FD_ZERO(err_set);
 
-        if (pthread_mutex_trylock(&event->fd_lock)) {
+        if (mln_event_trylock(event, &event->fd_lock)) {
             tm.tv_sec = 0;
             tm.tv_usec = M_EV_NOLOCK_TIMEOUT_US;
             select(event->select_fd, rd_set, wr_set, err_set, &tm);
@@ -1089,14 +1456,16 @@ void mln_event_dispatch(mln_event_t *event)
                 if (fd >= event->select_fd)
                     event->select_fd = fd + 1;
             }
-            tm.tv_sec = 0;
-            tm.tv_usec = M_EV_TIMEOUT_US;
-            nfds = select(event->select_fd, rd_set, wr_set, err_set, &tm);
+            wait_us = mln_event_wait_us(event);
+            tm.tv_sec = wait_us / 1000000;
+            tm.tv_usec = wait_us % 1000000;
+            nfds = select(event->select_fd, rd_set, wr_set, err_set, wait_us < 0? NULL: &tm);
+            ++(event->nr_wakeups);
             if (nfds < 0) {
 #if !defined(WIN32)
                 if (errno == EINTR || errno == ENOMEM) {
 #endif
-                    pthread_mutex_unlock(&event->fd_lock);
+                    mln_event_unlock(event, &event->fd_lock);
                     continue;
 #if !defined(WIN32)
                 } else {
@@ -1104,10 +1473,13 @@ void mln_event_dispatch(mln_event_t *event)
                 }
 #endif
             } else if (nfds == 0) {
-                pthread_mutex_unlock(&event->fd_lock);
-                tm.tv_sec = 0;
-                tm.tv_usec = M_EV_NOLOCK_TIMEOUT_US;
-                select(event->select_fd, rd_set, wr_set, err_set, &tm);
+                ++(event->nr_idle_wakeups);
+                mln_event_unlock(event, &event->fd_lock);
+                if (!event->nolock) {
+                    tm.tv_sec = 0;
+                    tm.tv_usec = M_EV_NOLOCK_TIMEOUT_US;
+                    select(event->select_fd, rd_set, wr_set, err_set, &tm);
+                }
                 continue;
             }
             ed = event->ev_fd_wait_head;
@@ -1151,7 +1523,532 @@ void mln_event_dispatch(mln_event_t *event)
                     ed->data.fd.in_active = 1;
                 }
             }
-            pthread_mutex_unlock(&event->fd_lock);
+            mln_event_unlock(event, &event->fd_lock);
+        }
+    }
+}
+#endif
+
+#if defined(MLN_IOURING)
+/*
+ * io_uring
+ * Every descriptor has at most one single-shot IORING_OP_POLL_ADD in the ring.
+ * It is re-armed after its handlers ran, which keeps the level-triggered behaviour
+ * of epoll, and all re-arms of a loop are submitted by the io_uring_enter that waits.
+ * user_data is (generation << 32 | fd), completions of cancelled polls carry an old
+ * generation and are dropped, so a freed descriptor is never referenced.
+ *
+ * Descriptors set by mln_event_accept_set and mln_event_recv_set also have one
+ * multishot IORING_OP_ACCEPT or IORING_OP_RECV instead of polling for POLLIN.
+ * Their user_data has M_EV_URING_MS set in the low half, their completions are
+ * queued in ms_q and handed to the handlers one by one, in order. recv takes
+ * buffers from a ring registered by IORING_REGISTER_PBUF_RING, every buffer is
+ * given back to the ring once its handler returned.
+ */
+#define M_EV_URING_MS     ((mln_u32_t)0x80000000)
+#define M_EV_URING_ACCEPT ((mln_u32_t)0x40000000)
+#define M_EV_URING_FD     ((mln_u32_t)0x3fffffff)
+static mln_event_uring_t *mln_event_uring_new(void)
+{
+    struct io_uring_params p;
+    mln_event_uring_t *r;
+
+    if ((r = (mln_event_uring_t *)calloc(1, sizeof(mln_event_uring_t))) == NULL)
+        return NULL;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = M_EV_URING_ENTRIES << 2;
+    if ((r->fd = syscall(__NR_io_uring_setup, M_EV_URING_ENTRIES, &p)) < 0)
+        goto err1;
+    /*IORING_FEAT_EXT_ARG is needed by the timeout of io_uring_enter*/
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+        goto err2;
+
+    r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(mln_u32_t);
+    r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_sz > r->sq_sz) r->sq_sz = r->cq_sz;
+        r->cq_sz = r->sq_sz;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto err2;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            goto err3;
+    }
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto err4;
+
+    r->sq_entries = p.sq_entries;
+    r->sq_head = (mln_u32_t *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (mln_u32_t *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = *(mln_u32_t *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (mln_u32_t *)((char *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (mln_u32_t *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (mln_u32_t *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = *(mln_u32_t *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    r->gen = 0;
+
+    r->ms_q = (struct io_uring_cqe *)malloc(p.cq_entries * sizeof(struct io_uring_cqe));
+    if (r->ms_q == NULL)
+        goto err5;
+    r->ms_mask = p.cq_entries - 1;
+    r->ms_head = r->ms_tail = 0;
+    r->no_ms = r->br_tried = 0;
+    r->br = NULL;
+    r->bufs = NULL;
+    return r;
+
+err5:
+    munmap(r->sqes, r->sqes_sz);
+err4:
+    if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_sz);
+err3:
+    munmap(r->sq_ptr, r->sq_sz);
+err2:
+    close(r->fd);
+err1:
+    free(r);
+    return NULL;
+}
+
+static void mln_event_uring_free(mln_event_uring_t *r)
+{
+    if (r == NULL) return;
+    if (r->bufs != NULL) {
+        munmap(r->br, M_EV_URING_BUF_NUM * sizeof(struct io_uring_buf));
+        free(r->bufs);
+    }
+    free(r->ms_q);
+    munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_sz);
+    munmap(r->sq_ptr, r->sq_sz);
+    close(r->fd);
+    free(r);
+}
+
+/*
+ * Set up the provided buffer ring on the first mln_event_recv_set.
+ * If the kernel does not support it, recv descriptors are polled.
+ */
+static void mln_event_uring_br_init(mln_event_uring_t *r)
+{
+    mln_u32_t i;
+    struct io_uring_buf_reg reg;
+    size_t size = M_EV_URING_BUF_NUM * sizeof(struct io_uring_buf);
+
+    r->br_tried = 1;
+    r->br = (struct io_uring_buf_ring *)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (r->br == MAP_FAILED) {
+        r->br = NULL;
+        return;
+    }
+    if ((r->bufs = (mln_u8ptr_t)malloc(M_EV_URING_BUF_NUM * M_EV_RECV_BUF_SIZE)) == NULL)
+        goto err;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (mln_u64_t)(uintptr_t)r->br;
+    reg.ring_entries = M_EV_URING_BUF_NUM;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        goto err;
+
+    for (i = 0; i < M_EV_URING_BUF_NUM; ++i) {
+        r->br->bufs[i].addr = (mln_u64_t)(uintptr_t)(r->bufs + i * M_EV_RECV_BUF_SIZE);
+        r->br->bufs[i].len = M_EV_RECV_BUF_SIZE;
+        r->br->bufs[i].bid = i;
+    }
+    r->br_tail = M_EV_URING_BUF_NUM;
+    __atomic_store_n(&(r->br->tail), r->br_tail, __ATOMIC_RELEASE);
+    return;
+
+err:
+    if (r->bufs != NULL) free(r->bufs);
+    r->bufs = NULL;
+    munmap(r->br, size);
+    r->br = NULL;
+}
+
+/*
+ * Give a buffer back to the kernel.
+ */
+static inline void mln_event_uring_buf_put(mln_event_uring_t *r, mln_u16_t bid)
+{
+    struct io_uring_buf *b = &(r->br->bufs[r->br_tail & (M_EV_URING_BUF_NUM - 1)]);
+
+    b->addr = (mln_u64_t)(uintptr_t)(r->bufs + bid * M_EV_RECV_BUF_SIZE);
+    b->len = M_EV_RECV_BUF_SIZE;
+    b->bid = bid;
+    __atomic_store_n(&(r->br->tail), ++(r->br_tail), __ATOMIC_RELEASE);
+}
+
+/*
+ * Submit pending entries and wait at most wait_us (-1 means forever, 0 means no wait).
+ */
+static inline int mln_event_uring_enter(mln_event_uring_t *r, mln_s64_t wait_us)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    mln_u32_t to_submit, min_complete = 0, flags = IORING_ENTER_EXT_ARG;
+
+    to_submit = *(r->sq_tail) - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    memset(&arg, 0, sizeof(arg));
+    if (wait_us != 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        min_complete = 1;
+        if (wait_us > 0) {
+            ts.tv_sec = wait_us / 1000000;
+            ts.tv_nsec = (wait_us % 1000000) * 1000;
+            arg.ts = (mln_u64_t)(uintptr_t)&ts;
+        }
+    } else if (!to_submit) {
+        return 0;
+    }
+    return syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+}
+
+/*
+ * The kernel only reads the submission queue in io_uring_enter, so the tail
+ * can be published before the entry is filled.
+ */
+static inline struct io_uring_sqe *mln_event_uring_sqe(mln_event_uring_t *r)
+{
+    struct io_uring_sqe *sqe;
+    mln_u32_t idx, tail = *(r->sq_tail);
+
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries) {
+        if (mln_event_uring_enter(r, 0) < 0) {
+            ASSERT(0);
+        }
+    }
+    idx = tail & r->sq_mask;
+    sqe = &(r->sqes[idx]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+static inline void
+mln_event_uring_ms_cancel(mln_event_uring_t *r, mln_event_fd_t *ef)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!ef->uring_ms_ud) return;
+    sqe = mln_event_uring_sqe(r);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = ef->uring_ms_ud;
+    sqe->user_data = M_EV_URING_IGNORE;
+    ef->uring_ms_ud = 0;
+}
+
+/*
+ * Whether the readable side of ed is handled by a multishot request.
+ */
+static inline int mln_event_uring_ms_on(mln_event_uring_t *r, mln_event_desc_t *ed)
+{
+    mln_event_fd_t *ef = &(ed->data.fd);
+
+    if (!(ed->flag & M_EV_RECV) || r->no_ms) return 0;
+    if (ef->ms.accept_handler != NULL) return 1;
+    return ef->ms.recv_handler != NULL && r->bufs != NULL;
+}
+
+static inline void
+mln_event_uring_cancel(mln_event_t *event, mln_event_desc_t *ed)
+{
+    struct io_uring_sqe *sqe;
+    mln_event_fd_t *ef = &(ed->data.fd);
+
+    mln_event_uring_ms_cancel(event->uring, ef);
+    if (!ef->uring_mask) return;
+    sqe = mln_event_uring_sqe(event->uring);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = ((mln_u64_t)ef->uring_gen << 32) | (mln_u32_t)ef->fd;
+    sqe->user_data = M_EV_URING_IGNORE;
+    ef->uring_mask = 0;
+}
+
+/*
+ * Make the poll in the ring match ed->flag. Descriptors being processed are
+ * re-armed after their handlers return.
+ */
+static inline void
+mln_event_uring_update(mln_event_t *event, mln_event_desc_t *ed)
+{
+    struct io_uring_sqe *sqe;
+    mln_event_fd_t *ef = &(ed->data.fd);
+    mln_event_uring_t *r = event->uring;
+    mln_u32_t mask = 0;
+    int ms;
+
+    if (ef->in_active || ef->in_process) return;
+
+    if ((ms = mln_event_uring_ms_on(r, ed))) {
+        if (!ef->uring_ms_ud && !ef->ms_done) {
+            if (++(r->gen) == 0) ++(r->gen);
+            ef->uring_ms_ud = ((mln_u64_t)r->gen << 32) | (mln_u32_t)ef->fd | M_EV_URING_MS;
+            sqe = mln_event_uring_sqe(r);
+            sqe->fd = ef->fd;
+            if (ef->ms.accept_handler != NULL) {
+                ef->uring_ms_ud |= M_EV_URING_ACCEPT;
+                sqe->opcode = IORING_OP_ACCEPT;
+                sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+            } else {
+                sqe->opcode = IORING_OP_RECV;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = 0;
+            }
+            sqe->user_data = ef->uring_ms_ud;
+        }
+    } else {
+        mln_event_uring_ms_cancel(r, ef);
+    }
+
+    if ((ed->flag & M_EV_RECV) && !ms) mask |= POLLIN;
+    if (ed->flag & M_EV_SEND) mask |= POLLOUT;
+    if (ed->flag & M_EV_ERROR) mask |= POLLERR;
+    if (mask == ef->uring_mask) return;
+
+    if (ef->uring_mask) {
+        sqe = mln_event_uring_sqe(r);
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = ((mln_u64_t)ef->uring_gen << 32) | (mln_u32_t)ef->fd;
+        sqe->user_data = M_EV_URING_IGNORE;
+        ef->uring_mask = 0;
+    }
+    if (!mask) return;
+
+    if (++(r->gen) == 0) ++(r->gen);
+    ef->uring_gen = r->gen;
+    ef->uring_mask = mask;
+    sqe = mln_event_uring_sqe(r);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = ef->fd;
+    sqe->poll32_events = mask;
+    sqe->user_data = ((mln_u64_t)ef->uring_gen << 32) | (mln_u32_t)ef->fd;
+}
+
+/*
+ * Move ready descriptors to the active chain, return the number of them.
+ */
+static inline int mln_event_uring_reap(mln_event_t *event)
+{
+    int n = 0;
+    mln_s32_t res;
+    mln_u64_t ud;
+    mln_u32_t head, tail, flag, mask;
+    mln_event_desc_t *ed;
+    mln_event_fd_t *ef;
+    mln_event_uring_t *r = event->uring;
+
+    head = *(r->cq_head);
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        ud = r->cqes[head & r->cq_mask].user_data;
+        res = r->cqes[head & r->cq_mask].res;
+        if (ud == M_EV_URING_IGNORE) continue;
+        if ((mln_u32_t)ud & M_EV_URING_MS) {
+            /*the rest is left in the completion queue until ms_q has room*/
+            if (r->ms_tail - r->ms_head > r->ms_mask) break;
+            r->ms_q[(r->ms_tail)++ & r->ms_mask] = r->cqes[head & r->cq_mask];
+            ++n;
+            continue;
+        }
+
+        ed = mln_event_fd_search(event, (int)(ud & 0xffffffff));
+        if (ed == NULL) continue;
+        ef = &(ed->data.fd);
+        if (!ef->uring_mask || ef->uring_gen != (mln_u32_t)(ud >> 32)) continue;
+        mask = ef->uring_mask;
+        ef->uring_mask = 0;
+        if (ef->is_clear || ef->in_active || ef->in_process) continue;
+
+        if (res < 0) res = POLLERR;
+        flag = 0;
+        if ((res & (POLLIN|POLLHUP|POLLERR)) && (mask & POLLIN)) flag |= (ed->flag & M_EV_RECV);
+        if (res & POLLOUT) flag |= (ed->flag & M_EV_SEND);
+        if (res & POLLERR) flag |= M_EV_ERROR;
+        if (!flag) {
+            mln_event_uring_update(event, ed);
+            continue;
+        }
+
+        if ((flag & M_EV_RECV) && ef->rd_oneshot) {
+            ef->rd_oneshot = 0;
+            ed->flag &= (~M_EV_RECV);
+        }
+        if ((flag & M_EV_SEND) && ef->wr_oneshot) {
+            ef->wr_oneshot = 0;
+            ed->flag &= (~M_EV_SEND);
+        }
+        if ((flag & M_EV_ERROR) && ef->err_oneshot) {
+            ef->err_oneshot = 0;
+            ed->flag &= (~M_EV_ERROR);
+        }
+        ef->active_flag |= flag;
+        ev_fd_active_chain_add(&(event->ev_fd_active_head), \
+                               &(event->ev_fd_active_tail), \
+                               ed);
+        ef->in_active = 1;
+        ++n;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/*
+ * Hand the queued multishot completions to their handlers.
+ * A completion of a descriptor whose handlers are running is left at the head,
+ * so that one connection never sees its data out of order.
+ */
+static inline void mln_event_uring_ms_process(mln_event_t *event)
+{
+    mln_event_uring_t *r = event->uring;
+    struct io_uring_cqe cqe;
+    mln_event_desc_t *ed;
+    mln_event_fd_t *ef;
+    mln_event_fd_ms_t ms;
+    mln_u8ptr_t buf;
+    mln_u32_t low;
+    int fd;
+
+lp:
+    if (mln_event_trylock(event, &event->fd_lock))
+        return;
+
+    if (r->ms_head == r->ms_tail) {
+        mln_event_unlock(event, &event->fd_lock);
+        return;
+    }
+    cqe = r->ms_q[r->ms_head & r->ms_mask];
+    low = (mln_u32_t)cqe.user_data;
+    fd = (int)(low & M_EV_URING_FD);
+    ef = NULL;
+    if ((ed = mln_event_fd_search(event, fd)) != NULL && !ed->data.fd.is_clear && ed->data.fd.uring_ms_ud == cqe.user_data) {
+        ef = &(ed->data.fd);
+        if (ef->in_active || ef->in_process) {
+            mln_event_unlock(event, &event->fd_lock);
+            return;
+        }
+    }
+    ++(r->ms_head);
+
+    if (ef == NULL) {
+        /*cancelled or replaced, nobody takes the result*/
+        if (cqe.flags & IORING_CQE_F_BUFFER)
+            mln_event_uring_buf_put(r, cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        else if ((low & M_EV_URING_ACCEPT) && cqe.res >= 0)
+            close(cqe.res);
+        mln_event_unlock(event, &event->fd_lock);
+        goto lp;
+    }
+
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        /*terminated, re-armed by mln_event_uring_update unless it is done*/
+        ef->uring_ms_ud = 0;
+        if (cqe.res == -EINVAL) {
+            r->no_ms = 1;
+            mln_event_uring_update(event, ed);
+            mln_event_unlock(event, &event->fd_lock);
+            goto lp;
+        }
+        if (!(low & M_EV_URING_ACCEPT)) {
+            if (cqe.res == -ENOBUFS) {
+                mln_event_uring_update(event, ed);
+                mln_event_unlock(event, &event->fd_lock);
+                goto lp;
+            }
+            if (cqe.res <= 0) ef->ms_done = 1;
+        }
+    }
+
+    ms = ef->ms;
+    buf = NULL;
+    if (cqe.flags & IORING_CQE_F_BUFFER)
+        buf = r->bufs + (cqe.flags >> IORING_CQE_BUFFER_SHIFT) * M_EV_RECV_BUF_SIZE;
+    ef->in_process = 1;
+    mln_event_unlock(event, &event->fd_lock);
+
+    if (low & M_EV_URING_ACCEPT) {
+        if (ms.accept_handler != NULL)
+            ms.accept_handler(event, fd, cqe.res, ms.data);
+        else if (cqe.res >= 0)
+            close(cqe.res);
+    } else if (ms.recv_handler != NULL) {
+        ms.recv_handler(event, fd, cqe.res > 0? buf: NULL, cqe.res, ms.data);
+    }
+
+    mln_event_lock(event, &event->fd_lock);
+    if (cqe.flags & IORING_CQE_F_BUFFER)
+        mln_event_uring_buf_put(r, cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    ef->in_process = 0;
+    if (ef->is_clear) mln_event_fd_clr_set(event, fd);
+    else mln_event_uring_update(event, ed);
+    mln_event_unlock(event, &event->fd_lock);
+
+    if (event->is_break) return;
+    goto lp;
+}
+
+static void mln_event_uring_dispatch(mln_event_t *event)
+{
+    int rc;
+    struct epoll_event events[1];
+
+    while (1) {
+        if (!mln_event_trylock(event, &event->cb_lock)) {
+            dispatch_callback cb = event->callback;
+            void *data = event->callback_data;
+            if (cb != NULL) {
+                mln_event_unlock(event, &event->cb_lock);
+                cb(event, data);
+            } else {
+                mln_event_unlock(event, &event->cb_lock);
+            }
+        }
+        BREAK_OUT();
+        mln_event_timer_process(event);
+        BREAK_OUT();
+        mln_event_active_fd_process(event);
+        BREAK_OUT();
+        mln_event_uring_ms_process(event);
+        BREAK_OUT();
+        mln_event_fd_timeout_process(event);
+        BREAK_OUT();
+        mln_event_timer_process(event);
+        BREAK_OUT();
+
+        if (mln_event_trylock(event, &event->fd_lock)) {
+            epoll_wait(event->unusedfd, events, 1, M_EV_NOLOCK_TIMEOUT_MS);
+        } else {
+            /*do not sleep on completions left in ms_q*/
+            rc = mln_event_uring_enter(event->uring, \
+                                       event->uring->ms_head != event->uring->ms_tail? 0: mln_event_wait_us(event));
+            ++(event->nr_wakeups);
+            if (rc < 0 && errno != EINTR && errno != ETIME && errno != EBUSY) {
+                ASSERT(0);
+            }
+            if (!mln_event_uring_reap(event)) {
+                ++(event->nr_idle_wakeups);
+                mln_event_unlock(event, &event->fd_lock);
+                if (!event->nolock)
+                    epoll_wait(event->unusedfd, events, 1, M_EV_NOLOCK_TIMEOUT_MS);
+                continue;
+            }
+            mln_event_unlock(event, &event->fd_lock);
         }
     }
 }
@@ -1167,7 +2064,7 @@ mln_event_active_fd_process(mln_event_t *event)
     int fd;
 
 lp:
-    if (pthread_mutex_trylock(&event->fd_lock))
+    if (mln_event_trylock(event, &event->fd_lock))
         return;
 
     ed = event->ev_fd_active_head;
@@ -1176,12 +2073,7 @@ lp:
                                &(event->ev_fd_active_tail), \
                                ed);
         ef = &(ed->data.fd);
-        if (ef->timeout_node != NULL) {
-            mln_fheap_inline_delete(event->ev_fd_timeout_heap, ef->timeout_node, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
-            mln_fheap_inline_node_free(event->ev_fd_timeout_heap, ef->timeout_node, NULL);
-            ef->timeout_node = NULL;
-            ef->end_us = 0;
-        }
+        mln_event_fd_timeout_unset(event, ed);
 
         ef->in_active = 0;
         ef->in_process = 1;
@@ -1192,9 +2084,9 @@ lp:
                 h = ef->rcv_handler;
                 data = ef->rcv_data;
                 fd = ef->fd;
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, &event->fd_lock);
                 h(event, fd, data);
-                pthread_mutex_lock(&event->fd_lock);
+                mln_event_lock(event, &event->fd_lock);
             }
             ef->active_flag &= (~M_EV_RECV);
         }
@@ -1204,9 +2096,9 @@ lp:
                 h = ef->snd_handler;
                 data = ef->snd_data;
                 fd = ef->fd;
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, &event->fd_lock);
                 h(event, fd, data);
-                pthread_mutex_lock(&event->fd_lock);
+                mln_event_lock(event, &event->fd_lock);
             }
             ef->active_flag &= (~M_EV_SEND);
         }
@@ -1216,22 +2108,25 @@ lp:
                 h = ef->err_handler;
                 data = ef->err_data;
                 fd = ef->fd;
-                pthread_mutex_unlock(&event->fd_lock);
+                mln_event_unlock(event, &event->fd_lock);
                 h(event, fd, data);
-                pthread_mutex_lock(&event->fd_lock);
+                mln_event_lock(event, &event->fd_lock);
             }
             ef->active_flag &= (~M_EV_ERROR);
         }
         ef->in_process = 0;
 
         if (ef->is_clear) mln_event_fd_clr_set(event, ef->fd);
+#if defined(MLN_IOURING)
+        else if (event->uring != NULL) mln_event_uring_update(event, ed);
+#endif
 
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, &event->fd_lock);
 
         if (event->is_break) return;
         goto lp;
     } else {
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, &event->fd_lock);
     }
 }
 
@@ -1249,59 +2144,293 @@ static inline void mln_event_fd_timeout_process(mln_event_t *event)
     int fd;
 
 lp:
-    if (pthread_mutex_trylock(&event->fd_lock))
+    if (mln_event_trylock(event, &event->fd_lock))
         return;
 
-    fn = mln_fheap_minimum(event->ev_fd_timeout_heap);
-    if (fn == NULL) {
-        pthread_mutex_unlock(&event->fd_lock);
-        return;
-    }
-    ed = (mln_event_desc_t *)mln_fheap_node_key(fn);
-    ef = &(ed->data.fd);
-    if (ef->in_active) {
-        ev_fd_active_chain_del(&(event->ev_fd_active_head), \
-                               &(event->ev_fd_active_tail), \
-                               ed);
-        ef->in_active = 0;
-    }
-    if (ef->end_us > now) {
-        pthread_mutex_unlock(&event->fd_lock);
-        return;
+    if (event->timer_wheel) {
+        ed = mln_event_wheel_expired(event->ev_fd_timeout_wheel, now);
+        if (ed == NULL) {
+            mln_event_unlock(event, &event->fd_lock);
+            return;
+        }
+        ef = &(ed->data.fd);
+        if (ef->in_active) {
+            ev_fd_active_chain_del(&(event->ev_fd_active_head), \
+                                   &(event->ev_fd_active_tail), \
+                                   ed);
+            ef->in_active = 0;
+        }
+        ef->in_process = 1;
+    } else {
+        fn = mln_fheap_minimum(event->ev_fd_timeout_heap);
+        if (fn == NULL) {
+            mln_event_unlock(event, &event->fd_lock);
+            return;
+        }
+        ed = (mln_event_desc_t *)mln_fheap_node_key(fn);
+        ef = &(ed->data.fd);
+        if (ef->end_us > now) {
+            mln_event_unlock(event, &event->fd_lock);
+            return;
+        }
+        if (ef->in_active) {
+            ev_fd_active_chain_del(&(event->ev_fd_active_head), \
+                                   &(event->ev_fd_active_tail), \
+                                   ed);
+            ef->in_active = 0;
+        }
+        ef->in_process = 1;
+        mln_fheap_inline_delete(event->ev_fd_timeout_heap, fn, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
+        mln_fheap_inline_node_free(event->ev_fd_timeout_heap, fn, NULL);
+        ed->data.fd.timeout_node = NULL;
     }
-    ef->in_process = 1;
-    mln_fheap_inline_delete(event->ev_fd_timeout_heap, fn, mln_event_fd_timeout_copy, mln_event_fd_timeout_cmp);
-    mln_fheap_inline_node_free(event->ev_fd_timeout_heap, fn, NULL);
-    ed->data.fd.timeout_node = NULL;
 
     if (ed->data.fd.timeout_handler != NULL) {
         h = ed->data.fd.timeout_handler;
         fd = ed->data.fd.fd;
         data = ed->data.fd.timeout_data;
-        pthread_mutex_unlock(&event->fd_lock);
+        mln_event_unlock(event, &event->fd_lock);
         h(event, fd, data);
-        pthread_mutex_lock(&event->fd_lock);
+        mln_event_lock(event, &event->fd_lock);
     }
 
     ef->in_process = 0;
 
     if (ef->is_clear) mln_event_fd_clr_set(event, ef->fd);
+#if defined(MLN_IOURING)
+    else if (event->uring != NULL) mln_event_uring_update(event, ed);
+#endif
 
-    pthread_mutex_unlock(&event->fd_lock);
+    mln_event_unlock(event, &event->fd_lock);
 
     if (event->is_break) return;
     goto lp;
 }
 
 /*
- * rbtree functions
+ * fd descriptor lookup
+ * epoll and kqueue use a dense table indexed by fd, so searching is a direct index.
+ * select keeps the rbtree, since sockets are not small integers on some platforms.
  */
-static int
-mln_event_rbtree_fd_cmp(const void *k1, const void *k2)
+#if defined(MLN_EPOLL) || defined(MLN_KQUEUE)
+static inline mln_event_desc_t *
+mln_event_fd_search(mln_event_t *event, int fd)
 {
-    mln_event_desc_t *ed1 = (mln_event_desc_t *)k1;
-    mln_event_desc_t *ed2 = (mln_event_desc_t *)k2;
-    return ed1->data.fd.fd - ed2->data.fd.fd;
+    if ((mln_u32_t)fd >= event->ev_fd_tbl_len) return NULL;
+    return event->ev_fd_tbl[fd];
+}
+
+static inline int
+mln_event_fd_insert(mln_event_t *event, mln_event_desc_t *ed)
+{
+    mln_u32_t fd = ed->data.fd.fd, len = event->ev_fd_tbl_len;
+    mln_event_desc_t **tbl;
+
+    if (fd >= len) {
+        if (!len) len = M_EV_FD_TBL_LEN;
+        while (fd >= len) len <<= 1;
+        tbl = (mln_event_desc_t **)realloc(event->ev_fd_tbl, len * sizeof(mln_event_desc_t *));
+        if (tbl == NULL) return -1;
+        memset(tbl + event->ev_fd_tbl_len, 0, (len - event->ev_fd_tbl_len) * sizeof(mln_event_desc_t *));
+        event->ev_fd_tbl = tbl;
+        event->ev_fd_tbl_len = len;
+    }
+    event->ev_fd_tbl[fd] = ed;
+    return 0;
+}
+
+static inline void
+mln_event_fd_remove(mln_event_t *event, mln_event_desc_t *ed)
+{
+    event->ev_fd_tbl[ed->data.fd.fd] = NULL;
+}
+#else
+/*
+ * the rbtree nodes are embedded in the descriptors (intrusive mode),
+ * so inserting a fd allocates nothing.
+ */
+#define mln_event_fd_entry(rn) mln_rbtree_entry(rn, mln_event_desc_t, fd_node)
+#define mln_event_rbtree_fd_cmp(n1, n2) \
+    (mln_event_fd_entry(n1)->data.fd.fd - mln_event_fd_entry(n2)->data.fd.fd)
+#define mln_event_rbtree_fd_key_cmp(fd, n) ((fd) - mln_event_fd_entry(n)->data.fd.fd)
+
+static inline mln_event_desc_t *
+mln_event_fd_search(mln_event_t *event, int fd)
+{
+    mln_rbtree_node_t *rn;
+
+    rn = mln_rbtree_inline_node_search(event->ev_fd_tree, fd, mln_event_rbtree_fd_key_cmp);
+    if (mln_rbtree_null(rn, event->ev_fd_tree)) return NULL;
+    return mln_event_fd_entry(rn);
+}
+
+static inline int
+mln_event_fd_insert(mln_event_t *event, mln_event_desc_t *ed)
+{
+    mln_rbtree_node_t *rn = mln_rbtree_node_init(&(ed->fd_node), ed);
+    mln_rbtree_inline_node_insert(event->ev_fd_tree, rn, mln_event_rbtree_fd_cmp);
+    return 0;
+}
+
+static inline void
+mln_event_fd_remove(mln_event_t *event, mln_event_desc_t *ed)
+{
+    mln_rbtree_delete(event->ev_fd_tree, &(ed->fd_node));
+}
+#endif
+
+/*
+ * timing wheel
+ * M_EV_WHEEL_LEVEL levels of M_EV_WHEEL_SIZE slots. Level 0 holds the entries
+ * expiring within M_EV_WHEEL_SIZE ticks, each higher level covers M_EV_WHEEL_SIZE
+ * times the range of the one below and is cascaded down when the lower level wraps.
+ */
+static mln_event_wheel_t *mln_event_wheel_new(mln_u32_t tick_ms)
+{
+    struct timeval tv;
+    mln_event_wheel_t *w;
+
+    if ((w = (mln_event_wheel_t *)calloc(1, sizeof(mln_event_wheel_t))) == NULL)
+        return NULL;
+    gettimeofday(&tv, NULL);
+    w->base_us = tv.tv_sec * 1000000 + tv.tv_usec;
+    w->tick_us = (tick_ms? tick_ms: M_EV_WHEEL_TICK_MS) * 1000;
+    return w;
+}
+
+static void mln_event_wheel_free(mln_event_wheel_t *w, void (*freer)(void *))
+{
+    int lv, i;
+    mln_event_desc_t *ed;
+    mln_event_wheel_slot_t *slot;
+
+    if (w == NULL) return;
+    if (freer != NULL) {
+        for (lv = 0; lv < M_EV_WHEEL_LEVEL; ++lv) {
+            for (i = 0; i < M_EV_WHEEL_SIZE; ++i) {
+                slot = &(w->slots[lv][i]);
+                while ((ed = slot->head) != NULL) {
+                    ev_tw_chain_del(&(slot->head), &(slot->tail), ed);
+                    freer(ed);
+                }
+            }
+        }
+        while ((ed = w->expired.head) != NULL) {
+            ev_tw_chain_del(&(w->expired.head), &(w->expired.tail), ed);
+            freer(ed);
+        }
+    }
+    free(w);
+}
+
+static inline void
+mln_event_wheel_add(mln_event_wheel_t *w, mln_event_desc_t *ed)
+{
+    int lv;
+    mln_event_wheel_slot_t *slot;
+    mln_u64_t end_us = ed->type == M_EV_TM? ed->data.tm.end_tm: ed->data.fd.end_us;
+    mln_u64_t expire, delta;
+
+    /*round up, an entry never expires before its deadline*/
+    expire = end_us <= w->base_us? 0: (end_us - w->base_us + w->tick_us - 1) / w->tick_us;
+    if (expire < w->cur) expire = w->cur;
+    delta = expire - w->cur;
+    for (lv = 0; lv < M_EV_WHEEL_LEVEL - 1; ++lv) {
+        if (delta < ((mln_u64_t)1 << (M_EV_WHEEL_BITS * (lv + 1))))
+            break;
+    }
+    if (delta >= ((mln_u64_t)1 << (M_EV_WHEEL_BITS * M_EV_WHEEL_LEVEL)))
+        expire = w->cur + ((mln_u64_t)1 << (M_EV_WHEEL_BITS * M_EV_WHEEL_LEVEL)) - 1;
+
+    slot = &(w->slots[lv][(expire >> (M_EV_WHEEL_BITS * lv)) & M_EV_WHEEL_MASK]);
+    ev_tw_chain_add(&(slot->head), &(slot->tail), ed);
+    ed->tw_slot = slot;
+    ++(w->nr);
+}
+
+static inline void
+mln_event_wheel_del(mln_event_wheel_t *w, mln_event_desc_t *ed)
+{
+    mln_event_wheel_slot_t *slot = ed->tw_slot;
+
+    if (slot == NULL) return;
+    ev_tw_chain_del(&(slot->head), &(slot->tail), ed);
+    if (slot != &(w->expired)) --(w->nr);
+    ed->tw_slot = NULL;
+}
+
+static inline void mln_event_wheel_cascade(mln_event_wheel_t *w, int lv)
+{
+    mln_event_desc_t *ed;
+    mln_event_wheel_slot_t *slot;
+
+    slot = &(w->slots[lv][(w->cur >> (M_EV_WHEEL_BITS * lv)) & M_EV_WHEEL_MASK]);
+    while ((ed = slot->head) != NULL) {
+        mln_event_wheel_del(w, ed);
+        mln_event_wheel_add(w, ed);
+    }
+}
+
+/*
+ * Advance the wheel until some entries expired at 'now' (us) are found,
+ * then detach and return one of them.
+ */
+static inline mln_event_desc_t *
+mln_event_wheel_expired(mln_event_wheel_t *w, mln_u64_t now)
+{
+    int lv;
+    mln_u64_t tick, idx;
+    mln_event_desc_t *ed;
+    mln_event_wheel_slot_t *slot;
+
+    tick = now <= w->base_us? 0: (now - w->base_us) / w->tick_us;
+    if (!w->nr && w->expired.head == NULL) {
+        if (tick >= w->cur) w->cur = tick + 1;
+        return NULL;
+    }
+
+    while (w->expired.head == NULL && w->cur <= tick) {
+        idx = w->cur & M_EV_WHEEL_MASK;
+        for (lv = 1; !idx && lv < M_EV_WHEEL_LEVEL; ++lv) {
+            idx = (w->cur >> (M_EV_WHEEL_BITS * lv)) & M_EV_WHEEL_MASK;
+            mln_event_wheel_cascade(w, lv);
+        }
+        slot = &(w->slots[0][w->cur & M_EV_WHEEL_MASK]);
+        while ((ed = slot->head) != NULL) {
+            mln_event_wheel_del(w, ed);
+            ev_tw_chain_add(&(w->expired.head), &(w->expired.tail), ed);
+            ed->tw_slot = &(w->expired);
+        }
+        ++(w->cur);
+    }
+
+    if ((ed = w->expired.head) != NULL)
+        mln_event_wheel_del(w, ed);
+    return ed;
+}
+
+/*
+ * The time (us) at which the wheel has to be advanced next, -1 if it is empty.
+ * Entries in higher levels are not due before level 0 wraps, so the scan stops
+ * at the next wrap which needs a cascade anyway.
+ */
+static inline int
+mln_event_wheel_next(mln_event_wheel_t *w, mln_u64_t *end_us)
+{
+    mln_u64_t tick = w->cur;
+
+    if (w->expired.head != NULL) {
+        *end_us = 0;
+        return 0;
+    }
+    if (!w->nr) return -1;
+
+    for (; ; ++tick) {
+        if (w->slots[0][tick & M_EV_WHEEL_MASK].head != NULL || !(tick & M_EV_WHEEL_MASK))
+            break;
+    }
+    *end_us = w->base_us + tick * w->tick_us;
+    return 0;
 }
 
 /*
@@ -1354,3 +2483,8 @@ MLN_CHAIN_FUNC_DEFINE(ev_fd_active, \
                       static inline void, \
                       act_prev, \
                       act_next);
+MLN_CHAIN_FUNC_DEFINE(ev_tw, \
+                      mln_event_desc_t, \
+                      static inline void, \
+                      tw_prev, \
+                      tw_next);
@@ -17,6 +17,12 @@
 #include "mln_ipc.h"
 #include "mln_alloc.h"
 #include <sys/ioctl.h>
+#if defined(MLN_EVENTFD)
+#include <sys/eventfd.h>
+#endif
+#if defined(MLN_EVENTFD) && defined(MLN_MMAP)
+#include <sys/mman.h>
+#endif
 
 mln_tcp_conn_t master_conn;
 mln_size_t child_error_bytes;
@@ -30,6 +36,9 @@ mln_rbtree_t *master_ipc_tree = NULL;
 mln_rbtree_t *worker_ipc_tree = NULL;
 clr_handler rs_clr_handler = NULL;
 void *rs_clr_data = NULL;
+mln_sauto_t cur_worker_no = -1;
+mln_size_t ipc_shm_size = 0;
+mln_fork_shm_t *master_shm = NULL;
 
 MLN_CHAIN_FUNC_DECLARE(worker_list, \
                        mln_fork_t, \
@@ -43,7 +52,8 @@ do_fork_core(enum proc_exec_type etype, \
              enum proc_state_type stype, \
              mln_s8ptr_t *args, \
              mln_u32_t n_args, \
-             mln_event_t *master_ev);
+             mln_event_t *master_ev, \
+             mln_sauto_t worker_no);
 static mln_fork_t *
 mln_fork_init(struct mln_fork_attr *attr) __NONNULL1(1);
 static void
@@ -64,6 +74,10 @@ static void
 mln_ipc_fd_handler_worker_send(mln_event_t *ev, int fd, void *data);
 static inline mln_ipc_handler_t *mln_ipc_handler_new(mln_u32_t type, ipc_handler handler, void *data);
 static void mln_ipc_handler_free(mln_ipc_handler_t *ih);
+static inline void
+mln_ipc_dispatch(mln_rbtree_t *tree, mln_event_t *ev, void *obj, mln_u32_t type, void *buf, mln_u32_t len);
+static mln_fork_shm_t *mln_fork_shm_new(void);
+static void mln_fork_shm_free(mln_fork_shm_t *shm);
 
 /*pre-fork*/
 int mln_fork_prepare(void)
@@ -153,6 +167,8 @@ mln_fork_init(struct mln_fork_attr *attr)
     f->msg_content = NULL;
     f->etype = attr->etype;
     f->stype = attr->stype;
+    f->worker_no = attr->worker_no;
+    f->shm = attr->shm;
     worker_list_chain_add(&worker_list_head, &worker_list_tail, f);
     return f;
 }
@@ -171,6 +187,7 @@ mln_fork_destroy(mln_fork_t *f, int free_args)
     if (mln_tcp_conn_fd_get(&(f->conn)) >= 0)
         mln_socket_close(mln_tcp_conn_fd_get(&(f->conn)));
     mln_tcp_conn_destroy(&(f->conn));
+    mln_fork_shm_free(f->shm);
     worker_list_chain_del(&worker_list_head, &worker_list_tail, f);
     free(f);
 }
@@ -221,6 +238,24 @@ int mln_fork(void)
             exit(1);
         }
     }
+    cmd = cd->search(cd, "ipc_shm_size");
+    if (cmd != NULL) {
+        mln_conf_item_t *ci = cmd->search(cmd, 1);
+        if (ci == NULL || ci->type != CONF_INT || ci->val.i < 0) {
+            mln_log(error, "'ipc_shm_size' need a non-negative integer argument.\n");
+            exit(1);
+        }
+        if (ci->val.i > 0 && ci->val.i < M_ALLOC_SHM_DEFAULT_SIZE+1024) {
+            mln_log(error, "'ipc_shm_size' should be 0 or not less than %l.\n", (mln_sauto_t)(M_ALLOC_SHM_DEFAULT_SIZE+1024));
+            exit(1);
+        }
+#if defined(MLN_EVENTFD) && defined(MLN_MMAP)
+        ipc_shm_size = ci->val.i;
+#else
+        if (ci->val.i > 0)
+            mln_log(warn, "'ipc_shm_size' is not supported on this platform.\n");
+#endif
+    }
     if (!do_fork_worker_process(n_worker_proc)) return 0;
 
     mln_conf_cmd_t **v, **cc;
@@ -278,7 +313,8 @@ int mln_fork_spawn(enum proc_state_type stype, \
                            stype, \
                            args, \
                            n_args, \
-                           master_ev);
+                           master_ev, \
+                           -1);
     if (ret < 0) {
         return -1;
     } else if (ret == 0) {
@@ -302,7 +338,13 @@ int mln_fork_restart(mln_event_t *master_ev)
                         M_PST_SUP, \
                         NULL, \
                         0, \
-                        master_ev);
+                        master_ev, \
+                        -1);
+}
+
+mln_sauto_t mln_fork_worker_no(void)
+{
+    return cur_worker_no;
 }
 
 static int
@@ -312,7 +354,7 @@ do_fork_worker_process(mln_sauto_t n_worker_proc)
     int ret;
     for (i = 0; i < n_worker_proc; ++i) {
         mln_log(none, "Start up worker process No.%l\n", i+1);
-        if ((ret = mln_fork_restart(NULL)) < 0) {
+        if ((ret = do_fork_core(M_PET_DFL, M_PST_SUP, NULL, 0, NULL, i)) < 0) {
             continue;
         } else if (ret == 0) {
             return 0;
@@ -332,15 +374,20 @@ do_fork_core(enum proc_exec_type etype, \
              enum proc_state_type stype, \
              mln_s8ptr_t *args, \
              mln_u32_t n_args, \
-             mln_event_t *master_ev)
+             mln_event_t *master_ev, \
+             mln_sauto_t worker_no)
 {
     int fds[2];
     mln_u8_t c;
+    mln_fork_shm_t *shm = NULL;
 
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
         mln_log(error, "socketpair() error. %s\n", strerror(errno));
         return -1;
     }
+    if (etype == M_PET_DFL && ipc_shm_size && (shm = mln_fork_shm_new()) == NULL) {
+        mln_log(error, "Create shared memory channel failed, only socketpair is used.\n");
+    }
 
     pid_t pid = fork();
     if (pid > 0) {
@@ -369,6 +416,8 @@ do_fork_core(enum proc_exec_type etype, \
         fattr.pid = pid;
         fattr.etype = etype;
         fattr.stype = stype;
+        fattr.worker_no = worker_no;
+        fattr.shm = shm;
         mln_fork_t *f = mln_fork_init(&fattr);
         if (f == NULL) {
             mln_log(error, "No memory.\n");
@@ -385,6 +434,16 @@ do_fork_core(enum proc_exec_type etype, \
                 mln_log(error, "mln_event_fd_set() failed.\n");
                 abort();
             }
+            if (f->shm != NULL && mln_event_fd_set(master_ev, \
+                                                   f->shm->master_fd, \
+                                                   M_EV_RECV|M_EV_NONBLOCK, \
+                                                   M_EV_UNLIMITED, \
+                                                   f, \
+                                                   mln_ipc_shm_handler_master) < 0)
+            {
+                mln_log(error, "mln_event_fd_set() failed.\n");
+                abort();
+            }
         }
         return 1;
     } else if (pid == 0) {
@@ -394,6 +453,8 @@ do_fork_core(enum proc_exec_type etype, \
         if (rs_clr_handler != NULL)
             rs_clr_handler(rs_clr_data);
         master_ipc_tree = NULL;
+        cur_worker_no = worker_no;
+        master_shm = shm;
         mln_tcp_conn_fd_set(&master_conn, fds[1]);
         signal(SIGCHLD, SIG_DFL);
         if (write(fds[1], " ", 1) < 0)
@@ -401,6 +462,9 @@ do_fork_core(enum proc_exec_type etype, \
         return 0;
     }
     mln_log(error, "fork() error. %s\n", strerror(errno));
+    mln_socket_close(fds[0]);
+    mln_socket_close(fds[1]);
+    mln_fork_shm_free(shm);
     return -1;
 }
 
@@ -461,6 +525,20 @@ static void mln_ipc_handler_free(mln_ipc_handler_t *ih)
     free(ih);
 }
 
+static inline void
+mln_ipc_dispatch(mln_rbtree_t *tree, mln_event_t *ev, void *obj, mln_u32_t type, void *buf, mln_u32_t len)
+{
+    mln_ipc_handler_t ih, *ihp;
+    mln_rbtree_node_t *rn;
+
+    ih.type = type;
+    rn = mln_rbtree_search(tree, &ih);
+    if (mln_rbtree_null(rn, tree)) return;
+    ihp = (mln_ipc_handler_t *)mln_rbtree_node_data_get(rn);
+    if (ihp->handler != NULL)
+        ihp->handler(ev, obj, buf, len, &(ihp->data));
+}
+
 /*
  * events
  */
@@ -478,6 +556,16 @@ void mln_fork_master_events_set(mln_event_t *ev)
             mln_log(error, "mln_event_fd_set() failed.\n");
             abort();
         }
+        if (f->shm != NULL && mln_event_fd_set(ev, \
+                                               f->shm->master_fd, \
+                                               M_EV_RECV|M_EV_NONBLOCK, \
+                                               M_EV_UNLIMITED, \
+                                               f, \
+                                               mln_ipc_shm_handler_master) < 0)
+        {
+            mln_log(error, "mln_event_fd_set() failed.\n");
+            abort();
+        }
     }
 }
 
@@ -493,6 +581,16 @@ void mln_fork_worker_events_set(mln_event_t *ev)
         mln_log(error, "mln_event_fd_set() failed.\n");
         abort();
     }
+    if (master_shm != NULL && mln_event_fd_set(ev, \
+                                               master_shm->worker_fd, \
+                                               M_EV_RECV|M_EV_NONBLOCK, \
+                                               M_EV_UNLIMITED, \
+                                               NULL, \
+                                               mln_ipc_shm_handler_worker) < 0)
+    {
+        mln_log(error, "mln_event_fd_set() failed.\n");
+        abort();
+    }
 }
 
 int mln_fork_iterate(mln_event_t *ev, fork_iterate_handler handler, void *data)
@@ -649,18 +747,12 @@ mln_ipc_fd_handler_master_process(mln_event_t *ev, mln_fork_t *f)
                 }
                 memcpy(&(f->msg_type), f->msg_content, M_F_TYPELEN);
                 f->state = STATE_IDLE;
-                mln_ipc_handler_t ih;
-                ih.type = f->msg_type;
-                mln_rbtree_node_t *rn = mln_rbtree_search(master_ipc_tree, &ih);
-                if (!mln_rbtree_null(rn, master_ipc_tree)) {
-                    mln_ipc_handler_t *ihp = (mln_ipc_handler_t *)mln_rbtree_node_data_get(rn);
-                    if (ihp->handler != NULL)
-                        ihp->handler(ev, \
-                                     f, \
-                                     f->msg_content+M_F_TYPELEN, \
-                                     f->msg_len-M_F_TYPELEN, \
-                                     &(ihp->data));
-                }
+                mln_ipc_dispatch(master_ipc_tree, \
+                                 ev, \
+                                 f, \
+                                 f->msg_type, \
+                                 f->msg_content+M_F_TYPELEN, \
+                                 f->msg_len-M_F_TYPELEN);
                 free(f->msg_content);
                 f->msg_content = NULL;
                 break;
@@ -675,14 +767,18 @@ mln_ipc_fd_handler_master_process(mln_event_t *ev, mln_fork_t *f)
 void mln_fork_socketpair_close_handler(mln_event_t *ev, mln_fork_t *f, int fd)
 {
     mln_event_fd_set(ev, fd, M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
+    if (f->shm != NULL)
+        mln_event_fd_set(ev, f->shm->master_fd, M_EV_CLR, M_EV_UNLIMITED, NULL, NULL);
     enum proc_exec_type etype = f->etype;
     enum proc_state_type stype = f->stype;
     mln_s8ptr_t *args = f->args;
     mln_u32_t n_args = f->n_args;
+    mln_sauto_t worker_no = f->worker_no;
     if (stype == M_PST_SUP) {
         mln_fork_destroy(f, 0);
         if (etype == M_PET_DFL) {
-            int rv = mln_fork_restart(ev);
+            /*a restarted worker keeps its number, so it gets the same cpu and listener*/
+            int rv = do_fork_core(M_PET_DFL, M_PST_SUP, NULL, 0, ev, worker_no);
             if (rv < 0) {
                 mln_log(error, "mln_fork_restart() error.\n");
                 abort();
@@ -756,18 +852,12 @@ mln_ipc_fd_handler_worker_process(mln_event_t *ev, mln_tcp_conn_t *tc)
                 }
                 memcpy(&cur_msg_type, child_msg_content, M_F_TYPELEN);
                 child_state = STATE_IDLE;
-                mln_ipc_handler_t ih;
-                ih.type = cur_msg_type;
-                mln_rbtree_node_t *rn = mln_rbtree_search(worker_ipc_tree, &ih);
-                if (!mln_rbtree_null(rn, worker_ipc_tree)) {
-                    mln_ipc_handler_t *ihp = (mln_ipc_handler_t *)mln_rbtree_node_data_get(rn);
-                    if (ihp->handler != NULL)
-                        ihp->handler(ev, \
-                                     tc, \
-                                     child_msg_content+M_F_TYPELEN, \
-                                     cur_msg_len-M_F_TYPELEN, \
-                                     &(ihp->data));
-                }
+                mln_ipc_dispatch(worker_ipc_tree, \
+                                 ev, \
+                                 tc, \
+                                 cur_msg_type, \
+                                 child_msg_content+M_F_TYPELEN, \
+                                 cur_msg_len-M_F_TYPELEN);
                 free(child_msg_content);
                 child_msg_content = NULL;
                 break;
@@ -955,6 +1045,166 @@ mln_ipc_fd_handler_worker_send(mln_event_t *ev, int fd, void *data)
 
 
 
+/*
+ * shared memory channel
+ */
+static mln_fork_shm_t *mln_fork_shm_new(void)
+{
+#if defined(MLN_EVENTFD) && defined(MLN_MMAP)
+    mln_fork_shm_t *shm;
+    mln_size_t rsize;
+    mln_u8ptr_t p;
+
+    if ((shm = (mln_fork_shm_t *)malloc(sizeof(mln_fork_shm_t))) == NULL) {
+        return NULL;
+    }
+    /*
+     * The rings are mapped directly, nothing else is allocated in the
+     * mapping. Both headers are at the beginning, followed by the data
+     * of both rings, each taking half of the space left.
+     */
+    shm->size = ipc_shm_size;
+    p = (mln_u8ptr_t)mmap(NULL, shm->size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (p == (mln_u8ptr_t)MAP_FAILED) {
+        goto err1;
+    }
+    shm->mem = p;
+    rsize = ((shm->size - (sizeof(mln_fork_shm_ring_t) << 1)) >> 1) & ~((mln_size_t)M_F_SHM_ALIGN - 1);
+    shm->to_worker = (mln_fork_shm_ring_t *)p;
+    shm->to_master = (mln_fork_shm_ring_t *)(p + sizeof(mln_fork_shm_ring_t));
+    p += sizeof(mln_fork_shm_ring_t) << 1;
+    shm->to_worker->head = shm->to_worker->tail = 0;
+    shm->to_worker->size = rsize;
+    shm->to_worker->data = p;
+    shm->to_master->head = shm->to_master->tail = 0;
+    shm->to_master->size = rsize;
+    shm->to_master->data = p + rsize;
+
+    if ((shm->worker_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        goto err2;
+    }
+    if ((shm->master_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        goto err3;
+    }
+    return shm;
+
+err3:
+    mln_socket_close(shm->worker_fd);
+err2:
+    munmap(shm->mem, shm->size);
+err1:
+    free(shm);
+#endif
+    return NULL;
+}
+
+static void mln_fork_shm_free(mln_fork_shm_t *shm)
+{
+#if defined(MLN_EVENTFD) && defined(MLN_MMAP)
+    if (shm == NULL) return;
+    mln_socket_close(shm->worker_fd);
+    mln_socket_close(shm->master_fd);
+    munmap(shm->mem, shm->size);
+    free(shm);
+#endif
+}
+
+static int
+mln_ipc_shm_send(mln_fork_shm_ring_t *r, int fd, mln_u32_t type, void *msg, mln_size_t len)
+{
+    mln_u64_t head, tail = r->tail, pos, skip, need;
+    mln_u32_t length;
+    mln_u8ptr_t p;
+
+    if (len > r->size - M_F_SHM_HDRLEN) return -1;
+    need = (M_F_SHM_HDRLEN + len + M_F_SHM_ALIGN - 1) & ~((mln_u64_t)M_F_SHM_ALIGN - 1);
+    pos = tail % r->size;
+    skip = r->size - pos < need? r->size - pos: 0;
+    head = __atomic_load_n(&(r->head), __ATOMIC_ACQUIRE);
+    if (tail - head + skip + need > r->size) return -1;
+
+    if (skip) {
+        length = M_F_SHM_WRAP;
+        memcpy(r->data + pos, &length, sizeof(length));
+        pos = 0;
+    }
+    p = r->data + pos;
+    length = sizeof(type) + len;
+    memcpy(p, &length, sizeof(length));
+    memcpy(p + M_F_LENLEN, &type, sizeof(type));
+    if (len) memcpy(p + M_F_SHM_HDRLEN, msg, len);
+    __atomic_store_n(&(r->tail), tail + skip + need, __ATOMIC_RELEASE);
+
+    /*
+     * Ring the doorbell only if the consumer had taken everything before this
+     * record. The fence pairs with the one in mln_ipc_shm_recv, so either we
+     * see the ring empty or the consumer sees this record before it stops.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(r->head), __ATOMIC_RELAXED) == tail) {
+#if defined(MLN_EVENTFD)
+        mln_u64_t v = 1;
+        (void)!write(fd, &v, sizeof(v));
+#endif
+    }
+    return 0;
+}
+
+static void
+mln_ipc_shm_recv(mln_event_t *ev, int fd, mln_fork_shm_ring_t *r, mln_rbtree_t *tree, void *obj)
+{
+    mln_u64_t head = r->head, tail, pos;
+    mln_u32_t length, type;
+    mln_u8ptr_t p;
+#if defined(MLN_EVENTFD)
+    mln_u64_t v;
+    (void)!read(fd, &v, sizeof(v));
+#endif
+
+    while (1) {
+        tail = __atomic_load_n(&(r->tail), __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            pos = head % r->size;
+            p = r->data + pos;
+            memcpy(&length, p, sizeof(length));
+            if (length == M_F_SHM_WRAP) {
+                head += r->size - pos;
+                __atomic_store_n(&(r->head), head, __ATOMIC_RELEASE);
+                continue;
+            }
+            memcpy(&type, p + M_F_LENLEN, sizeof(type));
+            /*the content is handed to the handler in place*/
+            mln_ipc_dispatch(tree, ev, obj, type, p + M_F_SHM_HDRLEN, length - M_F_TYPELEN);
+            head += (M_F_LENLEN + length + M_F_SHM_ALIGN - 1) & ~((mln_u64_t)M_F_SHM_ALIGN - 1);
+            __atomic_store_n(&(r->head), head, __ATOMIC_RELEASE);
+        }
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&(r->tail), __ATOMIC_ACQUIRE) == head) break;
+    }
+}
+
+int mln_ipc_master_shm_send(mln_fork_t *f_child, mln_u32_t type, void *msg, mln_size_t len)
+{
+    if (f_child->shm == NULL) return -1;
+    return mln_ipc_shm_send(f_child->shm->to_worker, f_child->shm->worker_fd, type, msg, len);
+}
+
+int mln_ipc_worker_shm_send(mln_u32_t type, void *msg, mln_size_t len)
+{
+    if (master_shm == NULL) return -1;
+    return mln_ipc_shm_send(master_shm->to_master, master_shm->master_fd, type, msg, len);
+}
+
+void mln_ipc_shm_handler_master(mln_event_t *ev, int fd, void *data)
+{
+    mln_fork_t *f = (mln_fork_t *)data;
+    mln_ipc_shm_recv(ev, fd, f->shm->to_master, master_ipc_tree, f);
+}
+
+void mln_ipc_shm_handler_worker(mln_event_t *ev, int fd, void *data)
+{
+    mln_ipc_shm_recv(ev, fd, master_shm->to_worker, worker_ipc_tree, &master_conn);
+}
 
 
 /*chain*/
@@ -2,6 +2,9 @@
 /*
  * Copyright (C) Niklaus F.Schen.
  */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE /*for sched_setaffinity*/
+#endif
 #include "mln_thread.h"
 #include "mln_fork.h"
 #include <stdio.h>
@@ -27,6 +30,9 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #endif
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 static void mln_init_notice(int argc, char *argv[]);
 #if !defined(WIN32)
@@ -36,8 +42,14 @@ static void mln_master_routine(struct mln_framework_attr *attr);
 static mln_string_t *mln_get_framework_status(void);
 static void mln_sig_conf_reload(int signo);
 static int mln_conf_reload_iterate_handler(mln_event_t *ev, mln_fork_t *f, void *data);
+static void mln_worker_cpu_pin(void);
+static void mln_framework_accept_handler(mln_event_t *ev, int fd, void *data);
 
 static mln_event_t *_ev = NULL;
+static int worker_cpu = -1;
+static mln_framework_listener_t *listener_head = NULL;
+static mln_u32_t listener_nr = 0;
+static mln_alloc_t *status_pool = NULL;
 #endif
 
 
@@ -122,6 +134,7 @@ static void mln_worker_routine(struct mln_framework_attr *attr)
     if (ev == NULL) exit(1);
     if (_ev == NULL) _ev = ev;
     mln_fork_worker_events_set(ev);
+    mln_worker_cpu_pin();
 
     if (!mln_string_strcmp(framework_mode, &proc_mode)) {
         i_thread_mode = 0;
@@ -175,6 +188,180 @@ static int mln_conf_reload_iterate_handler(mln_event_t *ev, mln_fork_t *f, void
     return mln_ipc_master_send_prepare(ev, M_IPC_TYPE_CONF, msg, sizeof(msg)-1, f);
 }
 
+/*
+ * Pin the worker process to cpu (worker_no % ncpu) if 'worker_cpu_pin' is on.
+ * Listeners opened afterwards ask the kernel to steer their connections to
+ * the same cpu, so a flow stays on the core that handles its RX queue.
+ */
+static void mln_worker_cpu_pin(void)
+{
+    char pin[] = "worker_cpu_pin";
+    mln_sauto_t worker_no = mln_fork_worker_no();
+    mln_conf_t *cf = mln_conf();
+    mln_conf_domain_t *cd;
+    mln_conf_cmd_t *cc;
+    mln_conf_item_t *ci;
+
+    if (worker_no < 0 || cf == NULL || (cd = cf->search(cf, "main")) == NULL) return;
+    if ((cc = cd->search(cd, pin)) == NULL) return;
+    if ((ci = cc->search(cc, 1)) == NULL || ci->type != CONF_BOOL) {
+        mln_log(error, "'%s' need an on/off argument.\n", pin);
+        exit(1);
+    }
+    if (!ci->val.b) return;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) ncpu = 1;
+
+    CPU_ZERO(&set);
+    CPU_SET((int)(worker_no % ncpu), &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        mln_log(error, "Worker process No.%l bind cpu %l failed. %s\n", worker_no+1, worker_no % ncpu, strerror(errno));
+        return;
+    }
+    worker_cpu = (int)(worker_no % ncpu);
+#else
+    mln_log(warn, "'%s' is not supported on this platform.\n", pin);
+#endif
+}
+
+int mln_framework_listen(mln_event_t *ev, char *host, char *service, mln_framework_accept_t handler, void *data)
+{
+    int fd, opt = 1;
+    struct addrinfo hints, *res = NULL;
+    mln_framework_listener_t *l;
+
+    if ((l = (mln_framework_listener_t *)malloc(sizeof(mln_framework_listener_t))) == NULL) {
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_flags = AI_PASSIVE;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if (getaddrinfo(host, service, &hints, &res) != 0 || res == NULL) {
+        mln_log(error, "getaddrinfo %s:%s failed.\n", host == NULL? "*": host, service);
+        goto err1;
+    }
+    if ((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0) {
+        mln_log(error, "socket failed. %s\n", strerror(errno));
+        goto err2;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        mln_log(error, "setsockopt SO_REUSEADDR failed. %s\n", strerror(errno));
+        goto err3;
+    }
+#if defined(SO_REUSEPORT)
+    /*every worker binds its own socket, the kernel balances connections among them*/
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        mln_log(error, "setsockopt SO_REUSEPORT failed. %s\n", strerror(errno));
+        goto err3;
+    }
+#endif
+#if defined(SO_INCOMING_CPU)
+    if (worker_cpu >= 0 && setsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &worker_cpu, sizeof(worker_cpu)) < 0) {
+        mln_log(warn, "setsockopt SO_INCOMING_CPU failed. %s\n", strerror(errno));
+    }
+#endif
+    if (bind(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        mln_log(error, "bind %s:%s failed. %s\n", host == NULL? "*": host, service, strerror(errno));
+        goto err3;
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        mln_log(error, "listen failed. %s\n", strerror(errno));
+        goto err3;
+    }
+    freeaddrinfo(res);
+
+    l->fd = fd;
+    l->handler = handler;
+    l->data = data;
+    l->accepted = 0;
+    if (mln_event_fd_set(ev, fd, M_EV_RECV|M_EV_NONBLOCK, M_EV_UNLIMITED, l, mln_framework_accept_handler) < 0) {
+        mln_log(error, "mln_event_fd_set failed.\n");
+        mln_socket_close(fd);
+        free(l);
+        return -1;
+    }
+    l->next = listener_head;
+    listener_head = l;
+    ++listener_nr;
+
+    return fd;
+
+err3:
+    mln_socket_close(fd);
+err2:
+    freeaddrinfo(res);
+err1:
+    free(l);
+    return -1;
+}
+
+static void mln_framework_accept_handler(mln_event_t *ev, int fd, void *data)
+{
+    int conn, n;
+    mln_framework_listener_t *l = (mln_framework_listener_t *)data;
+
+    for (n = 0; n < M_FRAMEWORK_ACCEPT_BATCH; ++n) {
+        if ((conn = accept(fd, NULL, NULL)) < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+                mln_log(error, "accept failed. %s\n", strerror(errno));
+            break;
+        }
+        ++(l->accepted);
+        l->handler(ev, conn, l->data);
+    }
+}
+
+int mln_framework_status(char *buf, mln_size_t size)
+{
+    int n;
+    mln_u64_t accepted = 0;
+    mln_size_t len;
+    mln_framework_listener_t *l;
+    mln_string_t *mode = mln_get_framework_status();
+
+    for (l = listener_head; l != NULL; l = l->next)
+        accepted += l->accepted;
+
+    n = snprintf(buf, size, "framework=%s pid=%ld worker=%ld cpu=%d listeners=%u accepted=%llu", \
+                 mode == NULL? "off": (char *)(mode->data), \
+                 (long)getpid(), \
+                 (long)mln_fork_worker_no(), \
+                 worker_cpu, \
+                 (unsigned)listener_nr, \
+                 (unsigned long long)accepted);
+    if (n < 0) return -1;
+
+    /*per-listener counters, the truncated length is returned like snprintf does*/
+    for (l = listener_head; l != NULL; l = l->next) {
+        len = (mln_size_t)n < size? size - n: 0;
+        n += snprintf(len? buf + n: NULL, len, " fd%d=%llu", l->fd, (unsigned long long)l->accepted);
+    }
+
+    if (status_pool != NULL) {
+        mln_alloc_stats_t stats;
+        mln_alloc_stats(status_pool, &stats);
+        len = (mln_size_t)n < size? size - n: 0;
+        n += snprintf(len? buf + n: NULL, len, " mem_live=%lu mem_hwm=%lu mem_cached=%lu mem_large=%lu", \
+                      (unsigned long)stats.live_bytes, \
+                      (unsigned long)stats.live_bytes_hwm, \
+                      (unsigned long)stats.cached_bytes, \
+                      (unsigned long)stats.large_bytes);
+    }
+    return n;
+}
+
+void mln_framework_status_pool_set(mln_alloc_t *pool)
+{
+    status_pool = pool;
+}
+
 static mln_string_t *mln_get_framework_status(void)
 {
     char framework[] = "framework";
@@ -16,7 +16,7 @@ MLN_CHAIN_FUNC_DECLARE(mln_hash_entry, \
                        mln_hash_entry_t, \
                        static inline void,);
 static inline mln_hash_entry_t *
-mln_hash_entry_new(mln_hash_t *h, mln_hash_mgr_t *mgr, void *key, void *val) __NONNULL4(1,2,3,4);
+mln_hash_entry_new(mln_hash_t *h, mln_hash_mgr_t *mgr, void *key, void *val, mln_u64_t hval) __NONNULL4(1,2,3,4);
 static inline void
 mln_hash_entry_free(mln_hash_t *h, mln_hash_entry_t *he, mln_hash_flag_t flg) __NONNULL1(1);
 static inline void
@@ -25,6 +25,18 @@ static inline void
 mln_hash_expand(mln_hash_t *h) __NONNULL1(1);
 static inline void
 mln_move_hash_entry(mln_hash_t *h, mln_hash_mgr_t *old_tbl, mln_u32_t old_len) __NONNULL2(1,2);
+static inline void mln_hash_resize(mln_hash_t *h, mln_u64_t len, mln_u32_t threshold);
+static inline void mln_hash_migrate(mln_hash_t *h);
+static inline mln_hash_entry_t *
+mln_hash_entry_search(mln_hash_t *h, void *key, int skip_removed);
+static inline void mln_hash_tbl_free(mln_hash_t *h, mln_hash_mgr_t *tbl, mln_u64_t len, mln_hash_flag_t flg);
+static inline mln_u64_t mln_hash_index(mln_hash_t *h, mln_u64_t hval, mln_u64_t len);
+static inline mln_u32_t mln_hash_flat_calc(mln_hash_flat_t *h, void *key);
+static inline mln_hash_slot_t *mln_hash_flat_find(mln_hash_flat_t *h, void *key, mln_u32_t hash);
+static inline void mln_hash_flat_place(mln_hash_flat_t *h, mln_hash_slot_t *slot);
+static inline void mln_hash_flat_delete(mln_hash_flat_t *h, mln_hash_slot_t *slot);
+static int mln_hash_flat_resize(mln_hash_flat_t *h, mln_u64_t cap);
+static inline void mln_hash_flat_slot_free(mln_hash_flat_t *h, mln_hash_slot_t *slot, mln_hash_flag_t flg);
 
 int mln_hash_init(mln_hash_t *h, struct mln_hash_attr *attr)
 {
@@ -48,6 +60,10 @@ int mln_hash_init(mln_hash_t *h, struct mln_hash_attr *attr)
     h->threshold = attr->calc_prime? mln_prime_generate(h->len << 1): h->len << 1;
     h->expandable = attr->expandable;
     h->calc_prime = attr->calc_prime;
+    h->incremental = attr->incremental;
+    h->full_hash = attr->full_hash;
+    h->old_tbl = NULL;
+    h->old_len = h->migrate_idx = 0;
     if (h->len == 0 || \
         h->hash == NULL || \
         h->cmp == NULL)
@@ -97,6 +113,10 @@ mln_hash_new(struct mln_hash_attr *attr)
     h->threshold = attr->calc_prime? mln_prime_generate(h->len << 1): h->len << 1;
     h->expandable = attr->expandable;
     h->calc_prime = attr->calc_prime;
+    h->incremental = attr->incremental;
+    h->full_hash = attr->full_hash;
+    h->old_tbl = NULL;
+    h->old_len = h->migrate_idx = 0;
     if (h->len == 0 || \
         h->hash == NULL || \
         h->cmp == NULL)
@@ -114,13 +134,11 @@ mln_hash_new(struct mln_hash_attr *attr)
     return h;
 }
 
-void mln_hash_destroy(mln_hash_t *h, mln_hash_flag_t flg)
+static inline void mln_hash_tbl_free(mln_hash_t *h, mln_hash_mgr_t *tbl, mln_u64_t len, mln_hash_flag_t flg)
 {
-    if (h == NULL) return;
-
     mln_hash_entry_t *he, *fr;
-    mln_hash_mgr_t *mgr, *mgr_end = h->tbl + h->len;
-    for (mgr = h->tbl; mgr < mgr_end; ++mgr) {
+    mln_hash_mgr_t *mgr, *mgr_end = tbl + len;
+    for (mgr = tbl; mgr < mgr_end; ++mgr) {
         he = mgr->head;
         while (he != NULL) {
             fr = he;
@@ -128,26 +146,26 @@ void mln_hash_destroy(mln_hash_t *h, mln_hash_flag_t flg)
             mln_hash_entry_free(h, fr, flg);
         }
     }
-    if (h->pool != NULL) h->pool_free(h->tbl);
-    else free(h->tbl);
+    if (h->pool != NULL) h->pool_free(tbl);
+    else free(tbl);
 }
 
-void mln_hash_free(mln_hash_t *h, mln_hash_flag_t flg)
+void mln_hash_destroy(mln_hash_t *h, mln_hash_flag_t flg)
 {
     if (h == NULL) return;
 
-    mln_hash_entry_t *he, *fr;
-    mln_hash_mgr_t *mgr, *mgr_end = h->tbl + h->len;
-    for (mgr = h->tbl; mgr < mgr_end; ++mgr) {
-        he = mgr->head;
-        while (he != NULL) {
-            fr = he;
-            he = he->next;
-            mln_hash_entry_free(h, fr, flg);
-        }
+    mln_hash_tbl_free(h, h->tbl, h->len, flg);
+    if (h->old_tbl != NULL) {
+        /*buckets before migrate_idx are empty*/
+        mln_hash_tbl_free(h, h->old_tbl, h->old_len, flg);
     }
-    if (h->pool != NULL) h->pool_free(h->tbl);
-    else free(h->tbl);
+}
+
+void mln_hash_free(mln_hash_t *h, mln_hash_flag_t flg)
+{
+    if (h == NULL) return;
+
+    mln_hash_destroy(h, flg);
     if (h->pool != NULL) h->pool_free(h);
     else free(h);
 }
@@ -156,12 +174,9 @@ int mln_hash_update(mln_hash_t *h, void *key, void *val)
 {
     void **k = (void **)key;
     void **v = (void **)val;
-    mln_u32_t index = h->hash(h, *k);
-    mln_hash_mgr_t *mgr = &(h->tbl[index]);
-    mln_hash_entry_t *he;
-    for (he = mgr->head; he != NULL; he = he->next) {
-        if (h->cmp(h, *k, he->key)) break;
-    }
+    mln_u64_t hval;
+    mln_hash_mgr_t *mgr;
+    mln_hash_entry_t *he = mln_hash_entry_search(h, *k, 0);
     if (he != NULL) {
         he->removed = 0;
 
@@ -180,7 +195,9 @@ int mln_hash_update(mln_hash_t *h, void *key, void *val)
     if (h->expandable && h->nr_nodes <= (h->threshold >> 3)) {
         mln_hash_reduce(h);
     }
-    he = mln_hash_entry_new(h, mgr, *k, *v);
+    hval = h->hash(h, *k);
+    mgr = &(h->tbl[mln_hash_index(h, hval, h->len)]);
+    he = mln_hash_entry_new(h, mgr, *k, *v, hval);
     if (he == NULL) return -1;
     mln_hash_entry_chain_add(&(mgr->head), &(mgr->tail), he);
     mln_hash_entry_iter_chain_add(&(h->iter_head), &(h->iter_tail), he);
@@ -191,15 +208,16 @@ int mln_hash_update(mln_hash_t *h, void *key, void *val)
 
 int mln_hash_insert(mln_hash_t *h, void *key, void *val)
 {
+    if (h->old_tbl != NULL) mln_hash_migrate(h);
     if (h->expandable && h->nr_nodes > h->threshold) {
         mln_hash_expand(h);
     }
     if (h->expandable && h->nr_nodes <= (h->threshold >> 3)) {
         mln_hash_reduce(h);
     }
-    mln_u32_t index = h->hash(h, key);
-    mln_hash_mgr_t *mgr = &(h->tbl[index]);
-    mln_hash_entry_t *he = mln_hash_entry_new(h, mgr, key, val);
+    mln_u64_t hval = h->hash(h, key);
+    mln_hash_mgr_t *mgr = &(h->tbl[mln_hash_index(h, hval, h->len)]);
+    mln_hash_entry_t *he = mln_hash_entry_new(h, mgr, key, val, hval);
     if (he == NULL) return -1;
     mln_hash_entry_chain_add(&(mgr->head), &(mgr->tail), he);
     mln_hash_entry_iter_chain_add(&(h->iter_head), &(h->iter_tail), he);
@@ -209,46 +227,53 @@ int mln_hash_insert(mln_hash_t *h, void *key, void *val)
 
 static inline void mln_hash_reduce(mln_hash_t *h)
 {
-    mln_hash_mgr_t *old_tbl = h->tbl;
-    mln_u32_t len = h->len;
-    h->len = h->calc_prime? mln_prime_generate(h->threshold >> 2): h->threshold >> 2;
-    if (h->len == 0) h->len = 1;
-    if (h->pool != NULL) {
-        h->tbl = (mln_hash_mgr_t *)h->pool_alloc(h->pool, h->len*sizeof(mln_hash_mgr_t));
-        memset(h->tbl, 0, h->len*sizeof(mln_hash_mgr_t));
-    } else {
-        h->tbl = (mln_hash_mgr_t *)calloc(h->len, sizeof(mln_hash_mgr_t));
-    }
-    if (h->tbl == NULL) {
-        h->tbl = old_tbl;
-        h->len = len;
-        return;
-    }
-    h->threshold = h->calc_prime? mln_prime_generate(h->threshold >> 1): h->threshold >> 1;
-    mln_move_hash_entry(h, old_tbl, len);
-    if (h->pool != NULL) h->pool_free(old_tbl);
-    else free(old_tbl);
+    if (h->old_tbl != NULL) return;
+
+    mln_u64_t len = h->calc_prime? mln_prime_generate(h->threshold >> 2): h->threshold >> 2;
+    if (len == 0) len = 1;
+    mln_hash_resize(h, len, h->calc_prime? mln_prime_generate(h->threshold >> 1): h->threshold >> 1);
 }
 
 static inline void mln_hash_expand(mln_hash_t *h)
+{
+    if (h->old_tbl != NULL) return;
+
+    mln_hash_resize(h, \
+                    h->calc_prime? mln_prime_generate(h->len << 1): ((h->len << 1) - 1), \
+                    h->calc_prime? mln_prime_generate(h->threshold << 1): ((h->threshold << 1) - 1));
+}
+
+/*
+ * In incremental mode, the old table is kept and its buckets are moved
+ * by mln_hash_migrate() a few at a time, instead of all at once here.
+ * mln_hash_expand() and mln_hash_reduce() do nothing until the migration
+ * is done.
+ */
+static inline void mln_hash_resize(mln_hash_t *h, mln_u64_t len, mln_u32_t threshold)
 {
     mln_hash_mgr_t *old_tbl = h->tbl;
-    mln_u32_t len = h->len;
-    h->len = h->calc_prime? mln_prime_generate(len << 1): ((len << 1) - 1);
+    mln_u64_t old_len = h->len;
+
+    h->len = len;
     if (h->pool != NULL) {
         h->tbl = (mln_hash_mgr_t *)h->pool_alloc(h->pool, h->len*sizeof(mln_hash_mgr_t));
-        memset(h->tbl, 0, h->len*sizeof(mln_hash_mgr_t));
+        if (h->tbl != NULL) memset(h->tbl, 0, h->len*sizeof(mln_hash_mgr_t));
     } else {
         h->tbl = (mln_hash_mgr_t *)calloc(h->len, sizeof(mln_hash_mgr_t));
     }
     if (h->tbl == NULL) {
         h->tbl = old_tbl;
-        h->len = len;
+        h->len = old_len;
         return;
     }
-    h->threshold = h->calc_prime? mln_prime_generate(h->threshold << 1): \
-                                  ((h->threshold << 1) - 1);
-    mln_move_hash_entry(h, old_tbl, len);
+    h->threshold = threshold;
+    if (h->incremental) {
+        h->old_tbl = old_tbl;
+        h->old_len = old_len;
+        h->migrate_idx = 0;
+        return;
+    }
+    mln_move_hash_entry(h, old_tbl, old_len);
     if (h->pool != NULL) h->pool_free(old_tbl);
     else free(old_tbl);
 }
@@ -259,26 +284,88 @@ mln_move_hash_entry(mln_hash_t *h, mln_hash_mgr_t *old_tbl, mln_u32_t old_len)
     mln_hash_mgr_t *old_end = old_tbl + old_len;
     mln_hash_mgr_t *new_mgr;
     mln_hash_entry_t *he;
-    mln_u32_t index;
+    mln_u64_t index;
 
     for (; old_tbl < old_end; ++old_tbl) {
         while ((he = old_tbl->head) != NULL) {
             mln_hash_entry_chain_del(&(old_tbl->head), &(old_tbl->tail), he);
-            index = h->hash(h, he->key);
+            index = h->full_hash? he->hval % h->len: h->hash(h, he->key);
             new_mgr = &(h->tbl[index]);
+            he->mgr = new_mgr;
             mln_hash_entry_chain_add(&(new_mgr->head), &(new_mgr->tail), he);
         }
     }
 }
 
-void *mln_hash_change_value(mln_hash_t *h, void *key, void *new_value)
+static inline mln_u64_t mln_hash_index(mln_hash_t *h, mln_u64_t hval, mln_u64_t len)
 {
-    mln_u32_t index = h->hash(h, key);
-    mln_hash_mgr_t *mgr = &(h->tbl[index]);
+    return h->full_hash? hval % len: hval;
+}
+
+static inline void mln_hash_migrate(mln_hash_t *h)
+{
+    mln_u64_t n = M_HASH_MIGRATE_STEP, empty = M_HASH_MIGRATE_STEP * 10;
+    mln_hash_mgr_t *mgr;
+
+    while (h->migrate_idx < h->old_len) {
+        mgr = &(h->old_tbl[h->migrate_idx++]);
+        if (mgr->head == NULL) {
+            if (!--empty) return;
+            continue;
+        }
+        mln_move_hash_entry(h, mgr, 1);
+        if (!--n) return;
+    }
+    if (h->pool != NULL) h->pool_free(h->old_tbl);
+    else free(h->old_tbl);
+    h->old_tbl = NULL;
+    h->old_len = h->migrate_idx = 0;
+}
+
+/*
+ * Search the current table, then the bucket of the old table if it is not
+ * migrated yet. Without full_hash, the user hash works on h->len, so it is
+ * switched to the old length to get the old index.
+ */
+static inline mln_hash_entry_t *
+mln_hash_entry_search(mln_hash_t *h, void *key, int skip_removed)
+{
+    mln_u64_t len, index, hval;
+    mln_hash_mgr_t *mgr;
     mln_hash_entry_t *he;
+
+    if (h->old_tbl != NULL) mln_hash_migrate(h);
+
+    hval = h->hash(h, key);
+    mgr = &(h->tbl[mln_hash_index(h, hval, h->len)]);
+    for (he = mgr->head; he != NULL; he = he->next) {
+        if (skip_removed && he->removed) continue;
+        if (h->full_hash && he->hval != hval) continue;
+        if (h->cmp(h, key, he->key)) return he;
+    }
+    if (h->old_tbl == NULL) return NULL;
+
+    if (h->full_hash) {
+        index = hval % h->old_len;
+    } else {
+        len = h->len;
+        h->len = h->old_len;
+        index = h->hash(h, key);
+        h->len = len;
+    }
+    if (index < h->migrate_idx) return NULL;
+    mgr = &(h->old_tbl[index]);
     for (he = mgr->head; he != NULL; he = he->next) {
-        if (h->cmp(h, key, he->key)) break;
+        if (skip_removed && he->removed) continue;
+        if (h->full_hash && he->hval != hval) continue;
+        if (h->cmp(h, key, he->key)) return he;
     }
+    return NULL;
+}
+
+void *mln_hash_change_value(mln_hash_t *h, void *key, void *new_value)
+{
+    mln_hash_entry_t *he = mln_hash_entry_search(h, key, 0);
     if (he == NULL) return NULL;
     mln_u8ptr_t retval = (mln_u8ptr_t)(he->val);
     he->val = new_value;
@@ -287,12 +374,7 @@ void *mln_hash_change_value(mln_hash_t *h, void *key, void *new_value)
 
 void *mln_hash_search(mln_hash_t *h, void *key)
 {
-    mln_u32_t index = h->hash(h, key);
-    mln_hash_mgr_t *mgr = &(h->tbl[index]);
-    mln_hash_entry_t *he;
-    for (he = mgr->head; he != NULL; he = he->next) {
-        if (h->cmp(h, key, he->key)) break;
-    }
+    mln_hash_entry_t *he = mln_hash_entry_search(h, key, 0);
     if (he == NULL || he->removed) return NULL;
     return he->val;
 }
@@ -311,12 +393,7 @@ void *mln_hash_search_iterator(mln_hash_t *h, void *key, int **ctx)
         *ctx = (int *)(he->next);
         return he->val;
     }
-    mln_u32_t index = h->hash(h, key);
-    mln_hash_mgr_t *mgr = &(h->tbl[index]);
-    mln_hash_entry_t *he;
-    for (he = mgr->head; he != NULL; he = he->next) {
-        if (h->cmp(h, key, he->key)) break;
-    }
+    mln_hash_entry_t *he = mln_hash_entry_search(h, key, 0);
     if (he == NULL || he->removed) return NULL;
     *ctx = (int *)(he->next);
     return he->val;
@@ -324,14 +401,10 @@ void *mln_hash_search_iterator(mln_hash_t *h, void *key, int **ctx)
 
 void mln_hash_remove(mln_hash_t *h, void *key, mln_hash_flag_t flg)
 {
-    mln_u32_t index = h->hash(h, key);
-    mln_hash_mgr_t *mgr = &(h->tbl[index]);
-    mln_hash_entry_t *he;
-
-    for (he = mgr->head; he != NULL; he = he->next) {
-        if (h->cmp(h, key, he->key)) break;
-    }
+    mln_hash_mgr_t *mgr;
+    mln_hash_entry_t *he = mln_hash_entry_search(h, key, 0);
     if (he == NULL) return;
+    mgr = he->mgr;
 
     if (h->iter == he) {
         he->remove_flag = flg;
@@ -346,7 +419,7 @@ void mln_hash_remove(mln_hash_t *h, void *key, mln_hash_flag_t flg)
 }
 
 static inline mln_hash_entry_t *
-mln_hash_entry_new(mln_hash_t *h, mln_hash_mgr_t *mgr, void *key, void *val)
+mln_hash_entry_new(mln_hash_t *h, mln_hash_mgr_t *mgr, void *key, void *val, mln_u64_t hval)
 {
     mln_hash_entry_t *he;
     if (h->pool != NULL) {
@@ -360,6 +433,7 @@ mln_hash_entry_new(mln_hash_t *h, mln_hash_mgr_t *mgr, void *key, void *val)
     he->prev = he->next = NULL;
     he->iter_prev = he->iter_next = NULL;
     he->mgr = mgr;
+    he->hval = hval;
     he->remove_flag = M_HASH_F_NONE;
     he->removed = 0;
     return he;
@@ -418,13 +492,7 @@ int mln_hash_iterate(mln_hash_t *h, hash_iterate_handler handler, void *udata)
 
 int mln_hash_key_exist(mln_hash_t *h, void *key)
 {
-    mln_u32_t index = h->hash(h, key);
-    mln_hash_mgr_t *mgr = &(h->tbl[index]);
-    mln_hash_entry_t *he;
-    for (he = mgr->head; he != NULL; he = he->next) {
-        if (!he->removed && h->cmp(h, key, he->key)) return 1;
-    }
-    return 0;
+    return mln_hash_entry_search(h, key, 1) != NULL;
 }
 
 void mln_hash_reset(mln_hash_t *h, mln_hash_flag_t flg)
@@ -439,11 +507,279 @@ void mln_hash_reset(mln_hash_t *h, mln_hash_flag_t flg)
             mln_hash_entry_free(h, he, flg);
         }
     }
+    if (h->old_tbl != NULL) {
+        mln_hash_tbl_free(h, h->old_tbl, h->old_len, flg);
+        h->old_tbl = NULL;
+        h->old_len = h->migrate_idx = 0;
+    }
 
     h->nr_nodes = 0;
     h->iter = h->iter_head = h->iter_tail = NULL;
 }
 
+/*
+ * flat table
+ */
+mln_hash_flat_t *mln_hash_flat_new(struct mln_hash_attr *attr)
+{
+    mln_hash_flat_t *h;
+    mln_u64_t cap = M_HASH_FLAT_MIN_SIZE;
+
+    if (attr->hash == NULL || attr->cmp == NULL) return NULL;
+
+    if (attr->pool != NULL) {
+        h = (mln_hash_flat_t *)attr->pool_alloc(attr->pool, sizeof(mln_hash_flat_t));
+    } else {
+        h = (mln_hash_flat_t *)malloc(sizeof(mln_hash_flat_t));
+    }
+    if (h == NULL) return NULL;
+
+    memset(&(h->base), 0, sizeof(mln_hash_t));
+    h->base.pool = attr->pool;
+    h->base.pool_alloc = attr->pool_alloc;
+    h->base.pool_free = attr->pool_free;
+    h->base.hash = attr->hash;
+    h->base.cmp = attr->cmp;
+    h->base.free_key = attr->free_key;
+    h->base.free_val = attr->free_val;
+    h->base.len = M_HASH_FLAT_SPACE;
+    h->base.expandable = 1;
+    h->base.full_hash = attr->full_hash;
+
+    while (cap < attr->len_base) cap <<= 1;
+    h->slots = NULL;
+    h->cap = 0;
+    h->min_cap = cap;
+    h->nr_nodes = h->nr_removed = 0;
+    h->iterating = 0;
+    if (mln_hash_flat_resize(h, cap) < 0) {
+        if (h->base.pool != NULL) h->base.pool_free(h);
+        else free(h);
+        return NULL;
+    }
+    return h;
+}
+
+void mln_hash_flat_free(mln_hash_flat_t *h, mln_hash_flag_t flg)
+{
+    if (h == NULL) return;
+
+    mln_hash_slot_t *slot, *end = h->slots + h->cap;
+
+    for (slot = h->slots; slot < end; ++slot) {
+        if (!slot->dist) continue;
+        mln_hash_flat_slot_free(h, slot, slot->removed? (mln_hash_flag_t)slot->remove_flag: flg);
+    }
+    if (h->base.pool != NULL) {
+        h->base.pool_free(h->slots);
+        h->base.pool_free(h);
+    } else {
+        free(h->slots);
+        free(h);
+    }
+}
+
+/*
+ * The user hash is mixed, so a weak callback (e.g. an integer key itself)
+ * still spreads over the low bits used as the index.
+ */
+static inline mln_u32_t mln_hash_flat_calc(mln_hash_flat_t *h, void *key)
+{
+    mln_u64_t v = h->base.hash(&(h->base), key);
+
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    return (mln_u32_t)v;
+}
+
+static inline mln_hash_slot_t *mln_hash_flat_find(mln_hash_flat_t *h, void *key, mln_u32_t hash)
+{
+    mln_u64_t mask = h->cap - 1, i = hash & mask;
+    mln_u32_t dist;
+    mln_hash_slot_t *slot;
+
+    for (dist = 1; ; ++dist, i = (i + 1) & mask) {
+        slot = &(h->slots[i]);
+        /*an entry with a shorter distance means the key is not here*/
+        if (slot->dist < dist) return NULL;
+        if (slot->hash == hash && !slot->removed && h->base.cmp(&(h->base), key, slot->key))
+            return slot;
+    }
+    return NULL;
+}
+
+/*
+ * Robin Hood: an entry takes the slot of any entry closer to its home.
+ * There must be at least one empty slot.
+ */
+static inline void mln_hash_flat_place(mln_hash_flat_t *h, mln_hash_slot_t *slot)
+{
+    mln_u64_t mask = h->cap - 1, i = slot->hash & mask;
+    mln_hash_slot_t cur = *slot, tmp;
+
+    for (cur.dist = 1; ; ++(cur.dist), i = (i + 1) & mask) {
+        if (!h->slots[i].dist) {
+            h->slots[i] = cur;
+            return;
+        }
+        if (h->slots[i].dist < cur.dist) {
+            tmp = h->slots[i];
+            h->slots[i] = cur;
+            cur = tmp;
+        }
+    }
+}
+
+/*
+ * Backward shift: pull the following entries one slot back until an empty
+ * slot or an entry at its home, so no tombstone is left.
+ */
+static inline void mln_hash_flat_delete(mln_hash_flat_t *h, mln_hash_slot_t *slot)
+{
+    mln_u64_t mask = h->cap - 1, i = slot - h->slots, next;
+
+    for (next = (i + 1) & mask; h->slots[next].dist > 1; i = next, next = (next + 1) & mask) {
+        h->slots[i] = h->slots[next];
+        --(h->slots[i].dist);
+    }
+    h->slots[i].dist = 0;
+    --(h->nr_nodes);
+}
+
+/*
+ * The hash is kept in the slot, so the user hash is not called on resize.
+ */
+static int mln_hash_flat_resize(mln_hash_flat_t *h, mln_u64_t cap)
+{
+    mln_hash_slot_t *old = h->slots, *slot, *end = h->slots + h->cap;
+
+    if (h->base.pool != NULL) {
+        h->slots = (mln_hash_slot_t *)h->base.pool_alloc(h->base.pool, cap * sizeof(mln_hash_slot_t));
+        if (h->slots != NULL) memset(h->slots, 0, cap * sizeof(mln_hash_slot_t));
+    } else {
+        h->slots = (mln_hash_slot_t *)calloc(cap, sizeof(mln_hash_slot_t));
+    }
+    if (h->slots == NULL) {
+        h->slots = old;
+        return -1;
+    }
+    h->cap = cap;
+
+    if (old == NULL) return 0;
+    for (slot = old; slot < end; ++slot) {
+        if (slot->dist) mln_hash_flat_place(h, slot);
+    }
+    if (h->base.pool != NULL) h->base.pool_free(old);
+    else free(old);
+    return 0;
+}
+
+static inline void mln_hash_flat_slot_free(mln_hash_flat_t *h, mln_hash_slot_t *slot, mln_hash_flag_t flg)
+{
+    switch (flg) {
+        case M_HASH_F_VAL:
+            if (h->base.free_val != NULL)
+                h->base.free_val(slot->val);
+            break;
+        case M_HASH_F_KEY:
+            if (h->base.free_key != NULL)
+                h->base.free_key(slot->key);
+            break;
+        case M_HASH_F_KV:
+            if (h->base.free_val != NULL)
+                h->base.free_val(slot->val);
+            if (h->base.free_key != NULL)
+                h->base.free_key(slot->key);
+            break;
+        default: break;
+    }
+}
+
+void *mln_hash_flat_search(mln_hash_flat_t *h, void *key)
+{
+    mln_hash_slot_t *slot = mln_hash_flat_find(h, key, mln_hash_flat_calc(h, key));
+    return slot == NULL? NULL: slot->val;
+}
+
+/*
+ * The table grows at a load factor of 7/8.
+ * Inserting is not allowed in mln_hash_flat_iterate.
+ * A probe distance never exceeds the number of entries, so limiting
+ * the entries keeps the 32-bit dist from wrapping.
+ */
+int mln_hash_flat_insert(mln_hash_flat_t *h, void *key, void *val)
+{
+    mln_hash_slot_t slot;
+
+    if (h->iterating || h->nr_nodes >= M_HASH_FLAT_MAX_NODES) return -1;
+    if ((h->nr_nodes + 1) << 3 > h->cap * 7) {
+        if (mln_hash_flat_resize(h, h->cap << 1) < 0) return -1;
+    }
+    slot.key = key;
+    slot.val = val;
+    slot.hash = mln_hash_flat_calc(h, key);
+    slot.removed = 0;
+    slot.remove_flag = M_HASH_F_NONE;
+    slot.padding = 0;
+    mln_hash_flat_place(h, &slot);
+    ++(h->nr_nodes);
+    return 0;
+}
+
+/*
+ * In mln_hash_flat_iterate, the entry is only marked and removed after the
+ * iteration, because the backward shift would move unvisited entries.
+ */
+void mln_hash_flat_remove(mln_hash_flat_t *h, void *key, mln_hash_flag_t flg)
+{
+    mln_hash_slot_t *slot = mln_hash_flat_find(h, key, mln_hash_flat_calc(h, key));
+
+    if (slot == NULL) return;
+
+    if (h->iterating) {
+        slot->removed = 1;
+        slot->remove_flag = flg;
+        ++(h->nr_removed);
+        return;
+    }
+
+    mln_hash_flat_slot_free(h, slot, flg);
+    mln_hash_flat_delete(h, slot);
+    if (h->cap > h->min_cap && (h->nr_nodes << 3) < h->cap)
+        (void)mln_hash_flat_resize(h, h->cap >> 1);
+}
+
+int mln_hash_flat_iterate(mln_hash_flat_t *h, hash_iterate_handler handler, void *udata)
+{
+    int ret = 0;
+    mln_hash_slot_t *slot, *end = h->slots + h->cap;
+
+    h->iterating = 1;
+    for (slot = h->slots; slot < end; ++slot) {
+        if (!slot->dist || slot->removed) continue;
+        if (handler != NULL && handler(&(h->base), slot->key, slot->val, udata) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    h->iterating = 0;
+
+    if (h->nr_removed) {
+        /*a deletion shifts the next entry into this slot, so check it again*/
+        for (slot = h->slots; slot < end; ++slot) {
+            while (slot->dist && slot->removed) {
+                mln_hash_flat_slot_free(h, slot, (mln_hash_flag_t)slot->remove_flag);
+                mln_hash_flat_delete(h, slot);
+            }
+        }
+        h->nr_removed = 0;
+    }
+    return ret;
+}
+
 MLN_CHAIN_FUNC_DEFINE(mln_hash_entry, \
                       mln_hash_entry_t, \
                       static inline void, \
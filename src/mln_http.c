@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <ctype.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include "mln_types.h"
 #include "mln_http.h"
 
@@ -18,8 +21,19 @@ struct mln_http_chain_s {
     mln_size_t   left_size;
 };
 
-static inline int mln_http_line_length(mln_http_t *http, mln_chain_t *in, mln_size_t *len);
-static inline int mln_http_process_line(mln_http_t *http, mln_chain_t **in, mln_size_t len);
+struct mln_http_range_s {
+    mln_alloc_t *pool;
+    mln_u8ptr_t  start;
+    mln_u8ptr_t  end;
+};
+
+static inline mln_u8ptr_t mln_http_scan(mln_u8ptr_t p, mln_u8ptr_t end, mln_u8_t a, mln_u8_t b, mln_u8_t c);
+static inline int
+mln_http_line_get(mln_http_t *http, mln_chain_t **in, int *slice, mln_u8ptr_t *line, mln_size_t *len);
+static inline int mln_http_buf_keep(mln_http_t *http, mln_chain_t **in);
+static inline int mln_http_relocate(struct mln_http_range_s *range, mln_string_t *s);
+static int mln_http_relocate_iterate_handler(mln_hash_t *h, void *key, void *val, void *data);
+static inline int mln_http_process_line(mln_http_t *http, mln_u8ptr_t buf, mln_size_t len);
 static inline int mln_http_parse_headline(mln_http_t *http, mln_u8ptr_t buf, mln_size_t len);
 static inline int mln_http_parse_field(mln_http_t *http, mln_u8ptr_t buf, mln_size_t len);
 static void mln_http_hash_free(void *data);
@@ -122,15 +136,21 @@ int mln_http_parse(mln_http_t *http, mln_chain_t **in)
 {
     if (http == NULL) return M_HTTP_RET_ERROR;
 
-    int ret = M_HTTP_RET_DONE, rc;
+    int ret = M_HTTP_RET_DONE, slice = 0;
+    mln_u8ptr_t line;
     mln_size_t len = 0;
     mln_http_handler handler = mln_http_handler_get(http);
 
-    while (!mln_http_done_get(http) && \
-           (ret = mln_http_line_length(http, *in, &len)) == M_HTTP_RET_DONE)
-    {
-        if ((rc = mln_http_process_line(http, in, len) == M_HTTP_RET_ERROR))
-            return rc;
+    while (!mln_http_done_get(http)) {
+        if ((ret = mln_http_line_get(http, in, &slice, &line, &len)) != M_HTTP_RET_DONE)
+            break;
+        if ((ret = mln_http_process_line(http, line, len)) == M_HTTP_RET_ERROR)
+            break;
+        ret = M_HTTP_RET_DONE;
+    }
+    if (slice && mln_http_buf_keep(http, in) < 0) {
+        mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+        return M_HTTP_RET_ERROR;
     }
     if (ret == M_HTTP_RET_OK || ret == M_HTTP_RET_ERROR) return ret;
 
@@ -141,96 +161,233 @@ int mln_http_parse(mln_http_t *http, mln_chain_t **in)
     return ret;
 }
 
-static inline int mln_http_line_length(mln_http_t *http, mln_chain_t *in, mln_size_t *len)
+/*
+ * Return the first byte equal to a, b or c in [p, end), or end.
+ * 32 or 16 bytes are compared at a time if AVX2 or SSE2 is enabled
+ * by the compiler, the rest is scanned byte by byte.
+ */
+static inline mln_u8ptr_t mln_http_scan(mln_u8ptr_t p, mln_u8ptr_t end, mln_u8_t a, mln_u8_t b, mln_u8_t c)
 {
-    mln_buf_t *b;
-    mln_u8ptr_t p, end;
-    mln_size_t length = 0;
-
-    while (in != NULL) {
-        b = in->buf;
-        if (b == NULL || b->in_file || mln_buf_left_size(b) <= 0) {
-            in = in->next;
-            continue;
-        }
-        for (p = b->left_pos, end = b->last; p < end; ++p) {
-            if (*p == (mln_u8_t)'\n') break;
-            ++length;
-        }
-        if (p >= end) {
-            in = in->next;
-            continue;
-        }
-        break;
-    }
-    if (in == NULL) return M_HTTP_RET_OK;
+#if defined(__AVX2__)
+    __m256i a32 = _mm256_set1_epi8((char)a), b32 = _mm256_set1_epi8((char)b), c32 = _mm256_set1_epi8((char)c), v32;
+    mln_u32_t mask32;
+
+    for (; end - p >= 32; p += 32) {
+        v32 = _mm256_loadu_si256((const __m256i *)p);
+        mask32 = (mln_u32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v32, a32), \
+                                                                                  _mm256_cmpeq_epi8(v32, b32)), \
+                                                                 _mm256_cmpeq_epi8(v32, c32)));
+        if (mask32) return p + __builtin_ctz(mask32);
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i a16 = _mm_set1_epi8((char)a), b16 = _mm_set1_epi8((char)b), c16 = _mm_set1_epi8((char)c), v16;
+    mln_u32_t mask16;
+
+    for (; end - p >= 16; p += 16) {
+        v16 = _mm_loadu_si128((const __m128i *)p);
+        mask16 = (mln_u32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v16, a16), \
+                                                                        _mm_cmpeq_epi8(v16, b16)), \
+                                                           _mm_cmpeq_epi8(v16, c16)));
+        if (mask16) return p + __builtin_ctz(mask16);
+    }
+#endif
+    for (; p < end; ++p) {
+        if (*p == a || *p == b || *p == c) break;
+    }
+    return p;
+}
 
-    *len = length;
-    return M_HTTP_RET_DONE;
+/*
+ * Tokens are zero-copy slices of the receive buffers and terminated by
+ * writing 0 over the delimiter in place, so a buffer must be writable and
+ * stays referenced by http until reset or destroy.
+ */
+static inline int mln_http_buf_writable(mln_buf_t *b)
+{
+#if !defined(WIN32) && defined(MLN_MMAP)
+    if (b->mmap) return 0;
+#endif
+    return !b->temporary && b->shared == NULL;
 }
 
-static inline int mln_http_process_line(mln_http_t *http, mln_chain_t **in, mln_size_t len)
+static inline void mln_http_buf_hold(mln_http_t *http, mln_chain_t *c)
 {
-    int ret;
-    mln_buf_t *b;
-    mln_chain_t *c;
-    mln_u8ptr_t buf, p, last;
-    mln_alloc_t *pool = mln_http_pool_get(http);
-    mln_u32_t type = mln_http_type_get(http);
+    c->next = NULL;
+    mln_chain_add(&(http->hold_head), &(http->hold_tail), c);
+}
 
-    buf = (mln_u8ptr_t)mln_alloc_m(pool, len+1);
-    if (buf == NULL) {
-        mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-        return M_HTTP_RET_ERROR;
-    }
-    buf[len] = 0;
-    p = buf;
+/*
+ * Get the next line without '\n'.
+ * A line found in one writable buffer is returned in place and *slice
+ * is set to tell that the head buffer of *in is referenced. Otherwise,
+ * the line is copied into a new buffer held by http, only lines across
+ * buffers are copied in practice.
+ */
+static inline int
+mln_http_line_get(mln_http_t *http, mln_chain_t **in, int *slice, mln_u8ptr_t *line, mln_size_t *len)
+{
+    mln_chain_t *c, *scan, *nc;
+    mln_buf_t *b, *nb;
+    mln_u8ptr_t p;
+    mln_size_t n, size;
+    mln_alloc_t *pool = mln_http_pool_get(http);
 
     while ((c = *in) != NULL) {
         b = c->buf;
-        if (b == NULL || b->in_file || mln_buf_left_size(b) <= 0) {
-            *in = (*in)->next;
-            mln_chain_pool_release(c);
-            continue;
-        }
-        while (mln_buf_left_size(b) > 0) {
-            if (*(b->left_pos) == '\n') break;
-            *p++ = *(b->left_pos++);
-        }
-        if (mln_buf_left_size(b) > 0) {
-            ++(b->left_pos);
-            break;
+        if (b != NULL && !b->in_file && mln_buf_left_size(b) > 0) break;
+        *in = c->next;
+        if (*slice) mln_http_buf_hold(http, c);
+        else mln_chain_pool_release(c);
+        *slice = 0;
+    }
+    if (c == NULL) return M_HTTP_RET_OK;
+
+    p = mln_http_scan(b->left_pos, b->last, '\n', '\n', '\n');
+    if (p < b->last && mln_http_buf_writable(b)) {
+        *line = b->left_pos;
+        *len = p - b->left_pos;
+        b->left_pos = p + 1;
+        *slice = 1;
+        return M_HTTP_RET_DONE;
+    }
+
+    n = p - b->left_pos;
+    if (p >= b->last) {
+        for (scan = c->next; scan != NULL; scan = scan->next) {
+            b = scan->buf;
+            if (b == NULL || b->in_file || mln_buf_left_size(b) <= 0) continue;
+            p = mln_http_scan(b->left_pos, b->last, '\n', '\n', '\n');
+            n += p - b->left_pos;
+            if (p < b->last) break;
         }
+        if (scan == NULL) return M_HTTP_RET_OK;
     }
 
-    for (last = buf + len - 1; last > buf; --last, --len) {
-        if (*last != 0) break;
+    if ((nc = mln_chain_new(pool)) == NULL) goto err1;
+    if ((nc->buf = nb = mln_buf_new(pool)) == NULL) goto err2;
+    if ((p = (mln_u8ptr_t)mln_alloc_m(pool, n + 1)) == NULL) goto err3;
+    nb->left_pos = nb->pos = nb->start = p;
+    nb->last = nb->end = p + n;
+    nb->in_memory = 1;
+    mln_http_buf_hold(http, nc);
+
+    for (size = n; ; ) {
+        c = *in;
+        b = c->buf;
+        if (b != NULL && !b->in_file && mln_buf_left_size(b) > 0) {
+            if (mln_buf_left_size(b) > size) {
+                memcpy(p, b->left_pos, size);
+                b->left_pos += size + 1;
+                break;
+            }
+            memcpy(p, b->left_pos, mln_buf_left_size(b));
+            p += mln_buf_left_size(b);
+            size -= mln_buf_left_size(b);
+            b->left_pos = b->last;
+        }
+        *in = c->next;
+        if (*slice) mln_http_buf_hold(http, c);
+        else mln_chain_pool_release(c);
+        *slice = 0;
     }
+
+    *line = nb->pos;
+    *len = n;
+    return M_HTTP_RET_DONE;
+
+err3:
+    mln_buf_pool_release(nb);
+err2:
+    mln_chain_pool_release(nc);
+err1:
+    mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+    return M_HTTP_RET_ERROR;
+}
+
+/*
+ * The head buffer of *in is referenced by tokens. Hold it if all of its
+ * data is consumed, otherwise it is still owned by the caller, so the
+ * tokens in it are copied out.
+ */
+static inline int mln_http_buf_keep(mln_http_t *http, mln_chain_t **in)
+{
+    struct mln_http_range_s range;
+    mln_chain_t *c = *in;
+    mln_buf_t *b = c->buf;
+
+    if (mln_buf_left_size(b) <= 0) {
+        *in = c->next;
+        mln_http_buf_hold(http, c);
+        return 0;
+    }
+
+    range.pool = mln_http_pool_get(http);
+    range.start = b->pos;
+    range.end = b->left_pos;
+    if (mln_http_relocate(&range, http->uri) < 0) return -1;
+    if (mln_http_relocate(&range, http->args) < 0) return -1;
+    if (mln_http_relocate(&range, http->response_msg) < 0) return -1;
+    return mln_hash_iterate(mln_http_header_get(http), mln_http_relocate_iterate_handler, &range);
+}
+
+static inline int mln_http_relocate(struct mln_http_range_s *range, mln_string_t *s)
+{
+    mln_u8ptr_t data;
+
+    if (s == NULL || !s->data_ref || s->data < range->start || s->data >= range->end)
+        return 0;
+    if ((data = (mln_u8ptr_t)mln_alloc_m(range->pool, s->len + 1)) == NULL)
+        return -1;
+    memcpy(data, s->data, s->len);
+    data[s->len] = 0;
+    s->data = data;
+    s->data_ref = 0;
+    return 0;
+}
+
+static int mln_http_relocate_iterate_handler(mln_hash_t *h, void *key, void *val, void *data)
+{
+    struct mln_http_range_s *range = (struct mln_http_range_s *)data;
+
+    if (mln_http_relocate(range, (mln_string_t *)key) < 0) return -1;
+    return mln_http_relocate(range, (mln_string_t *)val);
+}
+
+/*
+ * The byte following the token must have been examined.
+ */
+static inline mln_string_t *mln_http_slice(mln_alloc_t *pool, mln_u8ptr_t data, mln_size_t len)
+{
+    mln_string_t *s = (mln_string_t *)mln_alloc_m(pool, sizeof(mln_string_t));
+    if (s == NULL) return NULL;
+
+    data[len] = 0;
+    s->data = data;
+    s->len = len;
+    s->data_ref = 1;
+    s->pool = 1;
+    s->ref = 1;
+    return s;
+}
+
+static inline int mln_http_process_line(mln_http_t *http, mln_u8ptr_t buf, mln_size_t len)
+{
     if (len == 0 || (len == 1 && buf[0] == '\r')) {
-        mln_alloc_free(buf);
         mln_http_done_set(http, 1);
         return M_HTTP_RET_OK;
     }
 
-    if (buf[len-1] == '\r') {
-        buf[len-1] = 0;
-        --len;
-    }
-
-    if (type == M_HTTP_UNKNOWN) {
-        ret = mln_http_parse_headline(http, buf, len);
-    } else {
-        ret = mln_http_parse_field(http, buf, len);
-    }
+    if (buf[len-1] == '\r') --len;
 
-    mln_alloc_free(buf);
-
-    return ret;
+    if (mln_http_type_get(http) == M_HTTP_UNKNOWN)
+        return mln_http_parse_headline(http, buf, len);
+    return mln_http_parse_field(http, buf, len);
 }
 
 static inline int mln_http_parse_headline(mln_http_t *http, mln_u8ptr_t buf, mln_size_t len)
 {
-    mln_u8ptr_t p, end = buf + len, ques;
+    mln_u8ptr_t p, end = buf + len, uri, ques = NULL;
     mln_string_t tmp, *s, *scan, *send;
     mln_u32_t type, status = 0;
     mln_alloc_t *pool = mln_http_pool_get(http);
@@ -244,10 +401,7 @@ static inline int mln_http_parse_headline(mln_http_t *http, mln_u8ptr_t buf, mln
         mln_http_done_set(http, 1);
         return M_HTTP_RET_OK;
     }
-    for (p = buf; p < end; ++p) {
-        if (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t')
-            break;
-    }
+    p = mln_http_scan(buf, end, ' ', '\t', '\t');
     mln_string_nset(&tmp, buf, p-buf);
     send = http_version + sizeof(http_version)/sizeof(mln_string_t);
     for (scan = http_version; scan < send; ++scan) {
@@ -286,66 +440,47 @@ static inline int mln_http_parse_headline(mln_http_t *http, mln_u8ptr_t buf, mln
         }
         return M_HTTP_RET_ERROR;
     }
-    if (type == M_HTTP_REQUEST) {
-        for (ques = NULL, p = buf; p < end; ++p) {
-            if (ques == NULL && *p == (mln_u8_t)'?') ques = p;
-            if (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t')
-                break;
-        }
-        if (ques == NULL || ques+1 >= p) {
-            mln_string_nset(&tmp, buf, (ques == NULL)? p-buf: ques-buf);
-            s = mln_string_pool_dup(pool, &tmp);
-            if (s == NULL) {
-                mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-                return M_HTTP_RET_ERROR;
-            }
-            mln_http_uri_set(http, s);
-            mln_http_args_set(http, NULL);
-        } else {
-            mln_string_nset(&tmp, buf, ques-buf);
-            s = mln_string_pool_dup(pool, &tmp);
-            if (s == NULL) {
-                mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-                return M_HTTP_RET_ERROR;
-            }
-            mln_http_uri_set(http, s);
-            mln_string_nset(&tmp, ++ques, p - ques);
-            s = mln_string_pool_dup(pool, &tmp);
-            if (s == NULL) {
-                mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-                return M_HTTP_RET_ERROR;
-            }
-            mln_http_args_set(http, s);
-        }
-    } else {
-        for (p = buf; p < end; ++p) {
-            if (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t')
-                break;
-        }
+    if (type == M_HTTP_RESPONSE) {
+        p = mln_http_scan(buf, end, ' ', '\t', '\t');
         mln_string_nset(&tmp, buf, p-buf);
         if (mln_http_atou(&tmp, &status) == M_HTTP_RET_ERROR) {
             mln_http_error_set(http, M_HTTP_UNPARSEABLE_RESPONSE_HEADERS);
             return M_HTTP_RET_ERROR;
         }
         mln_http_status_set(http, status);
+
+        /*third*/
+        for (buf = p; buf < end; ++buf) {
+            if (*buf != (mln_u8_t)' ' && *buf != (mln_u8_t)'\t')
+                break;
+        }
+        if (buf >= end) {
+            mln_http_response_msg_set(http, NULL);
+            return M_HTTP_RET_OK;
+        }
+        if ((s = mln_http_slice(pool, buf, end-buf)) == NULL) {
+            mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+            return M_HTTP_RET_ERROR;
+        }
+        mln_http_response_msg_set(http, s);
+        return M_HTTP_RET_OK;
+    }
+
+    uri = buf;
+    p = mln_http_scan(buf, end, ' ', '\t', '?');
+    if (p < end && *p == (mln_u8_t)'?') {
+        ques = p;
+        p = mln_http_scan(p + 1, end, ' ', '\t', '\t');
     }
-    buf = p;
 
     /*third*/
-    for (; buf < end; ++buf) {
+    for (buf = p; buf < end; ++buf) {
         if (*buf != (mln_u8_t)' ' && *buf != (mln_u8_t)'\t')
             break;
     }
     if (buf >= end) {
-        if (type == M_HTTP_REQUEST) {
-            mln_http_version_set(http, M_HTTP_VERSION_1_0);
-        } else {
-            mln_http_response_msg_set(http, NULL);
-        }
-        return M_HTTP_RET_OK;
-    }
-
-    if (type == M_HTTP_REQUEST) {
+        mln_http_version_set(http, M_HTTP_VERSION_1_0);
+    } else {
         mln_string_nset(&tmp, buf, end-buf);
         send = http_version + sizeof(http_version)/sizeof(mln_string_t);
         for (scan = http_version; scan < send; ++scan) {
@@ -357,22 +492,38 @@ static inline int mln_http_parse_headline(mln_http_t *http, mln_u8ptr_t buf, mln
             return M_HTTP_RET_ERROR;
         }
         mln_http_version_set(http, scan - http_version);
-        return M_HTTP_RET_OK;
     }
-    mln_string_nset(&tmp, buf, end-buf);
-    s = mln_string_pool_dup(pool, &tmp);
-    if (s == NULL) {
-        mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-        return M_HTTP_RET_ERROR;
+
+    /*the delimiters are overwritten, so slice after all parts are parsed*/
+    if (ques == NULL || ques+1 >= p) {
+        s = mln_http_slice(pool, uri, (ques == NULL)? p-uri: ques-uri);
+        if (s == NULL) {
+            mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+            return M_HTTP_RET_ERROR;
+        }
+        mln_http_uri_set(http, s);
+        mln_http_args_set(http, NULL);
+    } else {
+        s = mln_http_slice(pool, uri, ques-uri);
+        if (s == NULL) {
+            mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+            return M_HTTP_RET_ERROR;
+        }
+        mln_http_uri_set(http, s);
+        s = mln_http_slice(pool, ques+1, p-ques-1);
+        if (s == NULL) {
+            mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+            return M_HTTP_RET_ERROR;
+        }
+        mln_http_args_set(http, s);
     }
-    mln_http_response_msg_set(http, s);
     return M_HTTP_RET_OK;
 }
 
 static inline int mln_http_parse_field(mln_http_t *http, mln_u8ptr_t buf, mln_size_t len)
 {
-    mln_u8ptr_t p, end = buf + len;
-    mln_string_t tmp, *s, *v;
+    mln_u8ptr_t p, end = buf + len, name;
+    mln_string_t *s, *v = NULL;
     mln_alloc_t *pool = mln_http_pool_get(http);
     mln_u32_t type = mln_http_type_get(http);
     mln_hash_t *header_fields = mln_http_header_get(http);
@@ -386,24 +537,9 @@ static inline int mln_http_parse_field(mln_http_t *http, mln_u8ptr_t buf, mln_si
         mln_http_done_set(http, 1);
         return M_HTTP_RET_OK;
     }
-    for (p = buf; p < end; ++p) {
-        if (*p == (mln_u8_t)' ' || *p == (mln_u8_t)'\t' || *p == (mln_u8_t)':')
-            break;
-    }
-    if (p - buf <= 0) {
-        if (type == M_HTTP_REQUEST) {
-            mln_http_error_set(http, M_HTTP_BAD_REQUEST);
-        } else {
-            mln_http_error_set(http, M_HTTP_UNPARSEABLE_RESPONSE_HEADERS);
-        }
-        return M_HTTP_RET_ERROR;
-    }
-    mln_string_nset(&tmp, buf, p-buf);
-    s = mln_string_pool_dup(pool, &tmp);
-    if (s == NULL) {
-        mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-        return M_HTTP_RET_ERROR;
-    }
+    name = buf;
+    p = mln_http_scan(buf, end, ' ', '\t', ':');
+    if (p - buf <= 0) goto err;
     buf = p;
 
     /* : */
@@ -411,41 +547,22 @@ static inline int mln_http_parse_field(mln_http_t *http, mln_u8ptr_t buf, mln_si
         if (*buf != (mln_u8_t)' ' && *buf != (mln_u8_t)'\t')
             break;
     }
-    if (buf >= end) {
-        if (mln_hash_insert(header_fields, s, NULL) < 0) {
-            mln_string_free(s);
-            mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-            return M_HTTP_RET_ERROR;
-        }
-        return M_HTTP_RET_OK;
-    }
-    if (buf[0] != (mln_u8_t)':') {
-        mln_string_free(s);
-        if (type == M_HTTP_REQUEST) {
-            mln_http_error_set(http, M_HTTP_BAD_REQUEST);
-        } else {
-            mln_http_error_set(http, M_HTTP_UNPARSEABLE_RESPONSE_HEADERS);
+    if (buf < end) {
+        if (buf[0] != (mln_u8_t)':') goto err;
+        ++buf;
+
+        /*field value*/
+        for (; buf < end; ++buf) {
+            if (*buf != (mln_u8_t)' ' && *buf != (mln_u8_t)'\t')
+                break;
         }
-        return M_HTTP_RET_ERROR;
     }
-    ++buf;
 
-    /*field value*/
-    for (; buf < end; ++buf) {
-        if (*buf != (mln_u8_t)' ' && *buf != (mln_u8_t)'\t')
-            break;
-    }
-    if (buf >= end) {
-        if (mln_hash_insert(header_fields, s, NULL) < 0) {
-            mln_string_free(s);
-            mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
-            return M_HTTP_RET_ERROR;
-        }
-        return M_HTTP_RET_OK;
+    if ((s = mln_http_slice(pool, name, p-name)) == NULL) {
+        mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
+        return M_HTTP_RET_ERROR;
     }
-    mln_string_nset(&tmp, buf, end-buf);
-    v = mln_string_pool_dup(pool, &tmp);
-    if (v == NULL) {
+    if (buf < end && (v = mln_http_slice(pool, buf, end-buf)) == NULL) {
         mln_string_free(s);
         mln_http_error_set(http, M_HTTP_INTERNAL_SERVER_ERROR);
         return M_HTTP_RET_ERROR;
@@ -458,6 +575,14 @@ static inline int mln_http_parse_field(mln_http_t *http, mln_u8ptr_t buf, mln_si
     }
 
     return M_HTTP_RET_OK;
+
+err:
+    if (type == M_HTTP_REQUEST) {
+        mln_http_error_set(http, M_HTTP_BAD_REQUEST);
+    } else {
+        mln_http_error_set(http, M_HTTP_UNPARSEABLE_RESPONSE_HEADERS);
+    }
+    return M_HTTP_RET_ERROR;
 }
 
 int mln_http_generate(mln_http_t *http, mln_chain_t **out_head, mln_chain_t **out_tail)
@@ -892,12 +1017,15 @@ mln_http_t *mln_http_init(mln_tcp_conn_t *connection, void *data, mln_http_handl
     hattr.len_base = M_HTTP_HASH_LEN;
     hattr.expandable = 0;
     hattr.calc_prime = 0;
+    hattr.incremental = 0;
+    hattr.full_hash = 0;
     http->header_fields = mln_hash_new(&hattr);
     if (http->header_fields == NULL) {
         mln_alloc_free(http);
         return NULL;
     }
     http->body_head = http->body_tail = NULL;
+    http->hold_head = http->hold_tail = NULL;
     http->body_handler = body_handler;
     http->data = data;
     http->uri = NULL;
@@ -923,6 +1051,9 @@ void mln_http_destroy(mln_http_t *http)
     if (http->body_head != NULL) {
         mln_chain_pool_release_all(http->body_head);
     }
+    if (http->hold_head != NULL) {
+        mln_chain_pool_release_all(http->hold_head);
+    }
     if (http->uri != NULL) {
         mln_string_free(http->uri);
     }
@@ -947,6 +1078,10 @@ void mln_http_reset(mln_http_t *http)
         mln_chain_pool_release_all(http->body_head);
         http->body_head = http->body_tail = NULL;
     }
+    if (http->hold_head != NULL) {
+        mln_chain_pool_release_all(http->hold_head);
+        http->hold_head = http->hold_tail = NULL;
+    }
     if (http->uri != NULL) {
         mln_string_free(http->uri);
         http->uri = NULL;
@@ -12,24 +12,38 @@
 #if defined(WIN32)
 #include <winsock2.h>
 #else
+#include <unistd.h>
 #include <sys/socket.h>
 #endif
+#if defined(MLN_EVENTFD)
+#include <sys/eventfd.h>
+#endif
 
 static inline void mln_iothread_fd_nonblock_set(int fd);
 static inline mln_iothread_msg_t *mln_iothread_msg_new(mln_u32_t type, void *data, int feedback);
 static inline void mln_iothread_msg_free(mln_iothread_msg_t *msg);
-MLN_CHAIN_FUNC_DECLARE(mln_iothread_msg, mln_iothread_msg_t, static inline void,);
-MLN_CHAIN_FUNC_DEFINE(mln_iothread_msg, mln_iothread_msg_t, static inline void, prev, next);
+static inline void mln_iothread_notify(mln_iothread_t *t, mln_iothread_ep_type_t to);
+static inline void mln_iothread_notify_clear(mln_iothread_t *t, mln_iothread_ep_type_t from);
 
 int mln_iothread_init(mln_iothread_t *t, struct mln_iothread_attr *attr)
 {
     mln_u32_t i;
-    int fds[2];
 
     if (!attr->nthread || attr->entry == NULL) {
         return -1;
     }
 
+#if defined(MLN_EVENTFD)
+    if ((t->io_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        return -1;
+    }
+    if ((t->user_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        mln_socket_close(t->io_fd);
+        return -1;
+    }
+#else
+    int fds[2];
+
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
         return -1;
     }
@@ -37,18 +51,17 @@ int mln_iothread_init(mln_iothread_t *t, struct mln_iothread_attr *attr)
     t->user_fd = fds[1];
     mln_iothread_fd_nonblock_set(t->io_fd);
     mln_iothread_fd_nonblock_set(t->user_fd);
+#endif
     t->entry = attr->entry;
     t->args = attr->args;
     t->handler = attr->handler;
-    pthread_mutex_init(&(t->io_lock), NULL);
-    pthread_mutex_init(&(t->user_lock), NULL);
-    t->io_head = t->io_tail = NULL;
-    t->user_head = t->user_tail = NULL;
+    t->io_head = NULL;
+    t->user_head = NULL;
     t->nthread = attr->nthread;
 
     if ((t->tids = (pthread_t *)calloc(t->nthread, sizeof(pthread_t))) == NULL) {
-        mln_socket_close(fds[0]);
-        mln_socket_close(fds[1]);
+        mln_socket_close(t->io_fd);
+        mln_socket_close(t->user_fd);
         return -1;
     }
     for (i = 0; i < t->nthread; ++i) {
@@ -82,22 +95,8 @@ void mln_iothread_destroy(mln_iothread_t *t)
 
 int mln_iothread_send(mln_iothread_t *t, mln_u32_t type, void *data, mln_iothread_ep_type_t to, mln_u32_t feedback)
 {
-    int fd;
-    pthread_mutex_t *plock;
-    mln_iothread_msg_t *msg;
-    mln_iothread_msg_t **head, **tail;
-
-    if (to == io_thread) {
-        fd = t->user_fd;
-        plock = &(t->io_lock);
-        head = &(t->io_head);
-        tail = &(t->io_tail);
-    } else {
-        fd = t->io_fd;
-        plock = &(t->user_lock);
-        head = &(t->user_head);
-        tail = &(t->user_tail);
-    }
+    mln_iothread_msg_t *msg, *old;
+    mln_iothread_msg_t **head = to == io_thread? &(t->io_head): &(t->user_head);
 
     if ((msg = mln_iothread_msg_new(type, data, feedback)) == NULL)
         return -1;
@@ -105,19 +104,17 @@ int mln_iothread_send(mln_iothread_t *t, mln_u32_t type, void *data, mln_iothrea
     if (feedback)
         pthread_mutex_lock(&(msg->mutex));
 
-    pthread_mutex_lock(plock);
-
-    mln_iothread_msg_chain_add(head, tail, msg);
-
-    if (*head == *tail && *head == msg && send(fd, " ", 1, 0) != 1) {
-        mln_iothread_msg_chain_del(head, tail, msg);
-        if (feedback) pthread_mutex_unlock(&(msg->mutex));
-        pthread_mutex_unlock(plock);
-        mln_iothread_msg_free(msg);
-        return 1;
-    }
+    old = __atomic_load_n(head, __ATOMIC_RELAXED);
+    do {
+        msg->next = old;
+    } while (!__atomic_compare_exchange_n(head, &old, msg, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 
-    pthread_mutex_unlock(plock);
+    /*
+     * If the stack was not empty, the receiver has been notified and has not
+     * taken the stack yet, so it will see this message as well.
+     */
+    if (old == NULL)
+        mln_iothread_notify(t, to);
 
     if (feedback) {
         pthread_mutex_lock(&(msg->mutex));
@@ -130,29 +127,25 @@ int mln_iothread_send(mln_iothread_t *t, mln_u32_t type, void *data, mln_iothrea
 
 int mln_iothread_recv(mln_iothread_t *t, mln_iothread_ep_type_t from)
 {
-    int fd, n = 0;
-    mln_s8_t c;
-    pthread_mutex_t *plock;
-    mln_iothread_msg_t *msg, *pos;
-    mln_iothread_msg_t **head, **tail;
-
-    if (from == io_thread) {
-        fd = t->user_fd;
-        plock = &(t->user_lock);
-        head = &(t->user_head);
-        tail = &(t->user_tail);
-    } else {
-        fd = t->io_fd;
-        plock = &(t->io_lock);
-        head = &(t->io_head);
-        tail = &(t->io_tail);
+    int n = 0;
+    mln_iothread_msg_t *msg, *next, *list = NULL;
+    mln_iothread_msg_t **head = from == io_thread? &(t->user_head): &(t->io_head);
+
+    /*
+     * Clear the notification before taking the stack, a message pushed after
+     * the stack is taken will notify again.
+     */
+    mln_iothread_notify_clear(t, from);
+
+    msg = __atomic_exchange_n(head, NULL, __ATOMIC_ACQUIRE);
+    for (; msg != NULL; msg = next) {
+        next = msg->next;
+        msg->next = list;
+        list = msg;
     }
 
-    pthread_mutex_lock(plock);
-
-    pos = *head;
-    while ((msg = *head) != NULL) {
-        mln_iothread_msg_chain_del(head, tail, msg);
+    for (msg = list; msg != NULL; msg = next) {
+        next = msg->next;
         if (t->handler != NULL)
             t->handler(t, from, msg);
         if (msg->feedback) {
@@ -164,12 +157,35 @@ int mln_iothread_recv(mln_iothread_t *t, mln_iothread_ep_type_t from)
         ++n;
     }
 
-    if (pos != *head)
-        (void)recv(fd, &c, 1, 0);
+    return n;
+}
 
-    pthread_mutex_unlock(plock);
+/*
+ * The file descriptor that the receiver watches is the same in both modes:
+ * io_fd for the I/O threads and user_fd for the user thread.
+ * A failed write can be ignored, the descriptor is readable already.
+ */
+static inline void mln_iothread_notify(mln_iothread_t *t, mln_iothread_ep_type_t to)
+{
+#if defined(MLN_EVENTFD)
+    mln_u64_t v = 1;
+    (void)!write(to == io_thread? t->io_fd: t->user_fd, &v, sizeof(v));
+#else
+    (void)send(to == io_thread? t->user_fd: t->io_fd, " ", 1, 0);
+#endif
+}
 
-    return n;
+static inline void mln_iothread_notify_clear(mln_iothread_t *t, mln_iothread_ep_type_t from)
+{
+    int fd = from == io_thread? t->user_fd: t->io_fd;
+#if defined(MLN_EVENTFD)
+    mln_u64_t v;
+    (void)!read(fd, &v, sizeof(v));
+#else
+    mln_s8_t buf[64];
+    while (recv(fd, (char *)buf, sizeof(buf), 0) == sizeof(buf))
+        ;
+#endif
 }
 
 
@@ -183,7 +199,7 @@ static inline mln_iothread_msg_t *mln_iothread_msg_new(mln_u32_t type, void *dat
     msg->hold = 0;
     msg->type = type;
     msg->data = data;
-    msg->prev = msg->next = NULL;
+    msg->next = NULL;
 
     if (feedback && pthread_mutex_init(&(msg->mutex), NULL) != 0) {
         free(msg);
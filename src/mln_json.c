@@ -47,12 +47,20 @@ static inline int __mln_json_array_append(mln_json_t *j, mln_json_t *value);
 static inline int mln_json_object_iterator(mln_rbtree_node_t *node, void *data);
 
 
-static inline int mln_json_kv_cmp(const mln_json_kv_t *kv1, const mln_json_kv_t *kv2)
+#define mln_json_kv_entry(rn) mln_rbtree_entry(rn, mln_json_kv_t, node)
+
+static inline int mln_json_kv_cmp(mln_rbtree_node_t *n1, mln_rbtree_node_t *n2)
 {
+    mln_json_kv_t *kv1 = mln_json_kv_entry(n1), *kv2 = mln_json_kv_entry(n2);
     ASSERT(mln_json_is_string(&(kv1->key)) && mln_json_is_string(&(kv2->key)));
     return mln_string_strcmp(mln_json_string_data_get(&(kv1->key)), mln_json_string_data_get(&(kv2->key)));
 }
 
+static inline int mln_json_key_cmp(mln_string_t *key, mln_rbtree_node_t *n)
+{
+    return mln_string_strcmp(key, mln_json_string_data_get(&(mln_json_kv_entry(n)->key)));
+}
+
 static inline void mln_json_kv_free(mln_json_kv_t *kv)
 {
     if (kv == NULL) return;
@@ -78,12 +86,11 @@ int mln_json_obj_update(mln_json_t *j, mln_json_t *key, mln_json_t *val)
 static inline int __mln_json_obj_update(mln_json_t *j, mln_json_t *key, mln_json_t *val)
 {
     mln_rbtree_node_t *rn;
-    mln_json_kv_t kv, *pkv;
+    mln_json_kv_t *pkv;
 
     if (!mln_json_is_string(key) || !mln_json_is_object(j)) return -1;
 
-    kv.key = *key;
-    rn = mln_rbtree_inline_search(mln_json_object_data_get(j), &kv, mln_json_kv_cmp);
+    rn = mln_rbtree_inline_node_search(mln_json_object_data_get(j), mln_json_string_data_get(key), mln_json_key_cmp);
     if (mln_rbtree_null(rn, mln_json_object_data_get(j))) {
         pkv = (mln_json_kv_t *)malloc(sizeof(mln_json_kv_t));
         if (pkv == NULL) return -1;
@@ -91,9 +98,9 @@ static inline int __mln_json_obj_update(mln_json_t *j, mln_json_t *key, mln_json
         pkv->key = *key;
         pkv->val = *val;
         rn = mln_rbtree_node_init(&pkv->node, pkv);
-        mln_rbtree_inline_insert(mln_json_object_data_get(j), rn, mln_json_kv_cmp);
+        mln_rbtree_inline_node_insert(mln_json_object_data_get(j), rn, mln_json_kv_cmp);
     } else {
-        pkv = (mln_json_kv_t *)mln_rbtree_node_data_get(rn);
+        pkv = mln_json_kv_entry(rn);
         mln_json_destroy(&(pkv->key));
         mln_json_destroy(&(pkv->val));
         pkv->key = *key;
@@ -108,25 +115,21 @@ mln_json_t *mln_json_obj_search(mln_json_t *j, mln_string_t *key)
     if (!mln_json_is_object(j)) return NULL;
 
     mln_rbtree_node_t *rn;
-    mln_json_kv_t kv;
 
-    mln_json_string_init(&(kv.key), key);
-    rn = mln_rbtree_inline_search(mln_json_object_data_get(j), &kv, mln_json_kv_cmp);
+    rn = mln_rbtree_inline_node_search(mln_json_object_data_get(j), key, mln_json_key_cmp);
     if (mln_rbtree_null(rn, mln_json_object_data_get(j))) {
         return NULL;
     }
-    return &(((mln_json_kv_t *)mln_rbtree_node_data_get(rn))->val);
+    return &(mln_json_kv_entry(rn)->val);
 }
 
 void mln_json_obj_remove(mln_json_t *j, mln_string_t *key)
 {
     if (!mln_json_is_object(j)) return;
 
-    mln_json_kv_t kv;
     mln_rbtree_node_t *rn;
 
-    mln_json_string_init(&(kv.key), key);
-    rn = mln_rbtree_inline_search(mln_json_object_data_get(j), &kv, mln_json_kv_cmp);
+    rn = mln_rbtree_inline_node_search(mln_json_object_data_get(j), key, mln_json_key_cmp);
     if (mln_rbtree_null(rn, mln_json_object_data_get(j))) {
         return;
     }
@@ -0,0 +1,276 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#include <stdlib.h>
+#if defined(WIN32)
+#include <malloc.h>
+#endif
+#include "mln_ring.h"
+
+static inline void *mln_ring_alloc(mln_size_t size)
+{
+#if defined(WIN32)
+    return _aligned_malloc(size, M_RING_CACHELINE);
+#else
+    void *p;
+
+    if (posix_memalign(&p, M_RING_CACHELINE, size)) return NULL;
+    return p;
+#endif
+}
+
+static inline void mln_ring_dealloc(void *p)
+{
+#if defined(WIN32)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static inline mln_uauto_t mln_ring_len(mln_uauto_t qlen)
+{
+    mln_uauto_t len = 1;
+
+    while (len < qlen) len <<= 1;
+    return len;
+}
+
+/*
+ * spsc
+ */
+mln_ring_spsc_t *mln_ring_spsc_new(struct mln_ring_attr *attr)
+{
+    mln_ring_spsc_t *q;
+    mln_uauto_t len = mln_ring_len(attr->qlen);
+
+    if ((q = (mln_ring_spsc_t *)mln_ring_alloc(sizeof(mln_ring_spsc_t))) == NULL) return NULL;
+    if ((q->buf = (void **)calloc(len, sizeof(void *))) == NULL) {
+        mln_ring_dealloc(q);
+        return NULL;
+    }
+    q->head = q->tail_cache = 0;
+    q->tail = q->head_cache = 0;
+    q->mask = len - 1;
+    q->free_handler = attr->free_handler;
+    return q;
+}
+
+void mln_ring_spsc_free(mln_ring_spsc_t *q)
+{
+    if (q == NULL) return;
+
+    if (q->free_handler != NULL) {
+        for (; q->head != q->tail; ++(q->head))
+            q->free_handler(q->buf[q->head & q->mask]);
+    }
+    free(q->buf);
+    mln_ring_dealloc(q);
+}
+
+/*
+ * The producer only reloads head when the cached one says the queue is
+ * full, and the consumer only reloads tail when the cached one says it is
+ * empty, so the other side's cache line is seldom touched.
+ */
+int mln_ring_spsc_enqueue(mln_ring_spsc_t *q, void *data)
+{
+    mln_uauto_t tail = q->tail;
+
+    if (tail - q->head_cache > q->mask) {
+        q->head_cache = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
+        if (tail - q->head_cache > q->mask) return -1;
+    }
+    q->buf[tail & q->mask] = data;
+    __atomic_store_n(&(q->tail), tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int mln_ring_spsc_dequeue(mln_ring_spsc_t *q, void **data)
+{
+    mln_uauto_t head = q->head;
+
+    if (head == q->tail_cache) {
+        q->tail_cache = __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE);
+        if (head == q->tail_cache) return -1;
+    }
+    *data = q->buf[head & q->mask];
+    __atomic_store_n(&(q->head), head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+mln_uauto_t mln_ring_spsc_enqueue_bulk(mln_ring_spsc_t *q, void **data, mln_uauto_t n)
+{
+    mln_uauto_t tail = q->tail, room, i;
+
+    room = q->mask + 1 - (tail - q->head_cache);
+    if (room < n) {
+        q->head_cache = __atomic_load_n(&(q->head), __ATOMIC_ACQUIRE);
+        room = q->mask + 1 - (tail - q->head_cache);
+        if (n > room) n = room;
+    }
+    for (i = 0; i < n; ++i)
+        q->buf[(tail + i) & q->mask] = data[i];
+    if (n) __atomic_store_n(&(q->tail), tail + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+mln_uauto_t mln_ring_spsc_dequeue_bulk(mln_ring_spsc_t *q, void **data, mln_uauto_t n)
+{
+    mln_uauto_t head = q->head, avail, i;
+
+    avail = q->tail_cache - head;
+    if (avail < n) {
+        q->tail_cache = __atomic_load_n(&(q->tail), __ATOMIC_ACQUIRE);
+        avail = q->tail_cache - head;
+        if (n > avail) n = avail;
+    }
+    for (i = 0; i < n; ++i)
+        data[i] = q->buf[(head + i) & q->mask];
+    if (n) __atomic_store_n(&(q->head), head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/*
+ * mpmc
+ * The sequence number of a slot is its index when it is free for the
+ * producer of that lap, and index + 1 when it is filled for the consumer.
+ * A consumer sets it to index + length after taking the data out.
+ */
+mln_ring_mpmc_t *mln_ring_mpmc_new(struct mln_ring_attr *attr)
+{
+    mln_ring_mpmc_t *q;
+    mln_uauto_t i, len = mln_ring_len(attr->qlen);
+
+    if ((q = (mln_ring_mpmc_t *)mln_ring_alloc(sizeof(mln_ring_mpmc_t))) == NULL) return NULL;
+    if ((q->cells = (mln_ring_cell_t *)malloc(len * sizeof(mln_ring_cell_t))) == NULL) {
+        mln_ring_dealloc(q);
+        return NULL;
+    }
+    for (i = 0; i < len; ++i) {
+        q->cells[i].seq = i;
+        q->cells[i].data = NULL;
+    }
+    q->head = q->tail = 0;
+    q->mask = len - 1;
+    q->free_handler = attr->free_handler;
+    return q;
+}
+
+void mln_ring_mpmc_free(mln_ring_mpmc_t *q)
+{
+    if (q == NULL) return;
+
+    if (q->free_handler != NULL) {
+        for (; q->head != q->tail; ++(q->head))
+            q->free_handler(q->cells[q->head & q->mask].data);
+    }
+    free(q->cells);
+    mln_ring_dealloc(q);
+}
+
+int mln_ring_mpmc_enqueue(mln_ring_mpmc_t *q, void *data)
+{
+    mln_ring_cell_t *cell;
+    mln_uauto_t pos = __atomic_load_n(&(q->tail), __ATOMIC_RELAXED);
+    mln_sauto_t dif;
+
+    while (1) {
+        cell = &(q->cells[pos & q->mask]);
+        dif = (mln_sauto_t)(__atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&(q->tail), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&(q->tail), __ATOMIC_RELAXED);
+        }
+    }
+    cell->data = data;
+    __atomic_store_n(&(cell->seq), pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int mln_ring_mpmc_dequeue(mln_ring_mpmc_t *q, void **data)
+{
+    mln_ring_cell_t *cell;
+    mln_uauto_t pos = __atomic_load_n(&(q->head), __ATOMIC_RELAXED);
+    mln_sauto_t dif;
+
+    while (1) {
+        cell = &(q->cells[pos & q->mask]);
+        dif = (mln_sauto_t)(__atomic_load_n(&(cell->seq), __ATOMIC_ACQUIRE) - (pos + 1));
+        if (dif == 0) {
+            if (__atomic_compare_exchange_n(&(q->head), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (dif < 0) {
+            return -1;
+        } else {
+            pos = __atomic_load_n(&(q->head), __ATOMIC_RELAXED);
+        }
+    }
+    *data = cell->data;
+    __atomic_store_n(&(cell->seq), pos + q->mask + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * Reserve the free slots in a row from tail with one CAS. A slot seen free
+ * stays free until its producer fills it, and that producer must be us
+ * once the CAS succeeds.
+ */
+mln_uauto_t mln_ring_mpmc_enqueue_bulk(mln_ring_mpmc_t *q, void **data, mln_uauto_t n)
+{
+    mln_uauto_t pos = __atomic_load_n(&(q->tail), __ATOMIC_RELAXED), seq, i, k;
+
+    if (n == 0) return 0;
+    while (1) {
+        for (k = 0; k < n; ++k) {
+            seq = __atomic_load_n(&(q->cells[(pos + k) & q->mask].seq), __ATOMIC_ACQUIRE);
+            if (seq != pos + k) break;
+        }
+        if (k == 0) {
+            if ((mln_sauto_t)(seq - pos) < 0) return 0;
+            pos = __atomic_load_n(&(q->tail), __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&(q->tail), &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+    for (i = 0; i < k; ++i) {
+        q->cells[(pos + i) & q->mask].data = data[i];
+        __atomic_store_n(&(q->cells[(pos + i) & q->mask].seq), pos + i + 1, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
+mln_uauto_t mln_ring_mpmc_dequeue_bulk(mln_ring_mpmc_t *q, void **data, mln_uauto_t n)
+{
+    mln_uauto_t pos = __atomic_load_n(&(q->head), __ATOMIC_RELAXED), seq, i, k;
+    mln_ring_cell_t *cell;
+
+    if (n == 0) return 0;
+    while (1) {
+        for (k = 0; k < n; ++k) {
+            seq = __atomic_load_n(&(q->cells[(pos + k) & q->mask].seq), __ATOMIC_ACQUIRE);
+            if (seq != pos + k + 1) break;
+        }
+        if (k == 0) {
+            if ((mln_sauto_t)(seq - (pos + 1)) < 0) return 0;
+            pos = __atomic_load_n(&(q->head), __ATOMIC_RELAXED);
+            continue;
+        }
+        if (__atomic_compare_exchange_n(&(q->head), &pos, pos + k, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+    for (i = 0; i < k; ++i) {
+        cell = &(q->cells[(pos + i) & q->mask]);
+        data[i] = cell->data;
+        __atomic_store_n(&(cell->seq), pos + i + q->mask + 1, __ATOMIC_RELEASE);
+    }
+    return k;
+}
+
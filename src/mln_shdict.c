@@ -0,0 +1,389 @@
+
+/*
+ * Copyright (C) Niklaus F.Schen.
+ */
+
+#include <string.h>
+#include <sys/time.h>
+#include "mln_shdict.h"
+
+#define mln_shdict_ptr(d,off)   ((off)? (void *)((mln_u8ptr_t)((d)->pool) + (off)): NULL)
+#define mln_shdict_off(d,ptr)   ((ptr) != NULL? (mln_u64_t)((mln_u8ptr_t)(ptr) - (mln_u8ptr_t)((d)->pool)): 0)
+#define mln_shdict_key(e)       ((mln_u8ptr_t)(e) + sizeof(mln_shdict_entry_t))
+#define mln_shdict_val(e)       (mln_shdict_key(e) + (e)->klen)
+#define mln_shdict_bucket(d,h)  ((mln_shdict_bucket_t *)mln_shdict_ptr((d), (d)->buckets) + ((h) & (d)->mask))
+
+static int mln_shdict_spin_lock(void *lock)
+{
+    mln_spin_lock((mln_spin_t *)lock);
+    return 0;
+}
+
+static int mln_shdict_spin_unlock(void *lock)
+{
+    mln_spin_unlock((mln_spin_t *)lock);
+    return 0;
+}
+
+mln_shdict_t *mln_shdict_new(struct mln_shdict_attr *attr)
+{
+    mln_alloc_t *pool;
+    mln_shdict_t *d;
+    mln_shdict_bucket_t *b;
+    mln_u64_t n = 1, i;
+    struct mln_alloc_shm_attr_s sattr;
+
+    sattr.size = attr->size;
+    sattr.locker = &n;/*replaced by &(d->alloc_lock) below*/
+    sattr.lock = attr->lock != NULL? attr->lock: mln_shdict_spin_lock;
+    sattr.unlock = attr->unlock != NULL? attr->unlock: mln_shdict_spin_unlock;
+    if ((pool = mln_alloc_shm_init(&sattr)) == NULL) return NULL;
+
+    if ((d = (mln_shdict_t *)mln_alloc_m(pool, sizeof(mln_shdict_t))) == NULL) {
+        mln_alloc_destroy(pool);
+        return NULL;
+    }
+    while (n < (attr->nbucket? attr->nbucket: M_SHDICT_DFL_BUCKETS)) n <<= 1;
+    if ((b = (mln_shdict_bucket_t *)mln_alloc_m(pool, n * sizeof(mln_shdict_bucket_t))) == NULL) {
+        mln_alloc_destroy(pool);
+        return NULL;
+    }
+    for (i = 0; i < n; ++i) {
+        mln_spin_init(&(b[i].lock));
+        b[i].head = b[i].tail = 0;
+    }
+
+    d->pool = pool;
+    d->lock = sattr.lock;
+    d->unlock = sattr.unlock;
+    mln_spin_init(&(d->alloc_lock));
+    d->mask = n - 1;
+    d->buckets = mln_shdict_off(d, b);
+    d->hand = 0;
+    d->nr = 0;
+    pool->locker = &(d->alloc_lock);
+    return d;
+}
+
+void mln_shdict_free(mln_shdict_t *d)
+{
+    if (d == NULL) return;
+    mln_alloc_destroy(d->pool);
+}
+
+/*
+ * internal
+ */
+static inline mln_u64_t mln_shdict_hash(void *key, mln_u32_t klen)
+{
+    mln_u8ptr_t p = (mln_u8ptr_t)key, end = p + klen;
+    mln_u64_t h = 0xcbf29ce484222325ULL;
+
+    for (; p < end; ++p) {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 29;
+    return h;
+}
+
+static inline mln_u64_t mln_shdict_now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (mln_u64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static inline int mln_shdict_expired(mln_shdict_entry_t *e, mln_u64_t now)
+{
+    return e->expire && e->expire <= now;
+}
+
+static inline mln_shdict_entry_t *
+mln_shdict_alloc(mln_shdict_t *d, mln_size_t size)
+{
+    mln_shdict_entry_t *e;
+
+    (void)d->lock(&(d->alloc_lock));
+    e = (mln_shdict_entry_t *)mln_alloc_m(d->pool, size);
+    (void)d->unlock(&(d->alloc_lock));
+    return e;
+}
+
+static inline void mln_shdict_dealloc(mln_shdict_t *d, mln_shdict_entry_t *e)
+{
+    (void)d->lock(&(d->alloc_lock));
+    mln_alloc_free(e);
+    (void)d->unlock(&(d->alloc_lock));
+}
+
+static inline mln_shdict_entry_t *
+mln_shdict_find(mln_shdict_t *d, mln_shdict_bucket_t *b, void *key, mln_u32_t klen, mln_u64_t hval)
+{
+    mln_shdict_entry_t *e;
+
+    for (e = mln_shdict_ptr(d, b->head); e != NULL; e = mln_shdict_ptr(d, e->next)) {
+        if (e->hval == hval && e->klen == klen && !memcmp(mln_shdict_key(e), key, klen))
+            return e;
+    }
+    return NULL;
+}
+
+static inline void
+mln_shdict_unlink(mln_shdict_t *d, mln_shdict_bucket_t *b, mln_shdict_entry_t *e)
+{
+    mln_shdict_entry_t *prev = mln_shdict_ptr(d, e->prev), *next = mln_shdict_ptr(d, e->next);
+
+    if (prev != NULL) prev->next = e->next;
+    else b->head = e->next;
+    if (next != NULL) next->prev = e->prev;
+    else b->tail = e->prev;
+    e->prev = e->next = 0;
+}
+
+static inline void
+mln_shdict_link_head(mln_shdict_t *d, mln_shdict_bucket_t *b, mln_shdict_entry_t *e)
+{
+    mln_u64_t off = mln_shdict_off(d, e);
+    mln_shdict_entry_t *head = mln_shdict_ptr(d, b->head);
+
+    e->prev = 0;
+    e->next = b->head;
+    if (head != NULL) head->prev = off;
+    else b->tail = off;
+    b->head = off;
+}
+
+static inline void
+mln_shdict_touch(mln_shdict_t *d, mln_shdict_bucket_t *b, mln_shdict_entry_t *e)
+{
+    if (b->head == mln_shdict_off(d, e)) return;
+    mln_shdict_unlink(d, b, e);
+    mln_shdict_link_head(d, b, e);
+}
+
+/*
+ * Remove the expired entries of a bucket, or its least recently used one
+ * if none is expired. The entries are chained by 'next' into the list
+ * returned, and freed by the caller after the bucket is unlocked.
+ */
+static mln_shdict_entry_t *
+mln_shdict_bucket_evict(mln_shdict_t *d, mln_shdict_bucket_t *b, mln_u64_t now, int lru, mln_u64_t *n)
+{
+    mln_shdict_entry_t *e, *prev, *list = NULL;
+
+    for (e = mln_shdict_ptr(d, b->tail); e != NULL; e = prev) {
+        prev = mln_shdict_ptr(d, e->prev);
+        if (!mln_shdict_expired(e, now)) continue;
+        mln_shdict_unlink(d, b, e);
+        e->next = mln_shdict_off(d, list);
+        list = e;
+        ++(*n);
+    }
+    if (list == NULL && lru && (e = mln_shdict_ptr(d, b->tail)) != NULL) {
+        mln_shdict_unlink(d, b, e);
+        list = e;
+        ++(*n);
+    }
+    return list;
+}
+
+static inline void mln_shdict_free_list(mln_shdict_t *d, mln_shdict_entry_t *list, mln_u64_t n)
+{
+    mln_shdict_entry_t *e;
+
+    if (!n) return;
+    __atomic_sub_fetch(&(d->nr), n, __ATOMIC_RELAXED);
+    (void)d->lock(&(d->alloc_lock));
+    while ((e = list) != NULL) {
+        list = mln_shdict_ptr(d, e->next);
+        mln_alloc_free(e);
+    }
+    (void)d->unlock(&(d->alloc_lock));
+}
+
+/*
+ * Visit the buckets from the clock hand until something is evicted.
+ * Only one bucket lock is held at a time.
+ */
+static int mln_shdict_evict(mln_shdict_t *d)
+{
+    mln_u64_t i, n = 0, now = mln_shdict_now();
+    mln_shdict_bucket_t *b;
+    mln_shdict_entry_t *list;
+
+    for (i = 0; i < M_SHDICT_EVICT_NUM && i <= d->mask; ++i) {
+        b = mln_shdict_bucket(d, __atomic_fetch_add(&(d->hand), 1, __ATOMIC_RELAXED));
+        (void)d->lock(&(b->lock));
+        list = mln_shdict_bucket_evict(d, b, now, 1, &n);
+        (void)d->unlock(&(b->lock));
+        if (n) {
+            mln_shdict_free_list(d, list, n);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static mln_shdict_entry_t *
+mln_shdict_entry_new(mln_shdict_t *d, void *key, mln_u32_t klen, void *val, mln_u32_t vlen, mln_u64_t hval, mln_u64_t ttl)
+{
+    mln_shdict_entry_t *e;
+    mln_size_t size = sizeof(mln_shdict_entry_t) + klen + vlen;
+    int i;
+
+    for (i = 0; (e = mln_shdict_alloc(d, size)) == NULL; ++i) {
+        if (i >= M_SHDICT_EVICT_TRIES || !mln_shdict_evict(d))
+            return NULL;
+    }
+    e->prev = e->next = 0;
+    e->hval = hval;
+    e->expire = ttl? mln_shdict_now() + ttl: 0;
+    e->klen = klen;
+    e->vlen = vlen;
+    memcpy(mln_shdict_key(e), key, klen);
+    if (vlen) memcpy(mln_shdict_val(e), val, vlen);
+    return e;
+}
+
+/*
+ * external
+ */
+int mln_shdict_set(mln_shdict_t *d, void *key, mln_u32_t klen, void *val, mln_u32_t vlen, mln_u64_t ttl)
+{
+    mln_u64_t hval = mln_shdict_hash(key, klen);
+    mln_shdict_bucket_t *b = mln_shdict_bucket(d, hval);
+    mln_shdict_entry_t *e, *old;
+
+    /*overwrite in place if the length is unchanged*/
+    (void)d->lock(&(b->lock));
+    if ((e = mln_shdict_find(d, b, key, klen, hval)) != NULL && e->vlen == vlen) {
+        if (vlen) memcpy(mln_shdict_val(e), val, vlen);
+        e->expire = ttl? mln_shdict_now() + ttl: 0;
+        mln_shdict_touch(d, b, e);
+        (void)d->unlock(&(b->lock));
+        return 0;
+    }
+    (void)d->unlock(&(b->lock));
+
+    if ((e = mln_shdict_entry_new(d, key, klen, val, vlen, hval, ttl)) == NULL)
+        return -1;
+
+    (void)d->lock(&(b->lock));
+    if ((old = mln_shdict_find(d, b, key, klen, hval)) != NULL)
+        mln_shdict_unlink(d, b, old);
+    mln_shdict_link_head(d, b, e);
+    (void)d->unlock(&(b->lock));
+
+    if (old != NULL) mln_shdict_dealloc(d, old);
+    else __atomic_add_fetch(&(d->nr), 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+mln_s64_t mln_shdict_get(mln_shdict_t *d, void *key, mln_u32_t klen, void *buf, mln_u32_t size)
+{
+    mln_u64_t hval = mln_shdict_hash(key, klen);
+    mln_shdict_bucket_t *b = mln_shdict_bucket(d, hval);
+    mln_shdict_entry_t *e;
+    mln_s64_t ret;
+
+    (void)d->lock(&(b->lock));
+    if ((e = mln_shdict_find(d, b, key, klen, hval)) == NULL) {
+        (void)d->unlock(&(b->lock));
+        return -1;
+    }
+    if (mln_shdict_expired(e, mln_shdict_now())) {
+        mln_shdict_unlink(d, b, e);
+        (void)d->unlock(&(b->lock));
+        e->next = 0;
+        mln_shdict_free_list(d, e, 1);
+        return -1;
+    }
+    mln_shdict_touch(d, b, e);
+    ret = e->vlen;
+    if (buf != NULL && size) memcpy(buf, mln_shdict_val(e), size < e->vlen? size: e->vlen);
+    (void)d->unlock(&(b->lock));
+    return ret;
+}
+
+int mln_shdict_delete(mln_shdict_t *d, void *key, mln_u32_t klen)
+{
+    mln_u64_t hval = mln_shdict_hash(key, klen);
+    mln_shdict_bucket_t *b = mln_shdict_bucket(d, hval);
+    mln_shdict_entry_t *e;
+
+    (void)d->lock(&(b->lock));
+    if ((e = mln_shdict_find(d, b, key, klen, hval)) == NULL) {
+        (void)d->unlock(&(b->lock));
+        return -1;
+    }
+    mln_shdict_unlink(d, b, e);
+    (void)d->unlock(&(b->lock));
+
+    mln_shdict_free_list(d, e, 1);
+    return 0;
+}
+
+int mln_shdict_incr(mln_shdict_t *d, void *key, mln_u32_t klen, mln_s64_t delta, mln_s64_t *result)
+{
+    mln_u64_t hval = mln_shdict_hash(key, klen);
+    mln_shdict_bucket_t *b = mln_shdict_bucket(d, hval);
+    mln_shdict_entry_t *e, *ne = NULL;
+    mln_s64_t v;
+
+again:
+    (void)d->lock(&(b->lock));
+    e = mln_shdict_find(d, b, key, klen, hval);
+    if (e != NULL && mln_shdict_expired(e, mln_shdict_now())) {
+        mln_shdict_unlink(d, b, e);
+        e->next = 0;
+        (void)d->unlock(&(b->lock));
+        mln_shdict_free_list(d, e, 1);
+        goto again;
+    }
+    if (e != NULL) {
+        if (e->vlen != sizeof(v)) {
+            (void)d->unlock(&(b->lock));
+            if (ne != NULL) mln_shdict_dealloc(d, ne);
+            return -1;
+        }
+        memcpy(&v, mln_shdict_val(e), sizeof(v));
+        v += delta;
+        memcpy(mln_shdict_val(e), &v, sizeof(v));
+        mln_shdict_touch(d, b, e);
+        (void)d->unlock(&(b->lock));
+        /*someone else created it while we were allocating*/
+        if (ne != NULL) mln_shdict_dealloc(d, ne);
+    } else if (ne != NULL) {
+        mln_shdict_link_head(d, b, ne);
+        (void)d->unlock(&(b->lock));
+        __atomic_add_fetch(&(d->nr), 1, __ATOMIC_RELAXED);
+        v = delta;
+    } else {
+        (void)d->unlock(&(b->lock));
+        if ((ne = mln_shdict_entry_new(d, key, klen, &delta, sizeof(delta), hval, 0)) == NULL)
+            return -1;
+        goto again;
+    }
+
+    if (result != NULL) *result = v;
+    return 0;
+}
+
+mln_u64_t mln_shdict_expire(mln_shdict_t *d)
+{
+    mln_u64_t i, n, total = 0, now = mln_shdict_now();
+    mln_shdict_bucket_t *b = (mln_shdict_bucket_t *)mln_shdict_ptr(d, d->buckets);
+    mln_shdict_entry_t *list;
+
+    for (i = 0; i <= d->mask; ++i, ++b) {
+        n = 0;
+        (void)d->lock(&(b->lock));
+        list = mln_shdict_bucket_evict(d, b, now, 0, &n);
+        (void)d->unlock(&(b->lock));
+        mln_shdict_free_list(d, list, n);
+        total += n;
+    }
+    return total;
+}
+
@@ -36,6 +36,8 @@ int mln_websocket_init(mln_websocket_t *ws, mln_http_t *http)
     hattr.len_base = 37;
     hattr.expandable = 0;
     hattr.calc_prime = 0;
+    hattr.incremental = 0;
+    hattr.full_hash = 0;
 
     ws->http = http;
     ws->pool = mln_http_pool_get(http);
@@ -769,7 +771,7 @@ int mln_websocket_parse(mln_websocket_t *ws, mln_chain_t **in)
     for (i = 0; c != NULL; c = c->next) {
         if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
         p = c->buf->left_pos;
-        for (end = c->buf->end; p < end; ++p) {
+        for (end = c->buf->last; p < end; ++p) {
              if (i == 0) {
                  b1 = *p;
                  ++i;
@@ -797,7 +799,7 @@ again127:
             for (c = c->next; c != NULL; c = c->next) {
                 if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                 p = c->buf->left_pos;
-                end = c->buf->end;
+                end = c->buf->last;
                 break;
             }
             if (c == NULL) return M_WS_RET_NOTYET;
@@ -817,7 +819,7 @@ again126:
             for (c = c->next; c != NULL; c = c->next) {
                 if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                 p = c->buf->left_pos;
-                end = c->buf->end;
+                end = c->buf->last;
                 break;
             }
             if (c == NULL) return M_WS_RET_NOTYET;
@@ -838,7 +840,7 @@ againm:
             for (c = c->next; c != NULL; c = c->next) {
                 if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                 p = c->buf->left_pos;
-                end = c->buf->end;
+                end = c->buf->last;
                 break;
             }
             if (c == NULL) return M_WS_RET_NOTYET;
@@ -862,7 +864,7 @@ against:
                 for (c = c->next; c != NULL; c = c->next) {
                     if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                     p = c->buf->left_pos;
-                    end = c->buf->end;
+                    end = c->buf->last;
                     break;
                 }
                 if (c == NULL) return M_WS_RET_NOTYET;
@@ -888,7 +890,7 @@ againc:
             for (c = c->next; c != NULL; c = c->next) {
                 if (c->buf == NULL || mln_buf_left_size(c->buf) == 0) continue;
                 p = c->buf->left_pos;
-                end = c->buf->end;
+                end = c->buf->last;
                 break;
             }
             if (c == NULL) {